@@ -255,6 +255,7 @@ public:
       present();
     }
 
+    Log::info("I/O statistics:\n", m_io->getStats().toString());
     return 0;
   }
 
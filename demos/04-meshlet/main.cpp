@@ -54,7 +54,7 @@ public:
     m_archives.loadArchive(loadArchive())->wait();
 
     // Initialize transfer manager
-    m_transfer = GfxTransferManager(m_io, m_device, 16ull << 20);
+    m_transfer = GfxTransferManager(m_io, m_jobs, m_device, 16ull << 20);
 
     // Create state objects
     m_renderStateDepth = createRenderState(GfxScenePassType::eMainDepth);
@@ -392,6 +392,8 @@ public:
     }
 
     m_device->waitIdle();
+
+    Log::info("I/O statistics:\n", m_io->getStats().toString());
   }
 
 private:
@@ -1,4 +1,5 @@
 #include "gfx_asset.h"
+#include "gfx_asset_manager.h"
 
 namespace as {
 
@@ -6,4 +7,29 @@ GfxAssetIface::~GfxAssetIface() {
 
 }
 
+
+void GfxAssetIface::prefetch(
+        GfxAssetManagerIface          assetManager) {
+
+}
+
+
+bool GfxAssetIface::isStreamComplete() {
+  return true;
+}
+
+
+bool GfxAssetIface::requestLod(
+        GfxAssetManagerIface          assetManager,
+        uint32_t                      lod,
+        uint32_t                      frameId) {
+  return false;
+}
+
+
+uint64_t GfxAssetIface::getLodStreamSize(
+        uint32_t                      lod) const {
+  return 0u;
+}
+
 }
@@ -78,6 +78,24 @@ struct GfxAssetProperties {
   /** GPU memory allocation size of the asset. For certain asset
    *  types, this will always be zero. Used for eviction heuristics. */
   uint64_t gpuSize = 0ull;
+  /** Estimated amount of GPU memory that a stream request will
+   *  allocate, in bytes. Used to hold stream requests back until
+   *  they fit into the memory budget. */
+  uint64_t streamSize = 0ull;
+  /** Number of detail levels that can be made resident individually.
+   *  Zero or one if the asset does not support partial residency. */
+  uint32_t lodCount = 0u;
+  /** Currently resident detail level, where zero is the most
+   *  detailed level. Only meaningful if \c lodCount is not 0. */
+  uint32_t lod = 0u;
+  /** Whether a detail level change is still in progress. If set,
+   *  \c requestLod must be called again in a later frame in order
+   *  to complete the transition. */
+  bool lodPending = false;
+  /** Detail level that a pending transition will make resident.
+   *  Requesting this level does not allocate any GPU memory. Same
+   *  as \c lod if no new detail level is being streamed in. */
+  uint32_t lodTarget = 0u;
 };
 
 
@@ -132,11 +150,33 @@ public:
           GfxAssetManagerIface          assetManager,
           uint32_t                      frameId) = 0;
 
+  /**
+   * \brief Prefetches asset data
+   *
+   * Hint that the asset is likely to be streamed in soon. Assets
+   * may load data into system memory, but \e must not allocate any
+   * GPU resources. Will only be called if the asset is non-resident.
+   * The default implementation does nothing.
+   * \param [in] assetManager Asset manager
+   */
+  virtual void prefetch(
+          GfxAssetManagerIface          assetManager);
+
+  /**
+   * \brief Checks whether the stream request has completed
+   *
+   * Polled once per frame for assets with a pending stream request
+   * while the asset manager is locked, and thus must not stall. The
+   * default implementation returns \c true, in which case the asset
+   * must be usable as soon as \c requestStream returns.
+   * \returns \c true if the asset can be made resident immediately.
+   */
+  virtual bool isStreamComplete();
+
   /**
    * \brief Marks the asset as resident
    *
-   * Note that this may stall the calling thread until the
-   * asset becomes available for use. Will only be called if
+   * Must not stall the calling thread. Will only be called if
    * the asset has a completed stream request, or if it has
    * a pending eviction request but has not been evicted.
    * \param [in] assetManager Asset manager
@@ -157,6 +197,39 @@ public:
   virtual void evict(
           GfxAssetManagerIface          assetManager) = 0;
 
+  /**
+   * \brief Requests a different detail level
+   *
+   * Called once per frame for resident assets that support partial
+   * residency if the requested detail level differs from the resident
+   * one, or if a previous transition is still pending. Changes must
+   * happen asynchronously, and the asset must remain usable at its
+   * current detail level until the new one is ready. The default
+   * implementation does nothing.
+   * \param [in] assetManager Asset manager
+   * \param [in] lod Requested detail level
+   * \param [in] frameId Current frame ID on the timeline
+   * \returns \c true if the descriptor index or GPU address of the
+   *    asset has changed and asset lists need to be updated.
+   */
+  virtual bool requestLod(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      lod,
+          uint32_t                      frameId);
+
+  /**
+   * \brief Estimates memory required for a detail level
+   *
+   * Used to hold back requests for more detailed levels until they
+   * fit into the memory budget. The default implementation returns
+   * zero, which is appropriate if \c requestLod does not allocate.
+   * \param [in] lod Detail level
+   * \returns Estimated amount of GPU memory, in bytes, that a
+   *    \c requestLod call for the given level will allocate.
+   */
+  virtual uint64_t getLodStreamSize(
+          uint32_t                      lod) const;
+
 };
 
 
@@ -198,6 +271,12 @@ struct GfxAssetInfo {
    *  information is only useful if \c numActiveGroups is zero,
    *  and is used to implement an LRU scheme for asset eviction. */
   uint32_t activeFrameId = 0u;
+  /** Previous and next asset in the list of unused assets, stored
+   *  as raw asset handles. Only valid if \c unusedListed is set. */
+  uint32_t unusedPrev = ~0u;
+  uint32_t unusedNext = ~0u;
+  /** Whether the asset is currently in the list of unused assets */
+  bool unusedListed = false;
 };
 
 using GfxAsset = Handle<GfxAssetInfo>;
@@ -11,6 +11,9 @@ GfxAssetGeometryFromArchive::GfxAssetGeometryFromArchive(
 , m_archiveFile     (std::move(file)) {
   if (!m_geometry.deserialize(m_archiveFile->getInlineData()))
     throw Error("Failed to deserialize geometry data");
+
+  if (auto subFile = m_archiveFile->getSubFile(0))
+    m_streamSize = subFile->getSize();
 }
 
 
@@ -23,6 +26,7 @@ GfxAssetProperties GfxAssetGeometryFromArchive::getAssetInfo() const {
   GfxAssetProperties result = { };
   result.type = GfxAssetType::eGeometry;
   result.status = m_status;
+  result.streamSize = m_streamSize;
 
   if (m_buffer) {
     result.gpuAddress = m_buffer->getGpuAddress();
@@ -48,6 +52,7 @@ bool GfxAssetGeometryFromArchive::requestStream(
     GfxUsage::eTransferDst;
 
   m_buffer = assetManager.getDevice()->createBuffer(bufferDesc, GfxMemoryType::eAny);
+  assetManager.notifyMemoryAlloc(m_buffer->getMemoryInfo().size);
 
   m_streamBatchId = m_transferManager->uploadBuffer(std::move(subFile), m_buffer, 0);
   return false;
@@ -61,11 +66,19 @@ void GfxAssetGeometryFromArchive::requestEviction(
 }
 
 
-void GfxAssetGeometryFromArchive::makeResident(
+void GfxAssetGeometryFromArchive::prefetch(
         GfxAssetManagerIface          assetManager) {
-  // Ensure that all buffer data is valid at this point
-  m_transferManager->waitForCompletion(m_streamBatchId);
+  m_transferManager->prefetch(m_archiveFile->getSubFile(0));
+}
 
+
+bool GfxAssetGeometryFromArchive::isStreamComplete() {
+  return m_transferManager->getCompletedBatchId() >= m_streamBatchId;
+}
+
+
+void GfxAssetGeometryFromArchive::makeResident(
+        GfxAssetManagerIface          assetManager) {
   m_status = GfxAssetStatus::eResident;
 }
 
@@ -73,7 +86,11 @@ void GfxAssetGeometryFromArchive::makeResident(
 void GfxAssetGeometryFromArchive::evict(
         GfxAssetManagerIface          assetManager) {
   m_status = GfxAssetStatus::eNonResident;
-  m_buffer = GfxBuffer();
+
+  if (m_buffer) {
+    assetManager.notifyMemoryFree(m_buffer->getMemoryInfo().size);
+    m_buffer = GfxBuffer();
+  }
 }
 
 
@@ -91,6 +108,12 @@ GfxAssetTextureFromArchive::GfxAssetTextureFromArchive(
 , m_archiveFile     (std::move(file)) {
   if (!m_desc.deserialize(m_archiveFile->getInlineData()))
     throw Error("Failed to deserialize texture metadata");
+
+  // Initial stream requests only load the least detailed mips
+  for (uint32_t l = 0; l < m_desc.layers; l++) {
+    if (auto subFile = getSubFile(l, getMaxLod()))
+      m_streamSize += subFile->getSize();
+  }
 }
 
 
@@ -103,12 +126,20 @@ GfxAssetProperties GfxAssetTextureFromArchive::getAssetInfo() const {
   GfxAssetProperties result = { };
   result.type = GfxAssetType::eTexture;
   result.status = m_status;
+  result.streamSize = m_streamSize;
+  result.lodCount = getMaxLod() + 1u;
+  result.lod = m_imageMip;
+  result.lodPending = m_pendingImage || !m_retiredImages.empty();
+  result.lodTarget = m_pendingImage ? m_pendingMip : m_imageMip;
 
   if (m_image) {
     result.descriptorIndex = m_descriptor;
     result.gpuSize = m_image->getMemoryInfo().size;
   }
 
+  if (m_pendingImage)
+    result.gpuSize += m_pendingImage->getMemoryInfo().size;
+
   return result;
 }
 
@@ -116,68 +147,43 @@ GfxAssetProperties GfxAssetTextureFromArchive::getAssetInfo() const {
 bool GfxAssetTextureFromArchive::requestStream(
         GfxAssetManagerIface          assetManager,
         uint32_t                      frameId) {
-  // TODO support some sort of size cap
   m_status = GfxAssetStatus::eStreamRequest;
 
-  GfxImageDesc imageDesc = { };
-  m_desc.fillImageDesc(imageDesc, 0);
-
-  imageDesc.debugName = m_archiveFile->getName();
-  imageDesc.usage |= GfxUsage::eShaderResource |
-    GfxUsage::eDecompressionDst |
-    GfxUsage::eTransferDst;
-
-  m_image = assetManager.getDevice()->createImage(imageDesc, GfxMemoryType::eAny);
+  // Only stream in the least detailed mip levels for now, the asset
+  // manager will request more detail once the texture is resident.
+  m_imageMip = getMaxLod();
+  m_image = createImage(assetManager, m_imageMip);
+  m_descriptor = createDescriptor(assetManager, m_image, m_imageMip);
+  m_streamQueue = GfxTransferQueue::eUrgent;
+  m_streamBatchId = streamImage(m_streamQueue, m_image, m_imageMip);
+  return false;
+}
 
-  GfxFormatInfo formatInfo = Gfx::getFormatInfo(m_desc.format);
 
-  GfxImageViewDesc viewDesc = { };
-  viewDesc.type = m_desc.type;
-  viewDesc.format = m_desc.format;
-  viewDesc.usage = GfxUsage::eShaderResource;
-  viewDesc.subresource.aspects = formatInfo.aspects;
-  viewDesc.subresource.mipCount = m_desc.mips;
-  viewDesc.subresource.layerCount = m_desc.layers;
+void GfxAssetTextureFromArchive::requestEviction(
+        GfxAssetManagerIface          assetManager,
+        uint32_t                      frameId) {
+  m_status = GfxAssetStatus::eEvictRequest;
+}
 
-  GfxImageView view = m_image->createView(viewDesc);
-  m_descriptor = assetManager.createDescriptor(GfxAssetType::eTexture, view->getDescriptor());
 
+void GfxAssetTextureFromArchive::prefetch(
+        GfxAssetManagerIface          assetManager) {
+  // Stream requests only load the least detailed mips
   for (uint32_t l = 0; l < m_desc.layers; l++) {
-    for (uint32_t m = 0; m < std::min(m_desc.mipTailStart + 1u, m_desc.mips); m++) {
-      auto subFile = getSubFile(l, m);
-
-      if (!subFile) {
-        Log::err(m_archiveFile->getName(), ": No sub file found for layer ", l, ", mip ", m);
-        continue;
-      }
-
-      GfxImageSubresource subresource = { };
-      subresource.aspects = formatInfo.aspects;
-      subresource.mipIndex = m;
-      subresource.mipCount = (m >= m_desc.mipTailStart) ? m_desc.mips - m : 1u;
-      subresource.layerIndex = l;
-      subresource.layerCount = 1u;
-
-      m_streamBatchId = m_transferManager->uploadImage(std::move(subFile), m_image, subresource);
-    }
+    for (uint32_t m = getMaxLod(); m < std::min(m_desc.mipTailStart + 1u, m_desc.mips); m++)
+      m_transferManager->prefetch(getSubFile(l, m));
   }
-
-  return false;
 }
 
 
-void GfxAssetTextureFromArchive::requestEviction(
-        GfxAssetManagerIface          assetManager,
-        uint32_t                      frameId) {
-  m_status = GfxAssetStatus::eEvictRequest;
+bool GfxAssetTextureFromArchive::isStreamComplete() {
+  return m_transferManager->getCompletedBatchId(m_streamQueue) >= m_streamBatchId;
 }
 
 
 void GfxAssetTextureFromArchive::makeResident(
         GfxAssetManagerIface          assetManager) {
-  // Ensure that all streamed data is valid at this point
-  m_transferManager->waitForCompletion(m_streamBatchId);
-
   m_status = GfxAssetStatus::eResident;
 }
 
@@ -185,7 +191,13 @@ void GfxAssetTextureFromArchive::makeResident(
 void GfxAssetTextureFromArchive::evict(
         GfxAssetManagerIface          assetManager) {
   m_status = GfxAssetStatus::eNonResident;
-  m_image = GfxImage();
+
+  // The GPU no longer uses any of the images for rendering at
+  // this point. Pending uploads keep their destination image
+  // alive until the transfer batch has completed.
+  destroyRetiredImages(assetManager, ~0u);
+  destroyImage(assetManager, m_pendingImage);
+  destroyImage(assetManager, m_image);
 
   if (m_descriptor) {
     assetManager.freeDescriptor(GfxAssetType::eTexture, m_descriptor);
@@ -194,6 +206,69 @@ void GfxAssetTextureFromArchive::evict(
 }
 
 
+bool GfxAssetTextureFromArchive::requestLod(
+        GfxAssetManagerIface          assetManager,
+        uint32_t                      lod,
+        uint32_t                      frameId) {
+  destroyRetiredImages(assetManager, assetManager.getLastCompletedFrameId());
+
+  if (m_status != GfxAssetStatus::eResident)
+    return false;
+
+  uint32_t firstMip = std::min(lod, getMaxLod());
+  bool descriptorChanged = false;
+
+  if (m_pendingImage) {
+    // Keep using the current image until the upload is done
+    if (m_transferManager->getCompletedBatchId(m_streamQueue) < m_streamBatchId)
+      return false;
+
+    // Swap in the new image. The descriptor pool will not reuse
+    // the old descriptor index until the current frame completes.
+    m_retiredImages.push_back({ frameId, std::move(m_image) });
+    assetManager.freeDescriptor(GfxAssetType::eTexture, m_descriptor);
+
+    m_image = std::move(m_pendingImage);
+    m_imageMip = m_pendingMip;
+    m_descriptor = createDescriptor(assetManager, m_image, m_imageMip);
+
+    m_pendingImage = GfxImage();
+    descriptorChanged = true;
+  }
+
+  // Images cannot be resized in place, so create a new image with
+  // the requested mip levels. Since coarse mip levels are small,
+  // re-uploading them is cheaper than copying them on the GPU.
+  if (firstMip != m_imageMip) {
+    m_pendingMip = firstMip;
+    m_pendingImage = createImage(assetManager, m_pendingMip);
+    // The texture is already usable, so avoid delaying stream
+    // requests for other assets with additional detail.
+    m_streamQueue = GfxTransferQueue::eBackground;
+    m_streamBatchId = streamImage(m_streamQueue, m_pendingImage, m_pendingMip);
+  }
+
+  return descriptorChanged;
+}
+
+
+uint64_t GfxAssetTextureFromArchive::getLodStreamSize(
+        uint32_t                      lod) const {
+  uint32_t maxLod = getMaxLod();
+  uint64_t size = 0u;
+
+  // The mip tail is stored in a single sub file
+  for (uint32_t l = 0; l < m_desc.layers; l++) {
+    for (uint32_t m = std::min(lod, maxLod); m <= maxLod; m++) {
+      if (auto subFile = getSubFile(l, m))
+        size += subFile->getSize();
+    }
+  }
+
+  return size;
+}
+
+
 FourCC GfxAssetTextureFromArchive::getSubFileIdentifier(
         uint32_t                      layer,
         int32_t                       mip) {
@@ -222,6 +297,105 @@ IoArchiveSubFileRef GfxAssetTextureFromArchive::getSubFile(
 }
 
 
+uint32_t GfxAssetTextureFromArchive::getMaxLod() const {
+  return std::min(m_desc.mipTailStart, m_desc.mips - 1u);
+}
+
+
+GfxImage GfxAssetTextureFromArchive::createImage(
+        GfxAssetManagerIface          assetManager,
+        uint32_t                      firstMip) {
+  GfxImageDesc imageDesc = { };
+  m_desc.fillImageDesc(imageDesc, firstMip);
+
+  imageDesc.debugName = m_archiveFile->getName();
+  imageDesc.usage |= GfxUsage::eShaderResource |
+    GfxUsage::eDecompressionDst |
+    GfxUsage::eTransferDst;
+
+  GfxImage image = assetManager.getDevice()->createImage(imageDesc, GfxMemoryType::eAny);
+  assetManager.notifyMemoryAlloc(image->getMemoryInfo().size);
+  return image;
+}
+
+
+void GfxAssetTextureFromArchive::destroyImage(
+        GfxAssetManagerIface          assetManager,
+        GfxImage&                     image) {
+  if (image) {
+    assetManager.notifyMemoryFree(image->getMemoryInfo().size);
+    image = GfxImage();
+  }
+}
+
+
+uint32_t GfxAssetTextureFromArchive::createDescriptor(
+        GfxAssetManagerIface          assetManager,
+  const GfxImage&                     image,
+        uint32_t                      firstMip) {
+  GfxFormatInfo formatInfo = Gfx::getFormatInfo(m_desc.format);
+
+  GfxImageViewDesc viewDesc = { };
+  viewDesc.type = m_desc.type;
+  viewDesc.format = m_desc.format;
+  viewDesc.usage = GfxUsage::eShaderResource;
+  viewDesc.subresource.aspects = formatInfo.aspects;
+  viewDesc.subresource.mipCount = m_desc.mips - firstMip;
+  viewDesc.subresource.layerCount = m_desc.layers;
+
+  GfxImageView view = image->createView(viewDesc);
+  return assetManager.createDescriptor(GfxAssetType::eTexture, view->getDescriptor());
+}
+
+
+uint64_t GfxAssetTextureFromArchive::streamImage(
+        GfxTransferQueue              queue,
+  const GfxImage&                     image,
+        uint32_t                      firstMip) {
+  GfxFormatInfo formatInfo = Gfx::getFormatInfo(m_desc.format);
+  uint64_t batchId = 0u;
+
+  // Mip levels are relative to the first mip level in the image.
+  // If the image starts within the mip tail, the tail is uploaded
+  // as a whole, which works since firstMip never exceeds its start.
+  for (uint32_t l = 0; l < m_desc.layers; l++) {
+    for (uint32_t m = firstMip; m < std::min(m_desc.mipTailStart + 1u, m_desc.mips); m++) {
+      auto subFile = getSubFile(l, m);
+
+      if (!subFile) {
+        Log::err(m_archiveFile->getName(), ": No sub file found for layer ", l, ", mip ", m);
+        continue;
+      }
+
+      GfxImageSubresource subresource = { };
+      subresource.aspects = formatInfo.aspects;
+      subresource.mipIndex = m - firstMip;
+      subresource.mipCount = (m >= m_desc.mipTailStart) ? m_desc.mips - m : 1u;
+      subresource.layerIndex = l;
+      subresource.layerCount = 1u;
+
+      batchId = m_transferManager->uploadImage(queue, std::move(subFile), image, subresource);
+    }
+  }
+
+  return batchId;
+}
+
+
+void GfxAssetTextureFromArchive::destroyRetiredImages(
+        GfxAssetManagerIface          assetManager,
+        uint32_t                      lastFrameId) {
+  for (auto i = m_retiredImages.begin(); i != m_retiredImages.end(); ) {
+    if (i->first <= lastFrameId) {
+      destroyImage(assetManager, i->second);
+      i = m_retiredImages.erase(i);
+    } else {
+      i++;
+    }
+  }
+}
+
+
 
 
 GfxAssetSamplerFromArchive::GfxAssetSamplerFromArchive(
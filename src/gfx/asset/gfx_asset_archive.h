@@ -52,6 +52,19 @@ public:
           GfxAssetManagerIface          assetManager,
           uint32_t                      frameId) override;
 
+  /**
+   * \brief Prefetches sub-files used by stream requests
+   * \param [in] assetManager Asset manager
+   */
+  void prefetch(
+          GfxAssetManagerIface          assetManager) override;
+
+  /**
+   * \brief Checks whether the upload has completed
+   * \returns \c true if all data has been uploaded
+   */
+  bool isStreamComplete() override;
+
   /**
    * \brief Marks the asset as resident
    *
@@ -85,6 +98,7 @@ private:
   GfxBuffer                   m_buffer;
 
   uint64_t                    m_streamBatchId = 0u;
+  uint64_t                    m_streamSize = 0u;
 
 };
 
@@ -111,7 +125,9 @@ public:
   /**
    * \brief Begins stream request for the asset
    *
-   * Creates the GPU image and streams the selected mip levels.
+   * Creates a GPU image that only contains the mip tail, or the
+   * smallest mip level if there is none, and streams it in. More
+   * detailed mip levels are streamed in later on request.
    * \param [in] assetManager Asset manager
    * \param [in] frameId Current frame ID on the timeline
    * \returns \c true if the asset can be made resident immediately.
@@ -130,6 +146,19 @@ public:
           GfxAssetManagerIface          assetManager,
           uint32_t                      frameId) override;
 
+  /**
+   * \brief Prefetches sub-files used by stream requests
+   * \param [in] assetManager Asset manager
+   */
+  void prefetch(
+          GfxAssetManagerIface          assetManager) override;
+
+  /**
+   * \brief Checks whether the upload has completed
+   * \returns \c true if all data has been uploaded
+   */
+  bool isStreamComplete() override;
+
   /**
    * \brief Marks the asset as resident
    *
@@ -146,6 +175,36 @@ public:
   void evict(
           GfxAssetManagerIface          assetManager) override;
 
+  /**
+   * \brief Requests a different set of resident mip levels
+   *
+   * The detail level is the index of the most detailed resident
+   * mip level. Changing it creates a new image that contains all
+   * mip levels from there on and streams them in. Once the upload
+   * has completed, the new image replaces the current one, which
+   * is destroyed once the GPU no longer uses it.
+   * \param [in] assetManager Asset manager
+   * \param [in] lod Index of most detailed mip level to keep
+   * \param [in] frameId Current frame ID on the timeline
+   * \returns \c true if the descriptor has changed
+   */
+  bool requestLod(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      lod,
+          uint32_t                      frameId) override;
+
+  /**
+   * \brief Estimates memory required for a set of mip levels
+   *
+   * The current image stays alive until the new one is ready,
+   * so this is the size of all mip levels that the new image
+   * contains, not the difference to the current image.
+   * \param [in] lod Index of most detailed mip level to keep
+   * \returns Estimated size of the new image
+   */
+  uint64_t getLodStreamSize(
+          uint32_t                      lod) const override;
+
   /**
    * \brief Computes sub file idenfitier for a subresource
    *
@@ -167,13 +226,45 @@ private:
 
   GfxTextureDesc              m_desc;
   GfxImage                    m_image;
+  uint32_t                    m_imageMip = 0u;
 
+  GfxImage                    m_pendingImage;
+  uint32_t                    m_pendingMip = 0u;
+
+  GfxTransferQueue            m_streamQueue = GfxTransferQueue::eUrgent;
   uint64_t                    m_streamBatchId = 0u;
+  uint64_t                    m_streamSize = 0u;
+
+  std::vector<std::pair<uint32_t, GfxImage>> m_retiredImages;
 
   IoArchiveSubFileRef getSubFile(
           uint32_t                      layer,
           uint32_t                      mip) const;
 
+  uint32_t getMaxLod() const;
+
+  GfxImage createImage(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      firstMip);
+
+  void destroyImage(
+          GfxAssetManagerIface          assetManager,
+          GfxImage&                     image);
+
+  uint32_t createDescriptor(
+          GfxAssetManagerIface          assetManager,
+    const GfxImage&                     image,
+          uint32_t                      firstMip);
+
+  uint64_t streamImage(
+          GfxTransferQueue              queue,
+    const GfxImage&                     image,
+          uint32_t                      firstMip);
+
+  void destroyRetiredImages(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      lastFrameId);
+
 };
 
 
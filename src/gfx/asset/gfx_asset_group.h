@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <shared_mutex>
 
 #include "../gfx_buffer_pool.h"
@@ -119,6 +120,9 @@ enum class GfxAssetGroupStatus : uint32_t {
   /** The asset list is active and has ownership of all
    *  assets, so that assets will not be evicted. */
   eActive         = (1u << 1),
+  /** A stream request for the asset list has been deferred
+   *  because it does not fit into the memory budget. */
+  eDeferred       = (1u << 2),
 
   eFlagEnum = 0u
 };
@@ -161,6 +165,14 @@ struct GfxAssetGroupInfo {
    *  accessed in the current frame regardless. This is still useful
    *  for eviction heuristics. */
   uint32_t lastUseFrameId = 0u;
+  /** Importance of the most recent stream request for this
+   *  group. Used to decide which assets get more detail
+   *  when not everything fits into the memory budget. */
+  float importance = 0.0f;
+  /** Time of the stream request that has most recently been
+   *  executed for this group, if it has not become resident
+   *  yet. Used to measure streaming latency. */
+  std::chrono::steady_clock::time_point streamRequestTime = { };
 };
 
 using GfxAssetGroup = Handle<GfxAssetGroupInfo>;
@@ -1,7 +1,90 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "../../util/util_log.h"
+#include "../../util/util_math.h"
+#include "../../util/util_string.h"
+
 #include "gfx_asset_manager.h"
 
 namespace as {
 
+std::chrono::microseconds GfxAssetStats::getStreamLatencyPercentile(
+        double                        percentile) const {
+  uint64_t total = 0;
+
+  for (uint64_t count : streamLatencyHistogram)
+    total += count;
+
+  if (!total)
+    return std::chrono::microseconds(0);
+
+  uint64_t threshold = uint64_t(std::ceil(double(total) * std::clamp(percentile, 0.0, 1.0)));
+  threshold = std::max<uint64_t>(threshold, 1u);
+
+  uint64_t accum = 0;
+
+  for (uint32_t i = 0; i < LatencyBucketCount; i++) {
+    accum += streamLatencyHistogram[i];
+
+    if (accum >= threshold)
+      return std::chrono::microseconds(1ull << i);
+  }
+
+  return std::chrono::microseconds(1ull << (LatencyBucketCount - 1));
+}
+
+
+std::string GfxAssetStats::getCsvHeader() {
+  return "frame,non_resident,non_resident_bytes,resident,resident_bytes,"
+    "stream_request,stream_request_bytes,evict_request,evict_request_bytes,"
+    "gpu_memory_budget,gpu_memory_used,evicted_assets,evicted_bytes,"
+    "resident_groups,stream_latency_p50_us,stream_latency_p99_us,"
+    "feedback_time_us,request_queue,stream_queue,deferred_streams,pending_assets";
+}
+
+
+std::string GfxAssetStats::toCsv() const {
+  return strcat(frameId, ",",
+    assetCount[0], ",", assetBytes[0], ",", assetCount[1], ",", assetBytes[1], ",",
+    assetCount[2], ",", assetBytes[2], ",", assetCount[3], ",", assetBytes[3], ",",
+    gpuMemoryBudget, ",", gpuMemoryUsed, ",", evictedAssets, ",", evictedBytes, ",",
+    residentGroups, ",", getStreamLatencyPercentile(0.5).count(), ",",
+    getStreamLatencyPercentile(0.99).count(), ",", feedbackTime.count(), ",",
+    requestQueueSize, ",", streamQueueSize, ",", deferredStreamCount, ",", pendingAssetCount);
+}
+
+
+std::string GfxAssetStats::toJson() const {
+  std::string histogram;
+
+  for (uint32_t i = 0; i < LatencyBucketCount; i++)
+    histogram += strcat(i ? "," : "", streamLatencyHistogram[i]);
+
+  return strcat("{\"frame\":", frameId,
+    ",\"assets\":{",
+      "\"nonResident\":{\"count\":", assetCount[0], ",\"bytes\":", assetBytes[0], "},",
+      "\"resident\":{\"count\":", assetCount[1], ",\"bytes\":", assetBytes[1], "},",
+      "\"streamRequest\":{\"count\":", assetCount[2], ",\"bytes\":", assetBytes[2], "},",
+      "\"evictRequest\":{\"count\":", assetCount[3], ",\"bytes\":", assetBytes[3], "}}",
+    ",\"gpuMemoryBudget\":", gpuMemoryBudget,
+    ",\"gpuMemoryUsed\":", gpuMemoryUsed,
+    ",\"evictedAssets\":", evictedAssets,
+    ",\"evictedBytes\":", evictedBytes,
+    ",\"residentGroups\":", residentGroups,
+    ",\"streamLatencyHistogramUs\":[", histogram, "]",
+    ",\"feedbackTimeUs\":", feedbackTime.count(),
+    ",\"feedbackTimeTotalUs\":", feedbackTimeTotal.count(),
+    ",\"requestQueue\":", requestQueueSize,
+    ",\"streamQueue\":", streamQueueSize,
+    ",\"deferredStreams\":", deferredStreamCount,
+    ",\"pendingAssets\":", pendingAssetCount, "}");
+}
+
+
+
+
 GfxAssetManager::GfxAssetManager(
       GfxDevice                       device)
 : m_device          (std::move(device))
@@ -9,8 +92,7 @@ GfxAssetManager::GfxAssetManager(
 , m_samplerPool     (m_device, "Sampler pool", GfxShaderBindingType::eSampler, SamplerDescriptorCount)
 , m_texturePool     (m_device, "Texture pool", GfxShaderBindingType::eResourceImageView, TextureDescriptorCount)
 , m_groupBuffers    (m_device, getGroupBufferDesc(), GfxMemoryType::eAny)
-, m_requestWorker   ([this] { runRequestWorker(); })
-, m_residencyWorker ([this] { runResidencyWorker(); }) {
+, m_requestWorker   ([this] { runRequestWorker(); }) {
 
 }
 
@@ -21,10 +103,49 @@ GfxAssetManager::~GfxAssetManager() {
 
   enqueueRequest(request);
   m_requestWorker.join();
+}
+
+
+void GfxAssetManager::setGpuMemoryBudget(
+        uint64_t                      budget) {
+  std::unique_lock lock(m_assetMutex);
+  m_gpuMemoryBudget = budget;
+}
 
-  // Invalid asset handle to stop the residency worker
-  enqueueStreamAsset(GfxAsset());
-  m_residencyWorker.join();
+
+GfxAssetBudgetStats GfxAssetManager::getBudgetStats() {
+  std::unique_lock lock(m_assetMutex);
+  return m_budgetStatsLastFrame;
+}
+
+
+GfxAssetStats GfxAssetManager::getStats() {
+  std::unique_lock lock(m_assetMutex);
+  return getStatsLocked();
+}
+
+
+bool GfxAssetManager::setStatsDump(
+  const std::filesystem::path&        path,
+        GfxAssetStatsFormat           format) {
+  std::unique_lock lock(m_statsFileMutex);
+
+  m_statsFile = std::ofstream();
+  m_statsFormat = format;
+
+  if (!path.empty()) {
+    m_statsFile = std::ofstream(path, std::ios::trunc);
+
+    if (!m_statsFile.is_open())
+      Log::err("Failed to open asset statistics file ", path);
+    else if (format == GfxAssetStatsFormat::eCsv)
+      m_statsFile << GfxAssetStats::getCsvHeader() << '\n';
+  }
+
+  std::unique_lock assetLock(m_assetMutex);
+  m_statsDump = m_statsFile.is_open();
+
+  return m_statsDump || path.empty();
 }
 
 
@@ -50,6 +171,49 @@ GfxAsset GfxAssetManager::findAsset(
 }
 
 
+void GfxAssetManager::createAssets(
+        uint32_t                      assetCount,
+        GfxAssetDesc*                 descs,
+        GfxAsset*                     assets) {
+  std::vector<uint32_t> indices(assetCount);
+  m_assets.allocator.allocate(assetCount, indices.data());
+
+  for (uint32_t i = 0; i < assetCount; i++) {
+    auto& assetInfo = m_assets.map.emplace(indices[i]);
+    assetInfo.iface = std::move(descs[i].iface);
+  }
+
+  std::unique_lock lock(m_assetLutMutex);
+  m_assetLut.reserve(m_assetLut.size() + assetCount);
+
+  for (uint32_t i = 0; i < assetCount; i++) {
+    if (!m_assetLut.insert({ descs[i].name, GfxAsset(indices[i]) }).second)
+      Log::err("Asset name ", descs[i].name.c_str(), " not unique");
+
+    assets[i] = GfxAsset(indices[i]);
+  }
+}
+
+
+void GfxAssetManager::reserve(
+        uint32_t                      assetCount,
+        uint32_t                      groupCount,
+        uint32_t                      groupAssetCount) {
+  { std::unique_lock lock(m_assetLutMutex);
+    m_assetLut.reserve(m_assetLut.size() + assetCount);
+  }
+
+  { std::unique_lock lock(m_groupLutMutex);
+    m_groupLut.reserve(m_groupLut.size() + groupCount);
+  }
+
+  { std::unique_lock lock(m_assetMutex);
+    m_groupList.reserve(m_groupList.size() + groupAssetCount);
+    m_dirtyGroups.reserve(m_dirtyGroups.size() + groupCount);
+  }
+}
+
+
 GfxAssetGroup GfxAssetManager::createAssetGroup(
   const GfxSemanticName&              name,
         GfxAssetGroupType             type,
@@ -65,31 +229,52 @@ GfxAssetGroup GfxAssetManager::createAssetGroup(
 
   // Also register asset group with each asset
   { std::unique_lock lock(m_assetMutex);
+    dwordCount = addGroupAssetsLocked(groupIndex, assetCount, assets);
+  }
 
-    for (uint32_t i = 0; i < assetCount; i++) {
-      auto& assetInfo = getAsset(assets[i]);
+  allocateGroupBuffer(groupInfo, type, dwordCount);
+  return registerNamedGroup(name, groupIndex);
+}
 
-      groupInfo.assets[i].asset = assets[i];
-      groupInfo.assets[i].type = gfxGetAssetRefType(assetInfo.iface->getAssetInfo().type);
-      groupInfo.assets[i].index = uint24_t(dwordCount);
 
-      dwordCount += gfxGetAssetRefSize(groupInfo.assets[i].type) / sizeof(uint32_t);
+void GfxAssetManager::createAssetGroups(
+        uint32_t                      groupCount,
+  const GfxAssetGroupDesc*            descs,
+        GfxAssetGroup*                groups) {
+  std::vector<uint32_t> indices(groupCount);
+  m_groups.allocator.allocate(groupCount, indices.data());
 
-      m_groupList.insert({ assets[i], GfxAssetGroup(groupIndex) });
-    }
+  std::vector<uint32_t> dwordCounts(groupCount);
+  size_t groupAssetCount = 0u;
+
+  for (uint32_t i = 0; i < groupCount; i++) {
+    auto& groupInfo = m_groups.map.emplace(indices[i]);
+    groupInfo.assets.resize(descs[i].assetCount);
 
-    m_dirtyGroups.push_back(GfxAssetGroup(groupIndex));
+    groupAssetCount += descs[i].assetCount;
   }
 
-  // Pad buffer size by one dword in order to allow shaders to unconditionally
-  // read 8 bytes at once. This will rarely affect the overall size since we
-  // pad the allocation anyway in order to avoid false data sharing.
-  uint64_t dataSize = sizeof(GfxAssetListHeader) + sizeof(uint32_t) * (dwordCount + 1u);
-  groupInfo.type = type;
-  groupInfo.bufferSlice = m_groupBuffers.alloc(dataSize, 256ull);
-  groupInfo.dwordCount = dwordCount;
+  { std::unique_lock lock(m_assetMutex);
 
-  return registerNamedGroup(name, groupIndex);
+    m_groupList.reserve(m_groupList.size() + groupAssetCount);
+    m_dirtyGroups.reserve(m_dirtyGroups.size() + groupCount);
+
+    for (uint32_t i = 0; i < groupCount; i++)
+      dwordCounts[i] = addGroupAssetsLocked(indices[i], descs[i].assetCount, descs[i].assets);
+  }
+
+  for (uint32_t i = 0; i < groupCount; i++)
+    allocateGroupBuffer(getAssetGroup(GfxAssetGroup(indices[i])), descs[i].type, dwordCounts[i]);
+
+  std::unique_lock lock(m_groupLutMutex);
+  m_groupLut.reserve(m_groupLut.size() + groupCount);
+
+  for (uint32_t i = 0; i < groupCount; i++) {
+    if (!m_groupLut.insert({ descs[i].name, GfxAssetGroup(indices[i]) }).second)
+      Log::err("Asset group name ", descs[i].name.c_str(), " not unique");
+
+    groups[i] = GfxAssetGroup(indices[i]);
+  }
 }
 
 
@@ -108,8 +293,21 @@ GfxAssetGroup GfxAssetManager::findAssetGroup(
 
 void GfxAssetManager::streamAssetGroup(
         GfxAssetGroup                 group) {
+  enqueueStreamRequest(group, 0.0f);
+}
+
+
+void GfxAssetManager::streamAssetGroup(
+        GfxAssetGroup                 group,
+        float                         importance) {
+  enqueueStreamRequest(group, importance);
+}
+
+
+void GfxAssetManager::prefetchAssetGroup(
+        GfxAssetGroup                 group) {
   GfxAssetRequest request = { };
-  request.type = GfxAssetRequestType::eRequestStream;
+  request.type = GfxAssetRequestType::eRequestPrefetch;
   request.assetGroup = group;
 
   enqueueRequest(request);
@@ -122,7 +320,15 @@ void GfxAssetManager::evictAssetGroup(
   request.type = GfxAssetRequestType::eRequestEvict;
   request.assetGroup = group;
 
-  enqueueRequest(request);
+  std::unique_lock lock(m_requestLock);
+
+  // A pending stream request must not be executed after the
+  // eviction request, so cancel it. The eviction request still
+  // needs to be executed in case the group is already active.
+  cancelStreamRequestLocked(group);
+
+  m_requestQueue.push(request);
+  m_requestCond.notify_one();
 }
 
 
@@ -149,9 +355,35 @@ void GfxAssetManager::commitUpdates(
   // while we're committing pending changes to any asset list. This is
   // especially important in order to make the new frame IDs visible.
   std::unique_lock lock(m_assetMutex);
+
+  // Finalize budget statistics for the previous frame
+  m_budgetStats.frameId = m_currFrameId;
+  m_budgetStats.gpuMemoryBudget = m_gpuMemoryBudget;
+  m_budgetStats.gpuMemoryUsed = m_gpuMemoryUsed;
+  m_budgetStats.deferredGroups = m_deferredStreams.size();
+
+  for (const auto& e : m_deferredStreams)
+    m_budgetStats.deferredBytes += computeStreamSize(e.assetGroup);
+
+  m_budgetStatsLastFrame = m_budgetStats;
+  m_budgetStats = GfxAssetBudgetStats();
+
+  // Only take a snapshot while holding the lock. Statistics are
+  // formatted and written after unlocking so that file I/O does
+  // not block the request worker.
+  GfxAssetStats stats;
+  bool statsDump = m_statsDump;
+
+  if (statsDump)
+    stats = getStatsLocked();
+
   m_currFrameId = currFrameId;
   m_lastFrameId = lastFrameId;
 
+  // Make assets with completed stream requests resident so
+  // that asset lists can be updated in the same frame
+  pollPendingAssets();
+
   context->beginDebugLabel("Clear asset feedback buffer", 0xffffb0e3);
   uint64_t feedbackSize = computeFeedbackBufferSize();
 
@@ -199,6 +431,25 @@ void GfxAssetManager::commitUpdates(
 
     groupInfo.status.set(GfxAssetGroupStatus::eResident, resident);
     groupInfo.lastCommitFrameId = currFrameId;
+
+    if (resident && groupInfo.streamRequestTime != std::chrono::steady_clock::time_point()) {
+      auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - groupInfo.streamRequestTime);
+
+      m_budgetStats.residentGroups += 1u;
+      m_budgetStats.totalTimeToResident += latency;
+      m_budgetStats.maxTimeToResident = std::max(m_budgetStats.maxTimeToResident, latency);
+
+      // Bucket i covers the range [2^(i-1), 2^i) microseconds
+      uint64_t us = uint64_t(std::max<int64_t>(latency.count(), 0));
+      uint32_t bucket = us ? uint32_t(findmsb(us) + 1) : 0u;
+      bucket = std::min(bucket, GfxAssetStats::LatencyBucketCount - 1);
+
+      m_stats.residentGroups += 1u;
+      m_stats.streamLatencyHistogram[bucket] += 1u;
+
+      groupInfo.streamRequestTime = std::chrono::steady_clock::time_point();
+    }
   }
 
   context->endDebugLabel();
@@ -209,6 +460,15 @@ void GfxAssetManager::commitUpdates(
   request.type = GfxAssetRequestType::eEvictUnused;
 
   enqueueRequest(request);
+
+  request.type = GfxAssetRequestType::eUpdateLod;
+
+  enqueueRequest(request);
+
+  lock.unlock();
+
+  if (statsDump)
+    writeStats(stats);
 }
 
 
@@ -230,6 +490,8 @@ void GfxAssetManager::processFeedback(
         uint32_t                      frameId) {
   std::unique_lock lock(m_assetMutex);
 
+  auto startTime = std::chrono::steady_clock::now();
+
   auto data = reinterpret_cast<const uint32_t*>(
     feedback.map(GfxUsage::eCpuRead, 0));
 
@@ -267,6 +529,10 @@ void GfxAssetManager::processFeedback(
     m_feedbackGroups[i - 1] = GfxAssetGroup(data[i]);
 
   feedback.unmap(GfxUsage::eCpuRead);
+
+  m_stats.feedbackTime = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - startTime);
+  m_stats.feedbackTimeTotal += m_stats.feedbackTime;
 }
 
 
@@ -317,6 +583,52 @@ GfxAssetGroupInfo& GfxAssetManager::getAssetGroup(
 }
 
 
+void GfxAssetManager::addUnusedAsset(
+        GfxAsset                      asset,
+        GfxAssetInfo&                 assetInfo,
+        uint32_t                      frameId) {
+  assetInfo.activeFrameId = frameId;
+  assetInfo.unusedPrev = uint32_t(m_unusedAssets.tail);
+  assetInfo.unusedNext = ~0u;
+  assetInfo.unusedListed = true;
+
+  if (m_unusedAssets.tail)
+    getAsset(m_unusedAssets.tail).unusedNext = uint32_t(asset);
+  else
+    m_unusedAssets.head = asset;
+
+  m_unusedAssets.tail = asset;
+  m_unusedAssets.size += 1u;
+}
+
+
+void GfxAssetManager::removeUnusedAsset(
+        GfxAsset                      asset,
+        GfxAssetInfo&                 assetInfo) {
+  if (!assetInfo.unusedListed)
+    return;
+
+  GfxAsset prev(assetInfo.unusedPrev);
+  GfxAsset next(assetInfo.unusedNext);
+
+  if (prev)
+    getAsset(prev).unusedNext = uint32_t(next);
+  else
+    m_unusedAssets.head = next;
+
+  if (next)
+    getAsset(next).unusedPrev = uint32_t(prev);
+  else
+    m_unusedAssets.tail = prev;
+
+  assetInfo.unusedPrev = ~0u;
+  assetInfo.unusedNext = ~0u;
+  assetInfo.unusedListed = false;
+
+  m_unusedAssets.size -= 1u;
+}
+
+
 GfxAsset GfxAssetManager::createAssetWithIface(
   const GfxSemanticName&              name,
         std::unique_ptr<GfxAssetIface>&& iface) {
@@ -369,6 +681,88 @@ GfxAssetGroup GfxAssetManager::registerNamedGroup(
 }
 
 
+GfxAssetStats GfxAssetManager::getStatsLocked() {
+  GfxAssetStats stats = m_stats;
+  stats.frameId = m_budgetStatsLastFrame.frameId;
+  stats.gpuMemoryBudget = m_gpuMemoryBudget;
+  stats.gpuMemoryUsed = m_gpuMemoryUsed;
+  stats.deferredStreamCount = m_deferredStreams.size();
+  stats.pendingAssetCount = m_pendingAssets.size();
+
+  { std::unique_lock lock(m_requestLock);
+    stats.requestQueueSize = m_requestQueue.size();
+    stats.streamQueueSize = m_streamQueueLookup.size();
+  }
+
+  // Only iterate over registered assets, since assets
+  // may be allocated but not yet initialized otherwise
+  std::shared_lock lock(m_assetLutMutex);
+
+  for (const auto& entry : m_assetLut) {
+    auto assetInfo = getAsset(entry.second).iface->getAssetInfo();
+    uint32_t status = uint32_t(assetInfo.status);
+
+    stats.assetCount[status] += 1u;
+    stats.assetBytes[status] += assetInfo.gpuSize;
+  }
+
+  return stats;
+}
+
+
+void GfxAssetManager::writeStats(
+  const GfxAssetStats&                stats) {
+  std::unique_lock lock(m_statsFileMutex);
+
+  // The dump may have been disabled in the meantime
+  if (!m_statsFile.is_open())
+    return;
+
+  if (m_statsFormat == GfxAssetStatsFormat::eJson)
+    m_statsFile << stats.toJson() << '\n';
+  else
+    m_statsFile << stats.toCsv() << '\n';
+}
+
+
+uint32_t GfxAssetManager::addGroupAssetsLocked(
+        uint32_t                      groupIndex,
+        uint32_t                      assetCount,
+  const GfxAsset*                     assets) {
+  auto& groupInfo = m_groups.map[groupIndex];
+  uint32_t dwordCount = 0u;
+
+  for (uint32_t i = 0; i < assetCount; i++) {
+    auto& assetInfo = getAsset(assets[i]);
+
+    groupInfo.assets[i].asset = assets[i];
+    groupInfo.assets[i].type = gfxGetAssetRefType(assetInfo.iface->getAssetInfo().type);
+    groupInfo.assets[i].index = uint24_t(dwordCount);
+
+    dwordCount += gfxGetAssetRefSize(groupInfo.assets[i].type) / sizeof(uint32_t);
+
+    m_groupList.insert({ assets[i], GfxAssetGroup(groupIndex) });
+  }
+
+  m_dirtyGroups.push_back(GfxAssetGroup(groupIndex));
+  return dwordCount;
+}
+
+
+void GfxAssetManager::allocateGroupBuffer(
+        GfxAssetGroupInfo&            groupInfo,
+        GfxAssetGroupType             type,
+        uint32_t                      dwordCount) {
+  // Pad buffer size by one dword in order to allow shaders to unconditionally
+  // read 8 bytes at once. This will rarely affect the overall size since we
+  // pad the allocation anyway in order to avoid false data sharing.
+  uint64_t dataSize = sizeof(GfxAssetListHeader) + sizeof(uint32_t) * (dwordCount + 1u);
+  groupInfo.type = type;
+  groupInfo.bufferSlice = m_groupBuffers.alloc(dataSize, 256ull);
+  groupInfo.dwordCount = dwordCount;
+}
+
+
 bool GfxAssetManager::writeAssetData(
         uint32_t*                     dwords,
         GfxAssetRefType               type,
@@ -422,34 +816,177 @@ void GfxAssetManager::enqueueRequest(
 }
 
 
+void GfxAssetManager::enqueueStreamRequest(
+        GfxAssetGroup                 group,
+        float                         importance) {
+  auto timestamp = std::chrono::steady_clock::now();
+
+  std::unique_lock lock(m_requestLock);
+
+  // If a request for the group is already queued, keep its original
+  // timestamp so that it does not lose its aging bonus. The old heap
+  // entry becomes stale and is skipped when dequeued.
+  auto entry = m_streamQueueLookup.find(group);
+
+  if (entry != m_streamQueueLookup.end())
+    timestamp = entry->second.timestamp;
+
+  GfxAssetStreamRequest request = { };
+  request.priority = computeStreamPriority(timestamp, importance);
+  request.serial = ++m_streamSerial;
+  request.assetGroup = group;
+  request.timestamp = timestamp;
+  request.importance = importance;
+
+  m_streamQueueLookup.insert_or_assign(group, request);
+  m_streamQueue.push(request);
+
+  compactStreamQueueLocked();
+
+  m_requestCond.notify_one();
+}
+
+
+void GfxAssetManager::cancelStreamRequestLocked(
+        GfxAssetGroup                 group) {
+  if (m_streamQueueLookup.erase(group))
+    compactStreamQueueLocked();
+}
+
+
+void GfxAssetManager::compactStreamQueueLocked() {
+  // Stale entries are only removed once they reach the top of the
+  // heap, so an app that reprioritizes groups every frame would grow
+  // the queue indefinitely while the worker is busy. Rebuild the heap
+  // from the lookup table, which stores the current request for each
+  // queued group, once stale entries outnumber live ones.
+  size_t liveCount = m_streamQueueLookup.size();
+
+  if (m_streamQueue.size() - liveCount <= liveCount)
+    return;
+
+  std::vector<GfxAssetStreamRequest> requests;
+  requests.reserve(liveCount);
+
+  for (const auto& entry : m_streamQueueLookup)
+    requests.push_back(entry.second);
+
+  m_streamQueue = std::priority_queue<GfxAssetStreamRequest>(
+    std::less<GfxAssetStreamRequest>(), std::move(requests));
+}
+
+
+bool GfxAssetManager::dequeueRequestLocked(
+        GfxAssetRequest&              rq) {
+  // Process regular requests first. These are cheap and include
+  // eviction requests which may help subsequent stream requests.
+  if (!m_requestQueue.empty()) {
+    rq = m_requestQueue.front();
+    m_requestQueue.pop();
+    return true;
+  }
+
+  while (!m_streamQueue.empty()) {
+    GfxAssetStreamRequest streamRq = m_streamQueue.top();
+    m_streamQueue.pop();
+
+    auto entry = m_streamQueueLookup.find(streamRq.assetGroup);
+
+    if (entry == m_streamQueueLookup.end() || entry->second.serial != streamRq.serial)
+      continue;
+
+    m_streamQueueLookup.erase(entry);
+
+    rq.type = GfxAssetRequestType::eRequestStream;
+    rq.assetGroup = streamRq.assetGroup;
+    rq.timestamp = streamRq.timestamp;
+    rq.importance = streamRq.importance;
+    return true;
+  }
+
+  return false;
+}
+
+
 void GfxAssetManager::enqueueStreamAsset(
         GfxAsset                      asset) {
-  std::unique_lock lock(m_residencyLock);
+  // Completion is polled once per frame in commitUpdates
+  m_pendingAssets.push_back(asset);
+}
+
 
-  m_residencyQueue.push(asset);
-  m_residencyCond.notify_one();
+double GfxAssetManager::computeStreamPriority(
+        std::chrono::steady_clock::time_point timestamp,
+        float                         importance) const {
+  std::chrono::duration<double> age = timestamp - m_streamTimeBase;
+  return double(importance) - StreamAgingRate * age.count();
 }
 
 
 void GfxAssetManager::executeStreamRequest(
-        GfxAssetGroup                 assetGroup) {
+        GfxAssetGroup                 assetGroup,
+        std::chrono::steady_clock::time_point timestamp,
+        float                         importance) {
   auto& groupInfo = getAssetGroup(assetGroup);
 
+  // Update the importance even if the group is already active,
+  // since it determines the detail level of its textures.
+  groupInfo.importance = importance;
+
   if (groupInfo.status & GfxAssetGroupStatus::eActive)
     return;
 
-  // Free up some memory if needed. This is especially useful
-  // when a large number of new assets is being loaded at once.
-  // TODO work out a way to stall stream requests until we can
-  // allocate enough memory or are forced to go over budget.
-  if (m_gpuMemoryUsed > m_gpuMemoryBudget)
-    executeEvictUnusedRequest();
+  GfxAssetDeferredStream entry = { };
+  entry.assetGroup = assetGroup;
+  entry.timestamp = timestamp;
+  entry.importance = importance;
+  entry.priority = computeStreamPriority(timestamp, importance);
+
+  // If the request is already deferred, only update its priority.
+  // Keep the original timestamp so that it retains its aging bonus.
+  if (groupInfo.status & GfxAssetGroupStatus::eDeferred) {
+    for (auto i = m_deferredStreams.begin(); i != m_deferredStreams.end(); i++) {
+      if (i->assetGroup == assetGroup) {
+        entry.timestamp = i->timestamp;
+        entry.priority = computeStreamPriority(entry.timestamp, importance);
+
+        m_deferredStreams.erase(i);
+        break;
+      }
+    }
+
+    deferStreamRequest(entry);
+    return;
+  }
+
+  // Hold the request back if it does not fit into the budget, or if
+  // a request of at least the same priority is already waiting for
+  // memory, so that smaller requests cannot starve it. Deferred
+  // requests are retried once per frame after evicting unused assets.
+  bool blocked = !m_deferredStreams.empty()
+    && m_deferredStreams.front().priority >= entry.priority;
+
+  if (blocked || !admitStreamRequest(assetGroup)) {
+    groupInfo.status |= GfxAssetGroupStatus::eDeferred;
+    deferStreamRequest(entry);
+    return;
+  }
+
+  activateAssetGroup(assetGroup, timestamp);
+}
+
+
+void GfxAssetManager::activateAssetGroup(
+        GfxAssetGroup                 assetGroup,
+        std::chrono::steady_clock::time_point timestamp) {
+  auto& groupInfo = getAssetGroup(assetGroup);
+  groupInfo.streamRequestTime = timestamp;
 
   for (const auto& a : groupInfo.assets) {
     auto& asset = getAsset(a.asset);
 
     if (!(asset.activeGroupCount++))
-      m_unusedAssets.erase({ asset.activeFrameId, a.asset });
+      removeUnusedAsset(a.asset, asset);
 
     auto assetInfo = asset.iface->getAssetInfo();
     bool makeResident = assetInfo.status == GfxAssetStatus::eEvictRequest;
@@ -461,20 +998,58 @@ void GfxAssetManager::executeStreamRequest(
         enqueueStreamAsset(a.asset);
     }
 
-    if (makeResident) {
-      asset.iface->makeResident(GfxAssetManagerIface(this));
-      dirtyAssetGroups(a.asset, m_currFrameId);
-    }
+    if (makeResident)
+      makeAssetResident(a.asset, asset);
   }
 
   groupInfo.status |= GfxAssetGroupStatus::eActive;
 }
 
 
+void GfxAssetManager::deferStreamRequest(
+  const GfxAssetDeferredStream&       entry) {
+  // Insert after entries of the same priority to retain FIFO order
+  auto pos = std::upper_bound(m_deferredStreams.begin(), m_deferredStreams.end(), entry,
+    [] (const GfxAssetDeferredStream& a, const GfxAssetDeferredStream& b) {
+      return a.priority > b.priority;
+    });
+
+  m_deferredStreams.insert(pos, entry);
+}
+
+
+void GfxAssetManager::executePrefetchRequest(
+        GfxAssetGroup                 assetGroup) {
+  auto& groupInfo = getAssetGroup(assetGroup);
+
+  if (groupInfo.status & GfxAssetGroupStatus::eActive)
+    return;
+
+  for (const auto& a : groupInfo.assets) {
+    auto& asset = getAsset(a.asset);
+
+    if (asset.iface->getAssetInfo().status == GfxAssetStatus::eNonResident)
+      asset.iface->prefetch(GfxAssetManagerIface(this));
+  }
+}
+
+
 void GfxAssetManager::executeEvictRequest(
         GfxAssetGroup                 assetGroup) {
   auto& groupInfo = getAssetGroup(assetGroup);
 
+  // If the stream request has not been executed yet, drop it
+  if (groupInfo.status & GfxAssetGroupStatus::eDeferred) {
+    groupInfo.status -= GfxAssetGroupStatus::eDeferred;
+
+    for (auto i = m_deferredStreams.begin(); i != m_deferredStreams.end(); i++) {
+      if (i->assetGroup == assetGroup) {
+        m_deferredStreams.erase(i);
+        break;
+      }
+    }
+  }
+
   if (!(groupInfo.status & GfxAssetGroupStatus::eActive))
     return;
 
@@ -483,80 +1058,308 @@ void GfxAssetManager::executeEvictRequest(
   for (const auto& a : groupInfo.assets) {
     auto& asset = getAsset(a.asset);
 
-    if (!(--asset.activeGroupCount)) {
-      asset.activeFrameId = m_currFrameId;
-      m_unusedAssets.insert({ m_currFrameId, a.asset });
-    }
+    if (!(--asset.activeGroupCount))
+      addUnusedAsset(a.asset, asset, m_currFrameId);
   }
 
   groupInfo.status -= GfxAssetGroupStatus::eActive;
 }
 
 
-void GfxAssetManager::executeEvictUnusedRequest() {
+bool GfxAssetManager::admitStreamRequest(
+        GfxAssetGroup                 assetGroup) {
+  if (!m_gpuMemoryBudget)
+    return true;
+
+  uint64_t required = computeStreamSize(assetGroup);
+
+  if (m_gpuMemoryUsed + required <= m_gpuMemoryBudget)
+    return true;
+
+  // Free up memory for the request if we can. This is especially
+  // useful when a large number of new assets is being loaded.
+  executeEvictUnusedRequest(required);
+
+  if (m_gpuMemoryUsed + required <= m_gpuMemoryBudget)
+    return true;
+
+  // Only defer the request if waiting can actually free up some
+  // memory, i.e. if unused assets are pending eviction. Otherwise,
+  // the request would stall forever, so go over budget instead.
+  return !m_unusedAssets.size;
+}
+
+
+void GfxAssetManager::executeDeferredStreamRequests() {
+  // Retry deferred requests in order of priority, and stop at the first
+  // request that still does not fit so that less important requests
+  // cannot overtake it. New requests are held back in the meantime.
+  size_t admitted = 0;
+
+  while (admitted < m_deferredStreams.size()) {
+    GfxAssetDeferredStream entry = m_deferredStreams[admitted];
+
+    if (!admitStreamRequest(entry.assetGroup))
+      break;
+
+    getAssetGroup(entry.assetGroup).status -= GfxAssetGroupStatus::eDeferred;
+    activateAssetGroup(entry.assetGroup, entry.timestamp);
+    admitted += 1;
+  }
+
+  m_deferredStreams.erase(m_deferredStreams.begin(),
+    m_deferredStreams.begin() + admitted);
+}
+
+
+uint64_t GfxAssetManager::computeStreamSize(
+        GfxAssetGroup                 assetGroup) {
+  auto& groupInfo = getAssetGroup(assetGroup);
+  uint64_t size = 0u;
+
+  // Assets that are resident or pending eviction
+  // can be reused without allocating any memory
+  for (const auto& a : groupInfo.assets) {
+    auto assetInfo = getAsset(a.asset).iface->getAssetInfo();
+
+    if (assetInfo.status == GfxAssetStatus::eNonResident)
+      size += assetInfo.streamSize;
+  }
+
+  return size;
+}
+
+
+void GfxAssetManager::executeEvictUnusedRequest(
+        uint64_t                      reserve) {
   // Under memory pressure, aim to always have a small portion of the
   // available memory budget available for eviction immediately so that
   // subsequent resource streaming does not stall. Evict any asset that
-  // we can if we're above budget already.
-  std::vector<GfxAssetUnusedEntry> newEntries;
-
+  // we can if we're above budget already. The reserved amount of memory
+  // is needed for a pending stream request and counts as already used.
   uint64_t memoryTarget = m_gpuMemoryBudget - m_gpuMemoryBudget / 8u;
   uint64_t memoryOrphaned = 0ull;
 
-  for (auto i = m_unusedAssets.begin(); i != m_unusedAssets.end(); ) {
-    auto& asset = getAsset(i->asset);
+  // Assets for which we request eviction get moved to the end of the
+  // list, so stop at the current end in order to not revisit them.
+  GfxAsset last = m_unusedAssets.tail;
+  GfxAsset next = m_unusedAssets.head;
+
+  while (next) {
+    GfxAsset handle = next;
+    auto& asset = getAsset(handle);
+
+    next = handle != last ? GfxAsset(asset.unusedNext) : GfxAsset();
 
     // Exit early if we're already within budget.
-    if (m_gpuMemoryUsed < memoryTarget + memoryOrphaned
-     && m_gpuMemoryUsed < m_gpuMemoryBudget)
+    if (m_gpuMemoryUsed + reserve < memoryTarget + memoryOrphaned
+     && m_gpuMemoryUsed + reserve < m_gpuMemoryBudget)
       break;
 
-    // Ignore assets that are not backed by memory, since
-    // evicting them doesn't accomplish anything at all.
+    // Assets that are still being streamed in cannot be evicted
+    // yet, but must stay in the list so that they can be evicted
+    // once the stream request completes.
     auto assetInfo = asset.iface->getAssetInfo();
 
+    if (assetInfo.status == GfxAssetStatus::eStreamRequest)
+      continue;
+
+    // Ignore assets that are not backed by memory, since
+    // evicting them doesn't accomplish anything at all.
     if (!assetInfo.gpuSize) {
-      i = m_unusedAssets.erase(i);
+      removeUnusedAsset(handle, asset);
       continue;
     }
 
     switch (assetInfo.status) {
       case GfxAssetStatus::eResident: {
-        // Request eviction and add asset to the back of the list with the
+        // Request eviction and move asset to the back of the list with the
         // current frame ID. Since feedback is delayed, the asset may still
         // get accessed in the current frame and we have no way of knowing.
         asset.iface->requestEviction(GfxAssetManagerIface(this), m_currFrameId);
-        dirtyAssetGroups(i->asset, m_currFrameId);
+        dirtyAssetGroups(handle, m_currFrameId);
 
         memoryOrphaned += assetInfo.gpuSize;
-        newEntries.push_back({ m_currFrameId, i->asset });
-        i = m_unusedAssets.erase(i);
+
+        removeUnusedAsset(handle, asset);
+        addUnusedAsset(handle, asset, m_currFrameId);
       } break;
 
       case GfxAssetStatus::eEvictRequest: {
         // Evict asset immediately if we can. Otherwise, count it towards already
         // orphaned memory so that we don't end up request eviction for everything.
-        if (m_lastFrameId >= i->frameId) {
+        if (m_lastFrameId >= asset.activeFrameId) {
+          m_budgetStats.evictedAssets += 1u;
+          m_budgetStats.evictedBytes += assetInfo.gpuSize;
+
+          m_stats.evictedAssets += 1u;
+          m_stats.evictedBytes += assetInfo.gpuSize;
+
           asset.iface->evict(GfxAssetManagerIface(this));
-          i = m_unusedAssets.erase(i);
+          m_lodAssets.erase(handle);
+          removeUnusedAsset(handle, asset);
         } else {
           memoryOrphaned += assetInfo.gpuSize;
-          i++;
         }
       } break;
 
       default: {
-        // Be robust so that the set does not grow indefinitely in case something
+        // Be robust so that the list does not grow indefinitely in case something
         // weird happens. This would indicate a bug in asset status reporting.
-        i = m_unusedAssets.erase(i);
+        removeUnusedAsset(handle, asset);
       } break;
     }
   }
+}
+
+
+void GfxAssetManager::executeLodUpdateRequest() {
+  bool overBudget = m_gpuMemoryBudget && m_gpuMemoryUsed > m_gpuMemoryBudget;
+
+  // Collect resident assets used by any active group, as well as the
+  // amount of memory they currently use. Unused assets are only reduced
+  // to their least detailed level when memory is short.
+  uint64_t candidateSize = 0u;
+
+  m_lodCandidates.clear();
+
+  for (const auto& entry : m_lodAssets) {
+    auto& asset = getAsset(entry.first);
+    auto assetInfo = asset.iface->getAssetInfo();
+
+    if (assetInfo.status != GfxAssetStatus::eResident)
+      continue;
+
+    if (asset.activeGroupCount) {
+      m_lodCandidates.push_back({ entry.first, computeAssetImportance(entry.first), assetInfo });
+      candidateSize += assetInfo.gpuSize;
+    } else {
+      requestAssetLod(entry.first, asset, assetInfo,
+        overBudget ? assetInfo.lodCount - 1u : assetInfo.lodTarget);
+    }
+  }
+
+  // Hand out the budget in order of importance, so that assets of less
+  // important groups lose detail first. Memory used by anything else
+  // is taken off the top. Adding detail requires some headroom in
+  // order to avoid oscillating between levels every frame.
+  std::sort(m_lodCandidates.begin(), m_lodCandidates.end(),
+    [] (const GfxAssetLodCandidate& a, const GfxAssetLodCandidate& b) {
+      return a.importance > b.importance;
+    });
+
+  uint64_t available = ~0ull;
+  uint64_t headroom = 0ull;
+
+  if (m_gpuMemoryBudget) {
+    uint64_t otherSize = m_gpuMemoryUsed - std::min(m_gpuMemoryUsed, candidateSize);
+
+    available = m_gpuMemoryBudget - std::min(m_gpuMemoryBudget, otherSize);
+    headroom = m_gpuMemoryBudget / 8u;
+  }
 
-  // Add assets for which we submitted an eviction request
-  // to the set again in order to actually evict them later.
-  for (auto& e : newEntries)
-    m_unusedAssets.insert(std::move(e));
+  for (const auto& candidate : m_lodCandidates) {
+    const auto& lodSizes = m_lodAssets.at(candidate.asset);
+    const auto& properties = candidate.properties;
+
+    uint32_t lod = properties.lodCount - 1u;
+
+    while (lod) {
+      uint64_t limit = available;
+
+      if (lod <= properties.lodTarget)
+        limit -= std::min(limit, headroom);
+
+      if (lodSizes[lod - 1u] > limit)
+        break;
+
+      lod -= 1u;
+    }
+
+    available -= std::min(available, lodSizes[lod]);
+
+    requestAssetLod(candidate.asset, getAsset(candidate.asset), properties, lod);
+  }
+}
+
+
+float GfxAssetManager::computeAssetImportance(
+        GfxAsset                      asset) {
+  auto list = m_groupList.equal_range(asset);
+
+  float importance = -std::numeric_limits<float>::infinity();
+
+  for (auto i = list.first; i != list.second; i++) {
+    const auto& groupInfo = getAssetGroup(i->second);
+
+    if (groupInfo.status & GfxAssetGroupStatus::eActive)
+      importance = std::max(importance, groupInfo.importance);
+  }
+
+  return importance;
+}
+
+
+void GfxAssetManager::requestAssetLod(
+        GfxAsset                      handle,
+        GfxAssetInfo&                 asset,
+  const GfxAssetProperties&           properties,
+        uint32_t                      lod) {
+  lod = std::min(lod, properties.lodCount - 1u);
+
+  // Switching to a more detailed level allocates memory, so hold
+  // it back like a stream request until it fits into the budget.
+  // Keep requesting the current target so that a pending change
+  // can still complete without allocating anything new.
+  if (lod < properties.lodTarget && !admitLodRequest(asset, lod))
+    lod = properties.lodTarget;
+
+  if (lod == properties.lod && !properties.lodPending)
+    return;
+
+  if (asset.iface->requestLod(GfxAssetManagerIface(this), lod, m_currFrameId))
+    dirtyAssetGroups(handle, m_currFrameId);
+}
+
+
+bool GfxAssetManager::admitLodRequest(
+  const GfxAssetInfo&                 asset,
+        uint32_t                      lod) {
+  if (!m_gpuMemoryBudget)
+    return true;
+
+  // Unlike stream requests, never go over budget for this since the
+  // asset remains usable at its current detail level. Requests that
+  // do not fit are retried on the next update, by which time unused
+  // assets may have been evicted.
+  uint64_t required = asset.iface->getLodStreamSize(lod);
+  return m_gpuMemoryUsed + required <= m_gpuMemoryBudget;
+}
+
+
+void GfxAssetManager::makeAssetResident(
+        GfxAsset                      asset,
+        GfxAssetInfo&                 assetInfo) {
+  assetInfo.iface->makeResident(GfxAssetManagerIface(this));
+  dirtyAssetGroups(asset, m_currFrameId);
+
+  // Stream requests may complete after all groups using the asset
+  // have been evicted, so ensure that the asset can be evicted.
+  if (!assetInfo.activeGroupCount && !assetInfo.unusedListed)
+    addUnusedAsset(asset, assetInfo, m_currFrameId);
+
+  // Cache the amount of memory required for each detail level,
+  // since computing it may be expensive and sizes never change.
+  auto properties = assetInfo.iface->getAssetInfo();
+
+  if (properties.lodCount > 1u && !m_lodAssets.count(asset)) {
+    std::vector<uint64_t> lodSizes(properties.lodCount);
+
+    for (uint32_t i = 0; i < properties.lodCount; i++)
+      lodSizes[i] = assetInfo.iface->getLodStreamSize(i);
+
+    m_lodAssets.emplace(asset, std::move(lodSizes));
+  }
 }
 
 
@@ -566,12 +1369,9 @@ void GfxAssetManager::runRequestWorker() {
 
     { std::unique_lock lock(m_requestLock);
 
-      m_requestCond.wait(lock, [this] {
-        return !m_requestQueue.empty();
+      m_requestCond.wait(lock, [this, &rq] {
+        return dequeueRequestLocked(rq);
       });
-
-      rq = m_requestQueue.front();
-      m_requestQueue.pop();
     }
 
     std::unique_lock lock(m_assetMutex);
@@ -581,7 +1381,7 @@ void GfxAssetManager::runRequestWorker() {
         return;
 
       case GfxAssetRequestType::eRequestStream: {
-        executeStreamRequest(rq.assetGroup);
+        executeStreamRequest(rq.assetGroup, rq.timestamp, rq.importance);
       } break;
 
       case GfxAssetRequestType::eRequestEvict: {
@@ -589,41 +1389,43 @@ void GfxAssetManager::runRequestWorker() {
       } break;
 
       case GfxAssetRequestType::eEvictUnused: {
-        executeEvictUnusedRequest();
+        executeEvictUnusedRequest(0u);
+        executeDeferredStreamRequests();
+      } break;
+
+      case GfxAssetRequestType::eUpdateLod: {
+        executeLodUpdateRequest();
+      } break;
+
+      case GfxAssetRequestType::eRequestPrefetch: {
+        executePrefetchRequest(rq.assetGroup);
       } break;
     }
   }
 }
 
 
-void GfxAssetManager::runResidencyWorker() {
-  while (true) {
-    GfxAsset asset;
-
-    { std::unique_lock lock(m_residencyLock);
-
-      m_residencyCond.wait(lock, [this] {
-        return !m_residencyQueue.empty();
-      });
+void GfxAssetManager::pollPendingAssets() {
+  size_t pendingCount = 0u;
 
-      asset = m_residencyQueue.front();
-      m_residencyQueue.pop();
-    }
+  for (size_t i = 0; i < m_pendingAssets.size(); i++) {
+    GfxAsset handle = m_pendingAssets[i];
 
-    // Exit condition
-    if (!asset)
-      return;
+    auto& asset = getAsset(handle);
+    auto assetInfo = asset.iface->getAssetInfo();
 
-    std::unique_lock lock(m_assetMutex);
-    auto& assetIface = getAsset(asset).iface;
-    auto assetInfo = assetIface->getAssetInfo();
+    // Drop assets that have been made resident or evicted
+    if (assetInfo.status != GfxAssetStatus::eStreamRequest
+     && assetInfo.status != GfxAssetStatus::eEvictRequest)
+      continue;
 
-    if (assetInfo.status == GfxAssetStatus::eStreamRequest
-     || assetInfo.status == GfxAssetStatus::eEvictRequest) {
-      assetIface->makeResident(GfxAssetManagerIface(this));
-      dirtyAssetGroups(asset, m_currFrameId);
-    }
+    if (asset.iface->isStreamComplete())
+      makeAssetResident(handle, asset);
+    else
+      m_pendingAssets[pendingCount++] = handle;
   }
+
+  m_pendingAssets.resize(pendingCount);
 }
 
 
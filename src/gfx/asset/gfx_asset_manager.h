@@ -1,9 +1,13 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <queue>
-#include <set>
 #include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "../../util/util_object_map.h"
@@ -32,6 +36,10 @@ enum class GfxAssetRequestType : uint32_t {
   /** Marks inactive assets for eviction in order to meet memory
    *  budget constraints. */
   eEvictUnused        = 3u,
+  /** Adjusts detail levels of partially resident assets. */
+  eUpdateLod          = 4u,
+  /** Prefetches data for non-resident assets of a group. */
+  eRequestPrefetch    = 5u,
 };
 
 
@@ -43,6 +51,232 @@ struct GfxAssetRequest {
   GfxAssetRequestType type = GfxAssetRequestType::eStopWorker;
   /** Asset group for which the request was made, if any. */
   GfxAssetGroup assetGroup;
+  /** Time when the request was made. Only used for
+   *  stream requests in order to measure latency. */
+  std::chrono::steady_clock::time_point timestamp = { };
+  /** Importance passed to the stream request. */
+  float importance = 0.0f;
+};
+
+
+/**
+ * \brief Memory budget statistics
+ *
+ * Collected by the asset manager for each frame, i.e. between
+ * two consecutive calls to \c commitUpdates.
+ */
+struct GfxAssetBudgetStats {
+  /** Frame ID that the statistics were collected for */
+  uint32_t frameId = 0u;
+  /** GPU memory budget, in bytes */
+  uint64_t gpuMemoryBudget = 0ull;
+  /** GPU memory used by assets at the end of the frame */
+  uint64_t gpuMemoryUsed = 0ull;
+  /** Number of asset groups whose stream requests are deferred
+   *  at the end of the frame because they exceed the budget, or
+   *  because a more important deferred request is waiting. */
+  uint32_t deferredGroups = 0u;
+  /** Estimated memory required by deferred stream requests */
+  uint64_t deferredBytes = 0ull;
+  /** Number of assets evicted during the frame */
+  uint32_t evictedAssets = 0u;
+  /** GPU memory freed by evicting assets during the frame */
+  uint64_t evictedBytes = 0ull;
+  /** Number of asset groups that became resident during the frame */
+  uint32_t residentGroups = 0u;
+  /** Sum of the time from stream request to full residency
+   *  of all groups that became resident during the frame. */
+  std::chrono::microseconds totalTimeToResident = { };
+  /** Maximum time from stream request to full residency
+   *  of any group that became resident during the frame. */
+  std::chrono::microseconds maxTimeToResident = { };
+};
+
+
+/**
+ * \brief Asset manager statistics
+ *
+ * Snapshot of the residency state of all assets, as well as
+ * counters that are accumulated since the asset manager was
+ * created, so that applications can compute per-frame values
+ * by comparing two snapshots.
+ */
+struct GfxAssetStats {
+  /** Number of asset residency states */
+  constexpr static uint32_t StatusCount = 4;
+  /** Number of stream latency histogram buckets. Bucket \c i
+   *  counts asset groups that became resident in less than 2^i
+   *  microseconds, but not faster than the previous bucket. */
+  constexpr static uint32_t LatencyBucketCount = 32;
+
+  /** Frame ID of the last completed frame */
+  uint32_t frameId = 0u;
+  /** Number of assets in each state, indexed by \c GfxAssetStatus */
+  std::array<uint32_t, StatusCount> assetCount = { };
+  /** GPU memory used by assets in each state, in bytes */
+  std::array<uint64_t, StatusCount> assetBytes = { };
+  /** GPU memory budget, in bytes */
+  uint64_t gpuMemoryBudget = 0ull;
+  /** GPU memory currently used by assets */
+  uint64_t gpuMemoryUsed = 0ull;
+  /** Total number of evicted assets */
+  uint64_t evictedAssets = 0ull;
+  /** Total GPU memory freed by evicting assets */
+  uint64_t evictedBytes = 0ull;
+  /** Total number of asset groups that became resident */
+  uint64_t residentGroups = 0ull;
+  /** Histogram of the time from stream request to full
+   *  residency of asset groups */
+  std::array<uint64_t, LatencyBucketCount> streamLatencyHistogram = { };
+  /** Time spent processing the most recent feedback buffer */
+  std::chrono::microseconds feedbackTime = { };
+  /** Total time spent processing feedback buffers */
+  std::chrono::microseconds feedbackTimeTotal = { };
+  /** Number of queued regular requests */
+  uint32_t requestQueueSize = 0u;
+  /** Number of queued stream requests */
+  uint32_t streamQueueSize = 0u;
+  /** Number of stream requests deferred due to the memory budget,
+   *  or because a more important request is waiting for memory */
+  uint32_t deferredStreamCount = 0u;
+  /** Number of assets waiting for stream completion */
+  uint32_t pendingAssetCount = 0u;
+
+  /**
+   * \brief Estimates a stream latency percentile
+   *
+   * \param [in] percentile Percentile, between 0 and 1
+   * \returns Upper bound of the histogram bucket that contains
+   *    the given percentile, or zero if no group became resident.
+   */
+  std::chrono::microseconds getStreamLatencyPercentile(
+          double                        percentile) const;
+
+  /**
+   * \brief Formats CSV header
+   * \returns Comma-separated column names matching \c toCsv
+   */
+  static std::string getCsvHeader();
+
+  /**
+   * \brief Formats statistics as a CSV row
+   * \returns Comma-separated values, without line break
+   */
+  std::string toCsv() const;
+
+  /**
+   * \brief Formats statistics as a JSON object
+   * \returns Single-line JSON object
+   */
+  std::string toJson() const;
+
+};
+
+
+/**
+ * \brief Statistics dump format
+ */
+enum class GfxAssetStatsFormat : uint32_t {
+  /** One comma-separated row per frame, with a header line */
+  eCsv  = 0u,
+  /** One JSON object per line and frame */
+  eJson = 1u,
+};
+
+
+/**
+ * \brief Deferred stream request
+ */
+struct GfxAssetDeferredStream {
+  /** Asset group to stream */
+  GfxAssetGroup assetGroup;
+  /** Time when the request was originally made */
+  std::chrono::steady_clock::time_point timestamp;
+  /** Importance passed to the stream request */
+  float importance = 0.0f;
+  /** Effective priority, computed the same way as for
+   *  queued stream requests. Deferred requests are kept
+   *  sorted by this in descending order. */
+  double priority = 0.0;
+};
+
+
+/**
+ * \brief Detail level update candidate
+ *
+ * Resident asset with multiple detail levels that
+ * is used by at least one active asset group.
+ */
+struct GfxAssetLodCandidate {
+  /** Asset handle */
+  GfxAsset asset;
+  /** Highest importance of any active group using the asset */
+  float importance = 0.0f;
+  /** Asset properties at the time of the update */
+  GfxAssetProperties properties;
+};
+
+
+/**
+ * \brief Queued stream request
+ *
+ * Stream requests are processed in order of their effective
+ * priority, which is the importance passed in by the caller
+ * plus a bonus that grows linearly with the time spent in the
+ * queue. Since all queued requests age at the same rate, the
+ * ordering can be computed once when the request is queued.
+ */
+struct GfxAssetStreamRequest {
+  /** Importance, minus the aging bonus accumulated from a fixed
+   *  point in time until the group was first queued. Uses double
+   *  precision so that small importance differences still matter
+   *  after the application has been running for a long time. */
+  double priority = 0.0;
+  /** Unique request serial number. Used to identify stale
+   *  entries after a request has been reprioritized or
+   *  cancelled, and to break ties in FIFO order. */
+  uint64_t serial = 0u;
+  /** Asset group to stream */
+  GfxAssetGroup assetGroup;
+  /** Time when the group was first queued. Kept when
+   *  the request is reprioritized while still queued. */
+  std::chrono::steady_clock::time_point timestamp;
+  /** Importance passed in by the caller */
+  float importance = 0.0f;
+
+  bool operator < (const GfxAssetStreamRequest& other) const {
+    if (priority != other.priority)
+      return priority < other.priority;
+
+    return serial > other.serial;
+  }
+};
+
+
+/**
+ * \brief Asset description for bulk creation
+ */
+struct GfxAssetDesc {
+  /** Unique asset name */
+  GfxSemanticName name;
+  /** Asset interface. Ownership is transferred
+   *  to the asset manager on creation. */
+  std::unique_ptr<GfxAssetIface> iface;
+};
+
+
+/**
+ * \brief Asset group description for bulk creation
+ */
+struct GfxAssetGroupDesc {
+  /** Unique asset group name */
+  GfxSemanticName name;
+  /** Asset group type */
+  GfxAssetGroupType type = GfxAssetGroupType::eAppManaged;
+  /** Number of assets in the group */
+  uint32_t assetCount = 0u;
+  /** Assets to add to the group */
+  const GfxAsset* assets = nullptr;
 };
 
 
@@ -62,26 +296,21 @@ struct GfxAssetStorage {
 
 
 /**
- * \brief Unused asset set
+ * \brief Unused asset list
  *
- * Stores the asset handle and the frame ID of when the asset
- * has last been accessed. Useful to quickly manipulate or
- * iterate over the set.
+ * Intrusive doubly linked list of assets that are not used by
+ * any active asset group, with links stored in the asset info.
+ * Assets are always appended with the current frame ID, so the
+ * list stays ordered by the frame ID of last use, and insertion
+ * and removal are constant time and do not allocate memory.
  */
-struct GfxAssetUnusedEntry {
-  /** Frame ID of last use */
-  uint32_t frameId = 0u;
-  /** Asset handle */
-  GfxAsset asset;
-
-  auto operator <=> (const GfxAssetUnusedEntry& other) const {
-    std::strong_ordering ordering = frameId <=> other.frameId;
-
-    if (ordering == std::strong_ordering::equal)
-      ordering = uint32_t(asset) <=> uint32_t(other.asset);
-
-    return ordering;
-  }
+struct GfxAssetUnusedList {
+  /** Least recently used asset */
+  GfxAsset head;
+  /** Most recently used asset */
+  GfxAsset tail;
+  /** Number of assets in the list */
+  size_t size = 0u;
 };
 
 
@@ -100,6 +329,7 @@ struct GfxAssetUnusedEntry {
 class GfxAssetManager {
   constexpr static uint32_t TextureDescriptorCount = 256u << 10u;
   constexpr static uint32_t SamplerDescriptorCount =   1u << 10u;
+  constexpr static double StreamAgingRate = 1.0;
 
   friend class GfxAssetManagerIface;
 public:
@@ -135,6 +365,54 @@ public:
       : 0ull;
   }
 
+  /**
+   * \brief Sets GPU memory budget
+   *
+   * When memory usage exceeds the budget, unused assets are
+   * evicted first, and if that is not enough, the detail level
+   * of partially resident assets is reduced. A budget of zero
+   * disables detail level reduction.
+   * \param [in] budget GPU memory budget, in bytes
+   */
+  void setGpuMemoryBudget(
+          uint64_t                      budget);
+
+  /**
+   * \brief Queries memory budget statistics
+   *
+   * Statistics are collected per frame and become
+   * available once \c commitUpdates is called for
+   * the next frame.
+   * \returns Statistics of the last complete frame
+   */
+  GfxAssetBudgetStats getBudgetStats();
+
+  /**
+   * \brief Queries asset manager statistics
+   *
+   * Iterates over all assets in order to compute per-status
+   * counts, so this should not be called more than once
+   * per frame.
+   * \returns Current statistics
+   */
+  GfxAssetStats getStats();
+
+  /**
+   * \brief Enables per-frame statistics dump
+   *
+   * Once enabled, statistics are written to the given file
+   * every time \c commitUpdates is called. This is intended
+   * for automated test runs, since gathering statistics
+   * requires iterating over all assets.
+   * \param [in] path Output file path, or an empty
+   *    path to disable the statistics dump
+   * \param [in] format Output format
+   * \returns \c true if the file could be opened
+   */
+  bool setStatsDump(
+    const std::filesystem::path&        path,
+          GfxAssetStatsFormat           format);
+
   /**
    * \brief Binds descriptor arrays to a context
    *
@@ -164,6 +442,38 @@ public:
     return createAssetWithIface(name, std::move(iface));
   }
 
+  /**
+   * \brief Creates multiple assets at once
+   *
+   * Equivalent to creating each asset individually, but
+   * only takes the relevant locks once. Useful when loading
+   * large numbers of assets, e.g. when loading a level.
+   * \param [in] assetCount Number of assets to create
+   * \param [in] descs Asset descriptions. Asset interfaces
+   *    will be moved out of the array.
+   * \param [out] assets Asset handles
+   */
+  void createAssets(
+          uint32_t                      assetCount,
+          GfxAssetDesc*                 descs,
+          GfxAsset*                     assets);
+
+  /**
+   * \brief Reserves space for assets and asset groups
+   *
+   * Pre-sizes internal look-up tables for the given number of
+   * additional assets and asset groups, so that subsequent asset
+   * creation does not need to reallocate them repeatedly.
+   * \param [in] assetCount Number of assets to reserve
+   * \param [in] groupCount Number of asset groups to reserve
+   * \param [in] groupAssetCount Total number of asset references
+   *    across all asset groups to reserve
+   */
+  void reserve(
+          uint32_t                      assetCount,
+          uint32_t                      groupCount,
+          uint32_t                      groupAssetCount);
+
   /**
    * \brief Retrieves asset interface
    *
@@ -203,6 +513,20 @@ public:
           uint32_t                      assetCount,
     const GfxAsset*                     assets);
 
+  /**
+   * \brief Creates multiple asset groups at once
+   *
+   * Equivalent to creating each asset group individually,
+   * but only takes the relevant locks once.
+   * \param [in] groupCount Number of asset groups to create
+   * \param [in] descs Asset group descriptions
+   * \param [out] groups Asset group handles
+   */
+  void createAssetGroups(
+          uint32_t                      groupCount,
+    const GfxAssetGroupDesc*            descs,
+          GfxAssetGroup*                groups);
+
   /**
    * \brief Looks up asset group by name
    *
@@ -219,9 +543,45 @@ public:
    * with the latter being useful to avoid pop-in when loading a new
    * scene. In that case, the last active frame ID of each asset will
    * be updated so that assets are not evicted again immediately.
+   * Uses an importance of zero.
+   * \param [in] group Asset group to load
+   */
+  void streamAssetGroup(
+          GfxAssetGroup                 group);
+
+  /**
+   * \brief Streams in an asset group with a given importance
+   *
+   * Queued stream requests are processed in order of importance,
+   * e.g. based on distance or screen coverage. If a request for
+   * the same group is already queued, its importance is replaced,
+   * but it keeps the time it has already spent waiting. To prevent
+   * starvation, the importance of queued requests increases by
+   * \c StreamAgingRate for every second they wait.
+   *
+   * Once the group is active, its importance also decides which
+   * textures keep their finer mip levels when memory is short.
+   * Calling this again for an active group updates it.
    * \param [in] group Asset group to load
+   * \param [in] importance Importance, higher values
+   *    are processed first
    */
   void streamAssetGroup(
+          GfxAssetGroup                 group,
+          float                         importance);
+
+  /**
+   * \brief Prefetches an asset group
+   *
+   * Hint that the asset group is likely to be streamed in soon,
+   * e.g. because the camera is moving towards it. Loads data for
+   * non-resident assets into system memory without allocating any
+   * GPU memory, so that a subsequent stream request only needs to
+   * perform the upload. Prefetching is best-effort and subject to
+   * the prefetch budget of the transfer manager used by assets.
+   * \param [in] group Asset group to prefetch
+   */
+  void prefetchAssetGroup(
           GfxAssetGroup                 group);
 
   /**
@@ -310,10 +670,30 @@ private:
   uint64_t                            m_gpuMemoryBudget = 0ull;
   uint64_t                            m_gpuMemoryUsed = 0ull;
 
+  std::unordered_map<GfxAsset,
+    std::vector<uint64_t>,
+    HashMemberProc>                   m_lodAssets;
+
+  std::vector<GfxAssetLodCandidate>   m_lodCandidates;
+
+  std::vector<GfxAssetDeferredStream> m_deferredStreams;
+
+  GfxAssetBudgetStats                 m_budgetStats;
+  GfxAssetBudgetStats                 m_budgetStatsLastFrame;
+
+  GfxAssetStats                       m_stats;
+  bool                                m_statsDump = false;
+
   std::unordered_multimap<GfxAsset,
     GfxAssetGroup, HashMemberProc>    m_groupList;
 
   std::vector<GfxAssetGroup>          m_dirtyGroups;
+  std::vector<GfxAsset>               m_pendingAssets;
+
+  alignas(CacheLineSize)
+  std::mutex                          m_statsFileMutex;
+  std::ofstream                       m_statsFile;
+  GfxAssetStatsFormat                 m_statsFormat = GfxAssetStatsFormat::eCsv;
 
   alignas(CacheLineSize)
   std::shared_mutex                   m_assetLutMutex;
@@ -329,16 +709,19 @@ private:
   std::mutex                          m_requestLock;
   std::condition_variable             m_requestCond;
   std::queue<GfxAssetRequest>         m_requestQueue;
+
+  std::priority_queue<GfxAssetStreamRequest> m_streamQueue;
+  std::unordered_map<GfxAssetGroup,
+    GfxAssetStreamRequest, HashMemberProc> m_streamQueueLookup;
+  uint64_t                            m_streamSerial = 0u;
+
+  std::chrono::steady_clock::time_point m_streamTimeBase = std::chrono::steady_clock::now();
+
   std::thread                         m_requestWorker;
 
-  std::set<GfxAssetUnusedEntry>       m_unusedAssets;
+  GfxAssetUnusedList                  m_unusedAssets;
   size_t                              m_unusedCleanupIndex = 0u;
 
-  alignas(CacheLineSize)
-  std::mutex                          m_residencyLock;
-  std::condition_variable             m_residencyCond;
-  std::queue<GfxAsset>                m_residencyQueue;
-  std::thread                         m_residencyWorker;
 
   void adjustGpuMemory(
             int64_t                     amount) {
@@ -362,6 +745,15 @@ private:
   GfxAssetGroupInfo& getAssetGroup(
           GfxAssetGroup                 assetGroup);
 
+  void addUnusedAsset(
+          GfxAsset                      asset,
+          GfxAssetInfo&                 assetInfo,
+          uint32_t                      frameId);
+
+  void removeUnusedAsset(
+          GfxAsset                      asset,
+          GfxAssetInfo&                 assetInfo);
+
   GfxAsset createAssetWithIface(
     const GfxSemanticName&              name,
           std::unique_ptr<GfxAssetIface>&& iface);
@@ -378,6 +770,21 @@ private:
     const GfxSemanticName&              name,
           uint32_t                      index);
 
+  GfxAssetStats getStatsLocked();
+
+  void writeStats(
+    const GfxAssetStats&                stats);
+
+  uint32_t addGroupAssetsLocked(
+          uint32_t                      groupIndex,
+          uint32_t                      assetCount,
+    const GfxAsset*                     assets);
+
+  void allocateGroupBuffer(
+          GfxAssetGroupInfo&            groupInfo,
+          GfxAssetGroupType             type,
+          uint32_t                      dwordCount);
+
   bool writeAssetData(
           uint32_t*                     dwords,
           GfxAssetRefType               type,
@@ -391,20 +798,76 @@ private:
   void enqueueRequest(
     const GfxAssetRequest&              rq);
 
+  void enqueueStreamRequest(
+          GfxAssetGroup                 group,
+          float                         importance);
+
+  void cancelStreamRequestLocked(
+          GfxAssetGroup                 group);
+
+  void compactStreamQueueLocked();
+
+  bool dequeueRequestLocked(
+          GfxAssetRequest&              rq);
+
   void enqueueStreamAsset(
           GfxAsset                      asset);
 
+  double computeStreamPriority(
+          std::chrono::steady_clock::time_point timestamp,
+          float                         importance) const;
+
   void executeStreamRequest(
+          GfxAssetGroup                 assetGroup,
+          std::chrono::steady_clock::time_point timestamp,
+          float                         importance);
+
+  void activateAssetGroup(
+          GfxAssetGroup                 assetGroup,
+          std::chrono::steady_clock::time_point timestamp);
+
+  void deferStreamRequest(
+    const GfxAssetDeferredStream&       entry);
+
+  bool admitStreamRequest(
+          GfxAssetGroup                 assetGroup);
+
+  void executeDeferredStreamRequests();
+
+  uint64_t computeStreamSize(
+          GfxAssetGroup                 assetGroup);
+
+  void executePrefetchRequest(
           GfxAssetGroup                 assetGroup);
 
   void executeEvictRequest(
           GfxAssetGroup                 assetGroup);
 
-  void executeEvictUnusedRequest();
+  void executeEvictUnusedRequest(
+          uint64_t                      reserve);
+
+  void executeLodUpdateRequest();
+
+  float computeAssetImportance(
+          GfxAsset                      asset);
+
+  void requestAssetLod(
+          GfxAsset                      handle,
+          GfxAssetInfo&                 asset,
+    const GfxAssetProperties&           properties,
+          uint32_t                      lod);
+
+  bool admitLodRequest(
+    const GfxAssetInfo&                 asset,
+          uint32_t                      lod);
+
+  void makeAssetResident(
+          GfxAsset                      asset,
+          GfxAssetInfo&                 assetInfo);
 
   void runRequestWorker();
 
-  void runResidencyWorker();
+  void pollPendingAssets();
 
   void runEvictionWorker();
 
@@ -455,6 +918,17 @@ public:
     m_assetManager->adjustGpuMemory(-int64_t(size));
   }
 
+  /**
+   * \brief Queries last completed frame ID
+   *
+   * Resources that were last accessed by the GPU in
+   * this frame or earlier can safely be destroyed.
+   * \returns Last completed frame ID
+   */
+  uint32_t getLastCompletedFrameId() const {
+    return m_assetManager->m_lastFrameId;
+  }
+
   /**
    * \brief Creates a descriptor for the given asset
    *
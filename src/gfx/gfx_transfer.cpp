@@ -1,14 +1,171 @@
+#include <cstring>
+
 #include "../util/util_log.h"
 
 #include "gfx_transfer.h"
 
 namespace as {
 
+GfxTransferCache::GfxTransferCache() {
+
+}
+
+
+GfxTransferCache::~GfxTransferCache() {
+
+}
+
+
+void GfxTransferCache::setBudget(
+        uint64_t                      budget) {
+  std::unique_lock lock(m_mutex);
+
+  m_budget = budget;
+  evictLocked(0);
+}
+
+
+bool GfxTransferCache::isCacheable(
+  const IoArchiveSubFile&             subFile) const {
+  uint64_t size = subFile.getCompressedSize();
+  return size && size <= m_budget.load(std::memory_order_relaxed);
+}
+
+
+std::shared_ptr<std::vector<char>> GfxTransferCache::find(
+  const GfxTransferCacheKey&          key) {
+  std::unique_lock lock(m_mutex);
+
+  if (!m_budget)
+    return nullptr;
+
+  auto entry = m_lookup.find(key);
+
+  if (entry == m_lookup.end()) {
+    m_misses += 1;
+    return nullptr;
+  }
+
+  auto& e = m_entries[entry->second];
+  e.referenced = true;
+
+  m_hits += 1;
+  return e.data;
+}
+
+
+void GfxTransferCache::insert(
+  const GfxTransferCacheKey&          key,
+  const IoArchiveSubFileRef&          subFile,
+  const void*                         data,
+        size_t                        size) {
+  { std::unique_lock lock(m_mutex);
+
+    if (size > m_budget || m_lookup.find(key) != m_lookup.end())
+      return;
+  }
+
+  // Copy the payload without holding the lock, since this
+  // runs on I/O completion threads and data may be large.
+  auto payload = std::make_shared<std::vector<char>>(size);
+  std::memcpy(payload->data(), data, size);
+
+  std::unique_lock lock(m_mutex);
+
+  // Another thread may have added the same sub-file meanwhile
+  if (m_lookup.find(key) != m_lookup.end())
+    return;
+
+  if (!evictLocked(size))
+    return;
+
+  size_t index;
+
+  if (!m_freeEntries.empty()) {
+    index = m_freeEntries.back();
+    m_freeEntries.pop_back();
+  } else {
+    index = m_entries.size();
+    m_entries.emplace_back();
+  }
+
+  // New entries start without a reference bit, so that
+  // sub-files that are only ever streamed once get
+  // evicted before the ones that have been reused.
+  auto& e = m_entries[index];
+  e.key = key;
+  e.subFile = subFile;
+  e.data = std::move(payload);
+  e.referenced = false;
+
+  m_lookup.insert({ key, index });
+  m_size += size;
+}
+
+
+GfxTransferCacheStats GfxTransferCache::getStats() const {
+  std::unique_lock lock(m_mutex);
+
+  GfxTransferCacheStats result;
+  result.hits = m_hits;
+  result.misses = m_misses;
+  result.evictions = m_evictions;
+  result.entryCount = m_lookup.size();
+  result.size = m_size;
+  result.budget = m_budget;
+  return result;
+}
+
+
+bool GfxTransferCache::evictLocked(
+        uint64_t                      size) {
+  if (size > m_budget)
+    return false;
+
+  while (m_size + size > m_budget) {
+    if (m_hand >= m_entries.size())
+      m_hand = 0;
+
+    auto& e = m_entries[m_hand];
+
+    if (e.data) {
+      if (e.referenced) {
+        e.referenced = false;
+      } else {
+        m_size -= e.data->size();
+        m_evictions += 1;
+        m_lookup.erase(e.key);
+
+        e = Entry();
+        m_freeEntries.push_back(m_hand);
+      }
+    }
+
+    m_hand += 1;
+  }
+
+  return true;
+}
+
+
+
+
+GfxTransferManagerIface::GfxTransferManagerIface(
+        Io                            io,
+        GfxDevice                     device,
+        uint64_t                      stagingBufferSize)
+: GfxTransferManagerIface(std::move(io), Jobs(), std::move(device), stagingBufferSize) {
+
+}
+
+
 GfxTransferManagerIface::GfxTransferManagerIface(
         Io                            io,
+        Jobs                          jobs,
         GfxDevice                     device,
         uint64_t                      stagingBufferSize)
 : m_io                (std::move(io))
+, m_jobs              (std::move(jobs))
 , m_device            (std::move(device))
 , m_gpuDecompression  (m_device->getFeatures().gdeflateDecompression)
 , m_stagingAllocator  (stagingBufferSize) {
@@ -20,13 +177,19 @@ GfxTransferManagerIface::GfxTransferManagerIface(
 
   m_stagingBuffer = m_device->createBuffer(bufferDesc, GfxMemoryType::eSystemMemory);
 
-  GfxSemaphoreDesc semaphoreDesc;
-  semaphoreDesc.debugName = "GfxTransferManager semaphore";
+  // Register the mapped staging buffer with the I/O backend so that
+  // reads into staging memory do not need to pin pages every time.
+  if (!m_io->registerBuffer(m_stagingBuffer->map(GfxUsage::eCpuWrite, 0), stagingBufferSize))
+    Log::info("GfxTransferManager: Staging buffer not registered for I/O");
 
-  m_semaphore = m_device->createSemaphore(semaphoreDesc);
+  for (size_t i = 0; i < QueueCount; i++) {
+    GfxSemaphoreDesc semaphoreDesc;
+    semaphoreDesc.debugName = i ? "GfxTransferManager background semaphore" : "GfxTransferManager semaphore";
 
-  for (size_t i = 0; i < ContextCount; i++)
-    m_contexts[i] = m_device->createContext(GfxQueue::eComputeTransfer);
+    m_queues[i].semaphore = m_device->createSemaphore(semaphoreDesc);
+  }
+
+  m_stats.stagingCapacity = stagingBufferSize;
 
   m_submissionThread = std::thread([this] { submit(); });
   m_completionThread = std::thread([this] { retire(); });
@@ -34,20 +197,35 @@ GfxTransferManagerIface::GfxTransferManagerIface(
 
 
 GfxTransferManagerIface::~GfxTransferManagerIface() {
-  std::unique_lock lock(m_mutex);
+  // Drop pending prefetches and wait for the ones
+  // in flight since their callbacks access the cache
+  { std::unique_lock lock(m_prefetchMutex);
 
-  flushLocked();
+    m_prefetchQueue = std::queue<IoArchiveSubFileRef>();
 
-  GfxTransferOp op;
-  op.type = GfxTransferOpType::eStop;
+    m_prefetchCond.wait(lock, [this] {
+      return !m_prefetchRequestsInFlight;
+    });
+  }
+
+  std::unique_lock lock(m_mutex);
 
-  m_submissionQueue.push(std::move(op));
+  // The submission thread exits once all batches are submitted
+  for (size_t i = 0; i < QueueCount; i++)
+    flushLocked(GfxTransferQueue(i));
+
+  m_stop = true;
   m_submissionCond.notify_one();
 
   lock.unlock();
 
   m_submissionThread.join();
   m_completionThread.join();
+
+  // I/O callbacks may still be returning from a submission
+  std::unique_lock submitLock(m_submitMutex);
+
+  m_io->unregisterBuffer(m_stagingBuffer->map(GfxUsage::eCpuWrite, 0));
 }
 
 
@@ -55,6 +233,16 @@ uint64_t GfxTransferManagerIface::uploadBuffer(
         IoArchiveSubFileRef           subFile,
         GfxBuffer                     buffer,
         uint64_t                      offset) {
+  return uploadBuffer(GfxTransferQueue::eUrgent,
+    std::move(subFile), std::move(buffer), offset);
+}
+
+
+uint64_t GfxTransferManagerIface::uploadBuffer(
+        GfxTransferQueue              queue,
+        IoArchiveSubFileRef           subFile,
+        GfxBuffer                     buffer,
+        uint64_t                      offset) {
   std::unique_lock lock(m_mutex);
 
   GfxTransferOp op;
@@ -63,7 +251,7 @@ uint64_t GfxTransferManagerIface::uploadBuffer(
   op.dstBuffer = std::move(buffer);
   op.dstBufferOffset = offset;
 
-  return enqueueLocked(std::move(op));
+  return enqueueLocked(queue, std::move(op));
 }
 
 
@@ -71,6 +259,16 @@ uint64_t GfxTransferManagerIface::uploadImage(
         IoArchiveSubFileRef           subFile,
         GfxImage                      image,
   const GfxImageSubresource&          subresources) {
+  return uploadImage(GfxTransferQueue::eUrgent,
+    std::move(subFile), std::move(image), subresources);
+}
+
+
+uint64_t GfxTransferManagerIface::uploadImage(
+        GfxTransferQueue              queue,
+        IoArchiveSubFileRef           subFile,
+        GfxImage                      image,
+  const GfxImageSubresource&          subresources) {
   std::unique_lock lock(m_mutex);
 
   GfxTransferOp op;
@@ -79,326 +277,537 @@ uint64_t GfxTransferManagerIface::uploadImage(
   op.dstImage = std::move(image);
   op.dstImageSubresources = subresources;
 
-  return enqueueLocked(std::move(op));
+  return enqueueLocked(queue, std::move(op));
+}
+
+
+void GfxTransferManagerIface::prefetch(
+        IoArchiveSubFileRef           subFile) {
+  IoRequest request;
+
+  { std::unique_lock lock(m_prefetchMutex);
+
+    if (!subFile || !subFile->getCompressedSize()
+     || subFile->getCompressedSize() > m_prefetchBudget)
+      return;
+
+    // If the sub-file is already cached, mark it as recently used
+    auto entry = m_prefetchCache.find(getCacheKey(subFile));
+
+    if (entry != m_prefetchCache.end()) {
+      m_prefetchLru.splice(m_prefetchLru.end(), m_prefetchLru, entry->second.lru);
+      return;
+    }
+
+    m_prefetchQueue.push(std::move(subFile));
+    request = issuePrefetchesLocked();
+  }
+
+  if (request)
+    m_io->submit(request);
+}
+
+
+void GfxTransferManagerIface::setPrefetchBudget(
+        uint64_t                      budget) {
+  std::unique_lock lock(m_prefetchMutex);
+
+  m_prefetchBudget = budget;
+  evictPrefetchesLocked(0);
+}
+
+
+void GfxTransferManagerIface::setCacheBudget(
+        uint64_t                      budget) {
+  m_cache.setBudget(budget);
+}
+
+
+GfxTransferCacheStats GfxTransferManagerIface::getCacheStats() const {
+  return m_cache.getStats();
 }
 
 
 uint64_t GfxTransferManagerIface::flush() {
   std::unique_lock lock(m_mutex);
-  return flushLocked();
+  flushLocked(GfxTransferQueue::eBackground);
+  return flushLocked(GfxTransferQueue::eUrgent);
+}
+
+
+uint64_t GfxTransferManagerIface::flush(
+        GfxTransferQueue              queue) {
+  std::unique_lock lock(m_mutex);
+  return flushLocked(queue);
 }
 
 
 uint64_t GfxTransferManagerIface::getCompletedBatchId() {
-  flush();
+  return getCompletedBatchId(GfxTransferQueue::eUrgent);
+}
+
+
+uint64_t GfxTransferManagerIface::getCompletedBatchId(
+        GfxTransferQueue              queue) {
+  flush(queue);
+
+  return m_queues[uint32_t(queue)].semaphore->getCurrentValue();
+}
+
 
-  return m_semaphore->getCurrentValue();
+void GfxTransferManagerIface::waitForCompletion(
+        uint64_t                      batch) {
+  waitForCompletion(GfxTransferQueue::eUrgent, batch);
 }
 
 
 void GfxTransferManagerIface::waitForCompletion(
+        GfxTransferQueue              queue,
         uint64_t                      batch) {
+  auto& q = m_queues[uint32_t(queue)];
+
   { std::unique_lock lock(m_mutex);
 
-    if (batch >= m_batchId)
-      flushLocked();
+    if (batch >= q.batchId)
+      flushLocked(queue);
   }
 
-  return m_semaphore->wait(batch);
+  return q.semaphore->wait(batch);
 }
 
 
-uint64_t GfxTransferManagerIface::flushLocked() {
-  if (!m_batchSize)
-    return m_batchId - 1;
+GfxTransferStats GfxTransferManagerIface::getStats() {
+  std::unique_lock lock(m_mutex);
 
-  GfxTransferOp op;
-  op.type = GfxTransferOpType::eFlush;
-  op.batchId = m_batchId;
+  GfxTransferStats result = m_stats;
+
+  for (size_t i = 0; i < QueueCount; i++)
+    result.batchesPending[i] = m_queues[i].batches.size();
+
+  return result;
+}
+
+
+uint64_t GfxTransferManagerIface::flushLocked(
+        GfxTransferQueue              queue) {
+  auto& q = m_queues[uint32_t(queue)];
+
+  if (!q.batchSize)
+    return q.batchId - 1;
+
+  // Compute staging buffer offsets relative to the start of
+  // the batch. Memory is allocated for the entire batch in
+  // one go, otherwise we'd get deadlocks if the allocator
+  // is too fragmented. Direct uploads do not need any.
+  GfxTransferBatch batch;
+  batch.batchId = q.batchId;
+  batch.ops = std::move(q.ops);
+
+  for (auto& op : batch.ops) {
+    if (!useDirectUpload(op)) {
+      op.stagingBufferOffset = batch.stagingBufferSize;
+      op.stagingBufferSize = computeAlignedSize(*op.subFile);
+
+      batch.stagingBufferSize += op.stagingBufferSize;
+    }
+  }
+
+  q.ops.clear();
+  q.batches.push(std::move(batch));
 
-  m_submissionQueue.push(std::move(op));
   m_submissionCond.notify_one();
 
-  m_batchSize = 0;
-  return m_batchId++;
+  q.batchSize = 0;
+  return q.batchId++;
 }
 
 
 uint64_t GfxTransferManagerIface::enqueueLocked(
+        GfxTransferQueue              queue,
         GfxTransferOp&&               op) {
+  auto& q = m_queues[uint32_t(queue)];
   uint64_t alignedSize = computeAlignedSize(*op.subFile);
 
   // We can't allow any single batch to be larger than the
   // staging buffer, so flush early if that's a problem.
-  if (m_batchSize + alignedSize > m_stagingAllocator.capacity())
-    flushLocked();
+  if (q.batchSize + alignedSize > m_stagingAllocator.capacity())
+    flushLocked(queue);
 
   // Enqueue the operation. We do not have to wake up the
   // worker thread since it won't do anything useful until
   // the batch is flushed anyway.
-  uint64_t batchId = m_batchId;
+  uint64_t batchId = q.batchId;
   op.batchId = batchId;
+  op.queue = queue;
 
-  m_submissionQueue.push(std::move(op));
+  q.ops.push_back(std::move(op));
 
   // Flush current batch if it uses at least a quarter of
   // the staging buffer. This should help reduce stalls.
-  m_batchSize += alignedSize;
+  q.batchSize += alignedSize;
 
-  if (m_batchSize >= m_stagingAllocator.capacity() / 4)
-    flushLocked();
+  if (q.batchSize >= m_stagingAllocator.capacity() / 4)
+    flushLocked(queue);
 
   return batchId;
 }
 
 
-GfxContext GfxTransferManagerIface::acquireContext(
-        uint64_t                      batchId) {
-  if (batchId >= ContextCount)
-    m_semaphore->wait(batchId - ContextCount);
+bool GfxTransferManagerIface::dequeueBatchLocked(
+        GfxTransferBatch&             batch,
+        GfxTransferQueue&             queue,
+        uint64_t&                     stagingBufferOffset) {
+  // Batches complete in order within each queue, so only the
+  // first batch of each queue can be considered. If a batch has
+  // to wait for staging memory, do not let batches with a lower
+  // priority take memory away from it, or else large urgent
+  // batches may get starved by a stream of background batches.
+  for (size_t i = 0; i < QueueCount; i++) {
+    auto& q = m_queues[i];
 
-  GfxContext context = m_contexts[batchId % ContextCount];
-  context->reset();
+    if (q.batches.empty())
+      continue;
+
+    auto offset = m_stagingAllocator.alloc(q.batches.front().stagingBufferSize, 1);
+
+    if (!offset)
+      return false;
+
+    batch = std::move(q.batches.front());
+    q.batches.pop();
+
+    queue = GfxTransferQueue(i);
+    stagingBufferOffset = *offset;
+    return true;
+  }
 
-  return context;
+  return false;
 }
 
 
-void GfxTransferManagerIface::submit() {
-  std::vector<GfxTransferOp> ops;
+GfxContext GfxTransferManagerIface::acquireContextLocked() {
+  if (!m_contexts.empty()) {
+    GfxContext context = std::move(m_contexts.back());
+    m_contexts.pop_back();
+    return context;
+  }
+
+  m_stats.contextCount += 1;
+  return m_device->createContext(GfxQueue::eComputeTransfer);
+}
 
+
+void GfxTransferManagerIface::submit() {
   while (true) {
     std::unique_lock lock(m_mutex);
 
-    m_submissionCond.wait(lock, [this] {
-      return !m_submissionQueue.empty();
-    });
+    GfxTransferBatch batch;
+    GfxTransferQueue queue = GfxTransferQueue::eUrgent;
+    uint64_t stagingBufferOffset = 0;
+
+    bool found = false;
+    bool waiting = false;
+
+    auto waitStart = std::chrono::steady_clock::time_point();
 
-    // If the next operation in queue is an upload, just
-    // add it to the local buffer, otherwise flush.
-    while (!m_submissionQueue.empty()) {
-      GfxTransferOp op = std::move(m_submissionQueue.front());
-      m_submissionQueue.pop();
-
-      if (op.type == GfxTransferOpType::eStop) {
-        // Forward stop event to completion worker and exit
-        m_completionQueue.push(std::move(op));
-        m_completionCond.notify_one();
-        return;
+    // Wait for a batch for which we can allocate staging memory
+    m_submissionCond.wait(lock, [&] {
+      found = dequeueBatchLocked(batch, queue, stagingBufferOffset);
+
+      if (found)
+        return true;
+
+      bool pending = false;
+
+      for (const auto& q : m_queues)
+        pending |= !q.batches.empty();
+
+      if (pending && !waiting) {
+        waiting = true;
+        waitStart = std::chrono::steady_clock::now();
       }
 
-      if (op.type == GfxTransferOpType::eUploadBuffer || op.type == GfxTransferOpType::eUploadImage) {
-        ops.push_back(std::move(op));
+      return m_stop && !pending;
+    });
+
+    if (!found) {
+      // Forward stop event to completion worker and exit
+      GfxTransferOp op;
+      op.type = GfxTransferOpType::eStop;
+
+      m_completionQueue.push(std::move(op));
+      m_completionCond.notify_one();
+      return;
+    }
+
+    if (waiting) {
+      m_stats.stagingWaitCount += 1;
+      m_stats.stagingWaitTime += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - waitStart);
+    }
+
+    m_stats.stagingUsed += batch.stagingBufferSize;
+    m_stats.stagingUsedMax = std::max(m_stats.stagingUsedMax, m_stats.stagingUsed);
+    m_stats.batchesSubmitted[uint32_t(queue)] += 1;
+
+    lock.unlock();
+
+    submitBatch(queue, batch, stagingBufferOffset);
+  }
+}
+
+
+void GfxTransferManagerIface::submitBatch(
+        GfxTransferQueue              queue,
+        GfxTransferBatch&             batch,
+        uint64_t                      stagingBufferOffset) {
+  // Build and submit the I/O request
+  IoRequest request = m_io->createRequest();
+  bool ioPending = false;
+
+  for (auto& op : batch.ops) {
+    auto archive = op.subFile.container();
+    op.stagingBufferOffset += stagingBufferOffset;
+
+    // Use prefetched data if possible. The copy or decode has
+    // to happen before the request is submitted, since command
+    // lists get submitted as soon as all I/O has completed.
+    auto prefetched = getPrefetchedData(op.subFile);
+
+    if (!prefetched)
+      prefetched = m_cache.find(getCacheKey(op.subFile));
+
+    if (prefetched) {
+      void* dst = useDirectUpload(op)
+        ? op.dstBuffer->map(GfxUsage::eCpuWrite, op.dstBufferOffset)
+        : m_stagingBuffer->map(GfxUsage::eCpuWrite, op.stagingBufferOffset);
+
+      bool success = true;
+
+      if (useGpuDecompression(*op.subFile) || !op.subFile->isCompressed())
+        std::memcpy(dst, prefetched->data(), prefetched->size());
+      else if (m_jobs)
+        success = op.subFile->decompress(m_jobs, dst, prefetched->data());
+      else
+        success = op.subFile->decompress(dst, prefetched->data());
+
+      if (success)
         continue;
-      }
 
-      if (op.type == GfxTransferOpType::eFlush) {
-        // Allocate staging memory in one go. Otherwise we'd get
-        // deadlocks if the allocator is too fragmented. Do not
-        // allocate staging memory for direct-upload buffers.
-        uint64_t stagingBufferSize = 0;
-        uint64_t stagingBufferOffset = 0;
-
-        for (auto& op : ops) {
-          if (!useDirectUpload(op)) {
-            op.stagingBufferOffset = stagingBufferSize;
-            op.stagingBufferSize = computeAlignedSize(*op.subFile);
-
-            stagingBufferSize += op.stagingBufferSize;
-          }
-        }
-
-        // If necessary, wait for staging memory to get freed
-        m_retireCond.wait(lock, [this, stagingBufferSize, &stagingBufferOffset] {
-          auto offset = m_stagingAllocator.alloc(stagingBufferSize, 1);
-
-          if (!offset)
-            return false;
-
-          stagingBufferOffset = *offset;
-          return true;
-        });
-
-        lock.unlock();
-
-        // Build and submit the I/O request
-        IoRequest request = m_io->createRequest();
-
-        for (auto& op : ops) {
-          auto archive = op.subFile.container();
-          op.stagingBufferOffset += stagingBufferOffset;
-
-          if (useDirectUpload(op)) {
-            op.subFile->read(request,
-              op.dstBuffer->map(GfxUsage::eCpuWrite, op.dstBufferOffset));
-          } else {
-            if (useGpuDecompression(*op.subFile)) {
-              op.subFile->readCompressed(request,
-                m_stagingBuffer->map(GfxUsage::eCpuWrite, op.stagingBufferOffset));
-            } else {
-              op.subFile->read(request,
-                m_stagingBuffer->map(GfxUsage::eCpuWrite, op.stagingBufferOffset));
-            }
-          }
-        }
-
-        m_io->submit(request);
-
-        // Figure out how large the scratch buffer for image decompression needs
-        // to be, and recreate it with at least the required size if necessary.
-        uint64_t scratchBufferSize = 0;
-
-        for (auto& op : ops) {
-          if (op.type == GfxTransferOpType::eUploadImage && useGpuDecompression(*op.subFile)) {
-            op.scratchBufferSize = align<uint64_t>(op.subFile->getSize(), 256);
-            scratchBufferSize = std::max(scratchBufferSize, op.scratchBufferSize);
-          }
-        }
-
-        if (scratchBufferSize && (!m_scratchBuffer || m_scratchBuffer->getDesc().size < scratchBufferSize)) {
-          GfxBufferDesc scratchDesc;
-          scratchDesc.debugName = "GfxTransferManager scratch buffer";
-          scratchDesc.usage = GfxUsage::eTransferSrc | GfxUsage::eDecompressionDst;
-          scratchDesc.size = std::max(1ull << findmsb(scratchBufferSize - 1), 16ull << 20);
-          scratchDesc.flags = GfxBufferFlag::eDedicatedAllocation;
-
-          m_scratchBuffer = m_device->createBuffer(scratchDesc, GfxMemoryType::eAny);
-        }
-
-        // Acquire a context for command recording
-        GfxContext context = acquireContext(op.batchId);
-
-        // Start with initializing all images to allow batching barriers.
-        for (const auto& op : ops) {
-          if (op.type == GfxTransferOpType::eUploadImage) {
-            context->imageBarrier(op.dstImage, op.dstImageSubresources,
-              0, 0, GfxUsage::eTransferDst, 0, GfxBarrierFlag::eDiscard);
-          }
-        }
-
-        // Record all buffer decompression and copy commands. These
-        // do not use scratch memory and can work independently.
-        for (const auto& op : ops) {
-          if (op.type != GfxTransferOpType::eUploadBuffer || useDirectUpload(op))
-            continue;
-
-          if (useGpuDecompression(*op.subFile)) {
-            context->decompressBuffer(
-              op.dstBuffer, op.dstBufferOffset, op.subFile->getSize(),
-              m_stagingBuffer, op.stagingBufferOffset, op.subFile->getCompressedSize());
-          } else {
-            context->copyBuffer(op.dstBuffer, op.dstBufferOffset,
-              m_stagingBuffer, op.stagingBufferOffset, op.subFile->getSize());
-          }
-        }
-
-        // Record all image decompression and copy commands, but try to
-        // batch them as much as possible within the scratch buffer.
-        size_t firstCommand = 0;
-
-        while (firstCommand < ops.size()) {
-          size_t commandCount = 0;
-
-          uint64_t scratchSize = m_scratchBuffer ? m_scratchBuffer->getDesc().size : 0;
-          uint64_t scratchOffset = 0;
-
-          // If this is not the first set of commands using scratch memory,
-          // issue a barrier to prevent write-after-read hazards.
-          if (firstCommand) {
-            context->memoryBarrier(
-              GfxUsage::eTransferSrc, 0,
-              GfxUsage::eDecompressionDst, 0);
-          }
-
-          while (firstCommand + commandCount < ops.size()) {
-            auto& op = ops[firstCommand + commandCount];
-
-            if (op.type != GfxTransferOpType::eUploadImage || !useGpuDecompression(*op.subFile)) {
-              commandCount += 1;
-              continue;
-            }
-
-            // If the scratch buffer is full, exit and record copy commands first.
-            if (scratchOffset + op.scratchBufferSize > scratchSize)
-              break;
-
-            // Otherwise, record the decompression command
-            op.scratchBufferOffset = scratchOffset;
-
-            context->decompressBuffer(
-              m_scratchBuffer, op.scratchBufferOffset, op.subFile->getSize(),
-              m_stagingBuffer, op.stagingBufferOffset, op.subFile->getCompressedSize());
-
-            scratchOffset += op.scratchBufferSize;
-            commandCount += 1;
-          }
-
-          // If any scratch memory is used, this means that compression
-          // commands have been recorded and we need a barrier.
-          if (scratchOffset) {
-            context->memoryBarrier(
-              GfxUsage::eDecompressionDst, 0,
-              GfxUsage::eTransferSrc, 0);
-          }
-
-          // Copy data from the staging or scratch buffer to the images
-          for (size_t i = firstCommand; i < firstCommand + commandCount; i++) {
-            const auto& op = ops[i];
-
-            if (op.type != GfxTransferOpType::eUploadImage)
-              continue;
-
-            bool scratch = useGpuDecompression(*op.subFile);
-
-            Extent3D extent = op.dstImage->computeMipExtent(op.dstImageSubresources.mipIndex);
-
-            context->copyBufferToImage(op.dstImage,
-              op.dstImageSubresources, Offset3D(0, 0, 0), extent,
-              scratch ? m_scratchBuffer : m_stagingBuffer,
-              scratch ? op.scratchBufferOffset : op.stagingBufferOffset,
-              Extent2D(extent));
-          }
-
-          firstCommand += commandCount;
-        }
-
-        // Issue a final memory barrier to make transfer commands visible
-        context->memoryBarrier(GfxUsage::eTransferDst | GfxUsage::eDecompressionDst, 0, 0, 0);
-
-        // Prepare the command submission, and queue it for
-        // execution when the I/O request has completed.
-        request->executeOnCompletion([
-          cDevice       = m_device,
-          cCommandList  = context->endCommandList(),
-          cSemaphore    = m_semaphore,
-          cBatchId      = op.batchId
-        ] (IoStatus status) mutable {
-          if (status != IoStatus::eSuccess)
-            Log::err("GfxTransferManager: An I/O error has occured on batch ", cBatchId);
-
-          GfxCommandSubmission submission;
-          submission.addCommandList(GfxCommandList(cCommandList));
-          submission.addSignalSemaphore(cSemaphore, cBatchId);
-
-          cDevice->submit(GfxQueue::eComputeTransfer, std::move(submission));
-        });
-
-        // Submit retire operation to the completion thread.
-        lock.lock();
-
-        GfxTransferOp retireOp;
-        retireOp.type = GfxTransferOpType::eRetire;
-        retireOp.batchId = op.batchId;
-        retireOp.stagingBufferOffset = stagingBufferOffset;
-        retireOp.stagingBufferSize = stagingBufferSize;
-        retireOp.scratchBuffer = m_scratchBuffer;
-
-        m_completionQueue.push(std::move(retireOp));
-        m_completionCond.notify_one();
-
-        ops.clear();
+      Log::err("GfxTransferManager: Failed to decode cached sub-file");
+    }
+
+    if (useDirectUpload(op)) {
+      readSubFile(request, op,
+        op.dstBuffer->map(GfxUsage::eCpuWrite, op.dstBufferOffset));
+    } else {
+      readSubFile(request, op,
+        m_stagingBuffer->map(GfxUsage::eCpuWrite, op.stagingBufferOffset));
+    }
+
+    ioPending = true;
+  }
+
+  // Backends may never complete requests without any items, so
+  // only submit the request if there actually is data to read.
+  if (ioPending)
+    m_io->submit(request);
+
+  // Figure out how large the scratch buffer for image decompression needs
+  // to be, and recreate it with at least the required size if necessary.
+  uint64_t scratchBufferSize = 0;
+
+  for (auto& op : batch.ops) {
+    if (op.type == GfxTransferOpType::eUploadImage && useGpuDecompression(*op.subFile)) {
+      op.scratchBufferSize = align<uint64_t>(op.subFile->getSize(), 256);
+      scratchBufferSize = std::max(scratchBufferSize, op.scratchBufferSize);
+    }
+  }
+
+  if (scratchBufferSize && (!m_scratchBuffer || m_scratchBuffer->getDesc().size < scratchBufferSize)) {
+    GfxBufferDesc scratchDesc;
+    scratchDesc.debugName = "GfxTransferManager scratch buffer";
+    scratchDesc.usage = GfxUsage::eTransferSrc | GfxUsage::eDecompressionDst;
+    scratchDesc.size = std::max(1ull << findmsb(scratchBufferSize - 1), 16ull << 20);
+    scratchDesc.flags = GfxBufferFlag::eDedicatedAllocation;
+
+    m_scratchBuffer = m_device->createBuffer(scratchDesc, GfxMemoryType::eAny);
+  }
+
+  // Acquire a context for command recording. Contexts are
+  // recycled on retirement, so this never waits for the GPU.
+  GfxContext context;
+
+  { std::unique_lock lock(m_mutex);
+    context = acquireContextLocked();
+  }
+
+  context->reset();
+
+  // Assets may get evicted while the upload is still in flight, so
+  // keep destination resources alive until the batch has completed.
+  for (const auto& op : batch.ops) {
+    context->trackObject(op.dstBuffer);
+    context->trackObject(op.dstImage);
+  }
+
+  // Start with initializing all images to allow batching barriers.
+  for (const auto& op : batch.ops) {
+    if (op.type == GfxTransferOpType::eUploadImage) {
+      context->imageBarrier(op.dstImage, op.dstImageSubresources,
+        0, 0, GfxUsage::eTransferDst, 0, GfxBarrierFlag::eDiscard);
+    }
+  }
+
+  // Record all buffer decompression and copy commands. These
+  // do not use scratch memory and can work independently.
+  for (const auto& op : batch.ops) {
+    if (op.type != GfxTransferOpType::eUploadBuffer || useDirectUpload(op))
+      continue;
+
+    if (useGpuDecompression(*op.subFile)) {
+      context->decompressBuffer(
+        op.dstBuffer, op.dstBufferOffset, op.subFile->getSize(),
+        m_stagingBuffer, op.stagingBufferOffset, op.subFile->getCompressedSize());
+    } else {
+      context->copyBuffer(op.dstBuffer, op.dstBufferOffset,
+        m_stagingBuffer, op.stagingBufferOffset, op.subFile->getSize());
+    }
+  }
+
+  // Record all image decompression and copy commands, but try to
+  // batch them as much as possible within the scratch buffer.
+  size_t firstCommand = 0;
+
+  while (firstCommand < batch.ops.size()) {
+    size_t commandCount = 0;
+
+    uint64_t scratchSize = m_scratchBuffer ? m_scratchBuffer->getDesc().size : 0;
+    uint64_t scratchOffset = 0;
+
+    // If this is not the first set of commands using scratch memory,
+    // issue a barrier to prevent write-after-read hazards.
+    if (firstCommand) {
+      context->memoryBarrier(
+        GfxUsage::eTransferSrc, 0,
+        GfxUsage::eDecompressionDst, 0);
+    }
+
+    while (firstCommand + commandCount < batch.ops.size()) {
+      auto& op = batch.ops[firstCommand + commandCount];
+
+      if (op.type != GfxTransferOpType::eUploadImage || !useGpuDecompression(*op.subFile)) {
+        commandCount += 1;
+        continue;
       }
+
+      // If the scratch buffer is full, exit and record copy commands first.
+      if (scratchOffset + op.scratchBufferSize > scratchSize)
+        break;
+
+      // Otherwise, record the decompression command
+      op.scratchBufferOffset = scratchOffset;
+
+      context->decompressBuffer(
+        m_scratchBuffer, op.scratchBufferOffset, op.subFile->getSize(),
+        m_stagingBuffer, op.stagingBufferOffset, op.subFile->getCompressedSize());
+
+      scratchOffset += op.scratchBufferSize;
+      commandCount += 1;
+    }
+
+    // If any scratch memory is used, this means that compression
+    // commands have been recorded and we need a barrier.
+    if (scratchOffset) {
+      context->memoryBarrier(
+        GfxUsage::eDecompressionDst, 0,
+        GfxUsage::eTransferSrc, 0);
+    }
+
+    // Copy data from the staging or scratch buffer to the images
+    for (size_t i = firstCommand; i < firstCommand + commandCount; i++) {
+      const auto& op = batch.ops[i];
+
+      if (op.type != GfxTransferOpType::eUploadImage)
+        continue;
+
+      bool scratch = useGpuDecompression(*op.subFile);
+
+      Extent3D extent = op.dstImage->computeMipExtent(op.dstImageSubresources.mipIndex);
+
+      context->copyBufferToImage(op.dstImage,
+        op.dstImageSubresources, Offset3D(0, 0, 0), extent,
+        scratch ? m_scratchBuffer : m_stagingBuffer,
+        scratch ? op.scratchBufferOffset : op.stagingBufferOffset,
+        Extent2D(extent));
     }
+
+    firstCommand += commandCount;
+  }
+
+  // Issue a final memory barrier to make transfer commands visible
+  context->memoryBarrier(GfxUsage::eTransferDst | GfxUsage::eDecompressionDst, 0, 0, 0);
+
+  // Submit the command list once the I/O request has completed. If
+  // all data was served from a cache, there is nothing to wait for.
+  GfxCommandList commandList = context->endCommandList();
+
+  if (ioPending) {
+    request->executeOnCompletion([
+      this,
+      cQueue        = queue,
+      cBatchId      = batch.batchId,
+      cCommandList  = std::move(commandList)
+    ] (IoStatus status) mutable {
+      if (status != IoStatus::eSuccess)
+        Log::err("GfxTransferManager: An I/O error has occured on batch ", cBatchId);
+
+      submitCommands(cQueue, cBatchId, std::move(cCommandList));
+    });
+  } else {
+    submitCommands(queue, batch.batchId, std::move(commandList));
+  }
+
+  // Submit retire operation to the completion thread.
+  std::unique_lock lock(m_mutex);
+
+  GfxTransferOp retireOp;
+  retireOp.type = GfxTransferOpType::eRetire;
+  retireOp.queue = queue;
+  retireOp.batchId = batch.batchId;
+  retireOp.stagingBufferOffset = stagingBufferOffset;
+  retireOp.stagingBufferSize = batch.stagingBufferSize;
+  retireOp.scratchBuffer = m_scratchBuffer;
+  retireOp.context = std::move(context);
+
+  m_completionQueue.push(std::move(retireOp));
+  m_completionCond.notify_one();
+}
+
+
+void GfxTransferManagerIface::submitCommands(
+        GfxTransferQueue              queue,
+        uint64_t                      batchId,
+        GfxCommandList&&              commandList) {
+  std::unique_lock lock(m_submitMutex);
+
+  auto& q = m_queues[uint32_t(queue)];
+  q.readyBatches.emplace(batchId, std::move(commandList));
+
+  // The semaphore value is used as the completed batch ID, so batches
+  // must be submitted in order. A batch whose I/O completes early, e.g.
+  // because all its data was cached, has to wait for its predecessors.
+  while (!q.readyBatches.empty() && q.readyBatches.begin()->first == q.submittedBatchId + 1) {
+    auto entry = q.readyBatches.begin();
+
+    GfxCommandSubmission submission;
+    submission.addCommandList(std::move(entry->second));
+    submission.addSignalSemaphore(q.semaphore, entry->first);
+
+    m_device->submit(GfxQueue::eComputeTransfer, std::move(submission));
+
+    q.submittedBatchId = entry->first;
+    q.readyBatches.erase(entry);
   }
 }
 
@@ -428,20 +837,219 @@ void GfxTransferManagerIface::retire() {
     // Unlock so that we can wait for the GPU
     lock.unlock();
 
-    m_semaphore->wait(op.batchId);
+    m_queues[uint32_t(op.queue)].semaphore->wait(op.batchId);
+
+    // Release tracked destination resources right away rather
+    // than when the context gets reused for another batch.
+    if (op.context)
+      op.context->reset();
 
-    // Re-acquire lock and free the staging buffer region
-    // attached to this this operation.
+    // Re-acquire lock, free the staging buffer region attached
+    // to this this operation, and recycle the command context.
     lock.lock();
 
     if (op.stagingBufferSize)
       m_stagingAllocator.free(op.stagingBufferOffset, op.stagingBufferSize);
 
-    m_retireCond.notify_one();
+    m_stats.stagingUsed -= op.stagingBufferSize;
+
+    if (op.context)
+      m_contexts.push_back(std::move(op.context));
+
+    m_submissionCond.notify_one();
   }
 }
 
 
+IoRequest GfxTransferManagerIface::issuePrefetchesLocked() {
+  // Only keep a small amount of prefetch data in flight at any
+  // given time so that uploads are not stuck behind prefetches.
+  IoRequest request;
+
+  std::vector<GfxTransferCacheKey> keys;
+  uint64_t size = 0;
+
+  while (!m_prefetchQueue.empty()
+      && m_prefetchBytesInFlight + size < PrefetchMaxBytesInFlight) {
+    IoArchiveSubFileRef subFile = std::move(m_prefetchQueue.front());
+    m_prefetchQueue.pop();
+
+    GfxTransferCacheKey key = getCacheKey(subFile);
+    uint64_t dataSize = subFile->getCompressedSize();
+
+    if (m_prefetchCache.find(key) != m_prefetchCache.end())
+      continue;
+
+    // Drop the prefetch if the cache is full of pending entries
+    if (!evictPrefetchesLocked(dataSize))
+      continue;
+
+    auto& entry = m_prefetchCache.emplace(key, GfxTransferPrefetchEntry()).first->second;
+    entry.subFile = subFile;
+    entry.data = std::make_shared<std::vector<char>>(dataSize);
+    entry.lru = m_prefetchLru.insert(m_prefetchLru.end(), key);
+
+    if (!request)
+      request = m_io->createRequest();
+
+    subFile->readCompressed(request, entry.data->data());
+
+    m_prefetchSize += dataSize;
+    size += dataSize;
+
+    keys.push_back(key);
+  }
+
+  if (!request)
+    return request;
+
+  m_prefetchBytesInFlight += size;
+  m_prefetchRequestsInFlight += 1;
+
+  request->executeOnCompletion([
+    this,
+    cKeys = std::move(keys),
+    cSize = size
+  ] (IoStatus status) {
+    completePrefetches(cKeys, cSize, status);
+  });
+
+  return request;
+}
+
+
+bool GfxTransferManagerIface::evictPrefetchesLocked(
+        uint64_t                      size) {
+  auto i = m_prefetchLru.begin();
+
+  while (m_prefetchSize + size > m_prefetchBudget && i != m_prefetchLru.end()) {
+    auto entry = m_prefetchCache.find(*i);
+
+    // Entries that are still being read cannot be evicted
+    if (!entry->second.ready) {
+      i++;
+      continue;
+    }
+
+    m_prefetchSize -= entry->second.data->size();
+    m_prefetchCache.erase(entry);
+
+    i = m_prefetchLru.erase(i);
+  }
+
+  return m_prefetchSize + size <= m_prefetchBudget;
+}
+
+
+void GfxTransferManagerIface::completePrefetches(
+  const std::vector<GfxTransferCacheKey>& keys,
+        uint64_t                      size,
+        IoStatus                      status) {
+  IoRequest request;
+
+  { std::unique_lock lock(m_prefetchMutex);
+
+    // Pending entries are never evicted, so all entries still exist
+    for (const auto& key : keys) {
+      auto entry = m_prefetchCache.find(key);
+
+      if (status == IoStatus::eSuccess) {
+        entry->second.ready = true;
+      } else {
+        m_prefetchSize -= entry->second.data->size();
+        m_prefetchLru.erase(entry->second.lru);
+        m_prefetchCache.erase(entry);
+      }
+    }
+
+    if (status != IoStatus::eSuccess)
+      Log::warn("GfxTransferManager: Failed to prefetch ", keys.size(), " sub-files");
+
+    // The budget may have been lowered in the meantime
+    evictPrefetchesLocked(0);
+
+    m_prefetchBytesInFlight -= size;
+    m_prefetchRequestsInFlight -= 1;
+    m_prefetchCond.notify_all();
+
+    request = issuePrefetchesLocked();
+  }
+
+  if (request)
+    m_io->submit(request);
+}
+
+
+std::shared_ptr<std::vector<char>> GfxTransferManagerIface::getPrefetchedData(
+  const IoArchiveSubFileRef&          subFile) {
+  std::unique_lock lock(m_prefetchMutex);
+
+  if (m_prefetchCache.empty())
+    return nullptr;
+
+  auto entry = m_prefetchCache.find(getCacheKey(subFile));
+
+  if (entry == m_prefetchCache.end() || !entry->second.ready)
+    return nullptr;
+
+  m_prefetchLru.splice(m_prefetchLru.end(), m_prefetchLru, entry->second.lru);
+  return entry->second.data;
+}
+
+
+void GfxTransferManagerIface::readSubFile(
+  const IoRequest&                    request,
+  const GfxTransferOp&                op,
+        void*                         dst) {
+  bool gpuDecompression = useGpuDecompression(*op.subFile);
+
+  if (!m_cache.isCacheable(*op.subFile)) {
+    if (gpuDecompression)
+      op.subFile->readCompressed(request, dst);
+    else if (m_jobs)
+      op.subFile->read(m_jobs, request, dst);
+    else
+      op.subFile->read(request, dst);
+    return;
+  }
+
+  // Read the compressed sub-file and add it to the cache
+  // before decoding it into the destination, if necessary.
+  if (gpuDecompression || !op.subFile->isCompressed()) {
+    op.subFile->readCompressed(request, dst, [
+      this,
+      cSubFile  = op.subFile
+    ] (const void* data, size_t size) {
+      m_cache.insert(getCacheKey(cSubFile), cSubFile, data, size);
+      return IoStatus::eSuccess;
+    });
+  } else {
+    op.subFile->streamCompressed(request, [
+      this,
+      cSubFile  = op.subFile,
+      cDst      = dst
+    ] (const void* data, size_t size) {
+      m_cache.insert(getCacheKey(cSubFile), cSubFile, data, size);
+
+      bool success = m_jobs
+        ? cSubFile->decompress(m_jobs, cDst, data)
+        : cSubFile->decompress(cDst, data);
+
+      return success ? IoStatus::eSuccess : IoStatus::eError;
+    });
+  }
+}
+
+
+GfxTransferCacheKey GfxTransferManagerIface::getCacheKey(
+  const IoArchiveSubFileRef&          subFile) {
+  GfxTransferCacheKey key;
+  key.archive = subFile.container().get();
+  key.offset = subFile->getOffsetInArchive();
+  return key;
+}
+
+
 uint64_t GfxTransferManagerIface::computeAlignedSize(
   const IoArchiveSubFile&             subFile) const {
   return useGpuDecompression(subFile)
@@ -1,12 +1,22 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "../alloc/alloc_chunk.h"
 
+#include "../util/util_hash.h"
+
 #include "../io/io_archive.h"
 
 #include "gfx_device.h"
@@ -26,8 +36,6 @@ enum class GfxTransferOpType : uint32_t {
   eUploadBuffer,
   /** Image upload */
   eUploadImage,
-  /** Flush current batch */
-  eFlush,
   /** Retires batch */
   eRetire,
   /** Stop worker threads */
@@ -35,6 +43,22 @@ enum class GfxTransferOpType : uint32_t {
 };
 
 
+/**
+ * \brief Transfer queue
+ *
+ * Each queue has its own batch IDs, and batches complete in
+ * order within a queue, but not necessarily across queues.
+ */
+enum class GfxTransferQueue : uint32_t {
+  /** Transfers that are needed as soon as possible,
+   *  e.g. resources that are required for rendering. */
+  eUrgent     = 0,
+  /** Transfers that can be delayed, e.g. additional
+   *  detail for resources that are already usable. */
+  eBackground = 1,
+};
+
+
 /**
  * \brief Tansfer operation
  */
@@ -56,11 +80,240 @@ struct GfxTransferOp {
   /** Destination image for image uploads */
   GfxImage dstImage;
   GfxImageSubresource dstImageSubresources;
+  /** Context to recycle on retirement */
+  GfxContext context;
+  /** Queue that the operation was submitted to */
+  GfxTransferQueue queue = GfxTransferQueue::eUrgent;
   /** Transfer operation */
   GfxTransferOpType type = GfxTransferOpType::eNone;
 };
 
 
+/**
+ * \brief Transfer batch
+ *
+ * Set of transfer operations that get submitted together
+ * and share one contiguous staging buffer allocation.
+ */
+struct GfxTransferBatch {
+  /** Transfer batch ID */
+  uint64_t batchId = 0;
+  /** Total staging memory required by the batch */
+  uint64_t stagingBufferSize = 0;
+  /** Transfer operations */
+  std::vector<GfxTransferOp> ops;
+};
+
+
+/**
+ * \brief Transfer queue state
+ */
+struct GfxTransferQueueState {
+  /** Timeline semaphore, signaled with the batch ID */
+  GfxSemaphore semaphore;
+  /** Batch ID of the batch currently being recorded */
+  uint64_t batchId = 1;
+  /** Staging memory used by the current batch */
+  uint64_t batchSize = 0;
+  /** Operations in the current batch */
+  std::vector<GfxTransferOp> ops;
+  /** Flushed batches waiting for staging memory */
+  std::queue<GfxTransferBatch> batches;
+  /** Batch ID of the last batch submitted to the device */
+  uint64_t submittedBatchId = 0;
+  /** Recorded batches that are ready for submission, but
+   *  must wait for earlier batches to be submitted first */
+  std::map<uint64_t, GfxCommandList> readyBatches;
+};
+
+
+/**
+ * \brief Transfer statistics
+ */
+struct GfxTransferStats {
+  /** Staging buffer size, in bytes */
+  uint64_t stagingCapacity = 0;
+  /** Staging memory currently allocated, in bytes */
+  uint64_t stagingUsed = 0;
+  /** Highest amount of staging memory allocated at any time */
+  uint64_t stagingUsedMax = 0;
+  /** Number of times the submission thread had to wait for
+   *  staging memory while batches were pending. This includes
+   *  background batches held back behind an urgent batch. */
+  uint64_t stagingWaitCount = 0;
+  /** Total time spent waiting for staging memory */
+  std::chrono::microseconds stagingWaitTime = { };
+  /** Number of submitted batches, per queue */
+  std::array<uint64_t, 2> batchesSubmitted = { };
+  /** Number of flushed batches that have not been submitted yet */
+  std::array<uint64_t, 2> batchesPending = { };
+  /** Number of command contexts allocated */
+  uint64_t contextCount = 0;
+};
+
+
+/**
+ * \brief Transfer cache key
+ *
+ * Identifies a sub-file by the archive it is
+ * stored in and its offset within the archive.
+ */
+struct GfxTransferCacheKey {
+  /** Archive containing the sub-file */
+  const IoArchive* archive = nullptr;
+  /** Sub-file offset within the archive file */
+  uint64_t offset = 0;
+
+  bool operator == (const GfxTransferCacheKey&) const = default;
+
+  size_t hash() const {
+    HashState hash;
+    hash.add(archive);
+    hash.add(offset);
+    return hash;
+  }
+};
+
+
+/**
+ * \brief Prefetched sub-file
+ *
+ * Stores the compressed contents of a sub-file in system
+ * memory, so that uploads do not need to perform any I/O.
+ */
+struct GfxTransferPrefetchEntry {
+  /** Sub-file reference. Keeps the archive alive for as
+   *  long as the entry exists so that keys remain unique. */
+  IoArchiveSubFileRef subFile;
+  /** Compressed sub-file data */
+  std::shared_ptr<std::vector<char>> data;
+  /** Whether the read has completed successfully */
+  bool ready = false;
+  /** Position in the LRU list */
+  std::list<GfxTransferCacheKey>::iterator lru;
+};
+
+
+/**
+ * \brief Transfer cache statistics
+ */
+struct GfxTransferCacheStats {
+  /** Number of uploads served from the cache */
+  uint64_t hits = 0;
+  /** Number of uploads that had to read from disk */
+  uint64_t misses = 0;
+  /** Number of entries evicted from the cache */
+  uint64_t evictions = 0;
+  /** Number of cached sub-files */
+  uint64_t entryCount = 0;
+  /** Total size of cached data, in bytes */
+  uint64_t size = 0;
+  /** Cache budget, in bytes */
+  uint64_t budget = 0;
+};
+
+
+/**
+ * \brief Transfer cache
+ *
+ * Keeps the compressed contents of recently uploaded sub-files in
+ * system memory, so that assets which get evicted and streamed in
+ * again do not need to go back to disk. Uses CLOCK replacement:
+ * entries are stored in a ring and get a reference bit on every
+ * hit, and the clock hand evicts the first entry without one,
+ * clearing reference bits as it passes.
+ *
+ * This class is thread-safe.
+ */
+class GfxTransferCache {
+
+public:
+
+  GfxTransferCache();
+
+  ~GfxTransferCache();
+
+  /**
+   * \brief Sets cache budget
+   *
+   * Evicts entries as necessary. The default budget
+   * is zero, which disables the cache entirely.
+   * \param [in] budget Cache size, in bytes
+   */
+  void setBudget(
+          uint64_t                      budget);
+
+  /**
+   * \brief Checks whether a sub-file can be cached
+   *
+   * \param [in] subFile Sub-file
+   * \returns \c true if the sub-file fits into the budget
+   */
+  bool isCacheable(
+    const IoArchiveSubFile&             subFile) const;
+
+  /**
+   * \brief Looks up cached sub-file
+   *
+   * Updates hit and miss counters accordingly.
+   * \param [in] key Sub-file key
+   * \returns Compressed sub-file data, or \c nullptr
+   */
+  std::shared_ptr<std::vector<char>> find(
+    const GfxTransferCacheKey&          key);
+
+  /**
+   * \brief Adds sub-file to the cache
+   *
+   * Does nothing if the sub-file is already cached.
+   * \param [in] key Sub-file key
+   * \param [in] subFile Sub-file reference
+   * \param [in] data Compressed sub-file data
+   * \param [in] size Compressed sub-file size
+   */
+  void insert(
+    const GfxTransferCacheKey&          key,
+    const IoArchiveSubFileRef&          subFile,
+    const void*                         data,
+          size_t                        size);
+
+  /**
+   * \brief Retrieves cache statistics
+   * \returns Cache statistics
+   */
+  GfxTransferCacheStats getStats() const;
+
+private:
+
+  struct Entry {
+    GfxTransferCacheKey key;
+    IoArchiveSubFileRef subFile;
+    std::shared_ptr<std::vector<char>> data;
+    bool referenced = false;
+  };
+
+  mutable std::mutex                m_mutex;
+
+  std::atomic<uint64_t>             m_budget = { 0ull };
+
+  uint64_t                          m_size = 0;
+  uint64_t                          m_hits = 0;
+  uint64_t                          m_misses = 0;
+  uint64_t                          m_evictions = 0;
+
+  std::vector<Entry>                m_entries;
+  std::vector<size_t>               m_freeEntries;
+  size_t                            m_hand = 0;
+
+  std::unordered_map<GfxTransferCacheKey,
+    size_t, HashMemberProc>         m_lookup;
+
+  bool evictLocked(
+          uint64_t                      size);
+
+};
+
+
 /**
  * \brief Asynchronous transfer manager
  *
@@ -73,11 +326,14 @@ struct GfxTransferOp {
  * a bottleneck.
  *
  * As for the execution model, transfers will execute and
- * complete in the order they are submitted. This may in
- * some cases reduce efficiency, but makes synchronization
- * with transfers significantly more convenient since only
- * the batch ID from the last submission needs to be
- * remembered.
+ * complete in the order they are submitted to any given
+ * queue. This may in some cases reduce efficiency, but makes
+ * synchronization with transfers significantly more convenient
+ * since only the batch ID from the last submission needs to be
+ * remembered. Urgent batches get staging memory first. If an
+ * urgent batch does not fit into the staging memory that is
+ * currently available, background batches are held back until
+ * it does, so that they cannot starve it.
  *
  * All methods in this class are thread-safe, however no
  * lifetime management is performed. All objects involved
@@ -85,7 +341,8 @@ struct GfxTransferOp {
  * transfer has completed.
  */
 class GfxTransferManagerIface {
-  constexpr static size_t ContextCount = 4;
+  constexpr static size_t QueueCount = 2;
+  constexpr static uint64_t PrefetchMaxBytesInFlight = 4ull << 20;
 public:
 
   /**
@@ -102,6 +359,23 @@ public:
           GfxDevice                     device,
           uint64_t                      stagingBufferSize);
 
+  /**
+   * \brief Initializes transfer manager with a job manager
+   *
+   * If the device does not support GPU decompression, large
+   * GDeflate sub-files will be decoded on multiple threads.
+   * \param [in] io I/O subsystem instance
+   * \param [in] jobs Job manager
+   * \param [in] device Graphics device
+   * \param [in] stagingBufferSize Size of the system memory
+   *    buffer, in bytes.
+   */
+  GfxTransferManagerIface(
+          Io                            io,
+          Jobs                          jobs,
+          GfxDevice                     device,
+          uint64_t                      stagingBufferSize);
+
   /**
    * \brief Destroys transfer manager
    *
@@ -130,6 +404,21 @@ public:
           GfxBuffer                     buffer,
           uint64_t                      offset);
 
+  /**
+   * \brief Enqueues a buffer upload on a given queue
+   *
+   * \param [in] queue Transfer queue
+   * \param [in] subFile Archive sub file containing the data
+   * \param [in] buffer Destination buffer
+   * \param [in] offset Destination buffer offset
+   * \returns Transfer batch ID for the given queue
+   */
+  uint64_t uploadBuffer(
+          GfxTransferQueue              queue,
+          IoArchiveSubFileRef           subFile,
+          GfxBuffer                     buffer,
+          uint64_t                      offset);
+
   /**
    * \brief Enqueues a texture upload
    *
@@ -152,6 +441,64 @@ public:
           GfxImage                      image,
     const GfxImageSubresource&          subresources);
 
+  /**
+   * \brief Enqueues a texture upload on a given queue
+   *
+   * \param [in] queue Transfer queue
+   * \param [in] subFile Archive sub file containing the data
+   * \param [in] image Destination image
+   * \param [in] subresources Destination subresources
+   * \returns Transfer batch ID for the given queue
+   */
+  uint64_t uploadImage(
+          GfxTransferQueue              queue,
+          IoArchiveSubFileRef           subFile,
+          GfxImage                      image,
+    const GfxImageSubresource&          subresources);
+
+  /**
+   * \brief Prefetches sub-file into system memory
+   *
+   * Reads the compressed sub-file into a system memory cache
+   * without allocating any GPU resources, so that subsequent
+   * uploads of the same sub-file do not need to wait for I/O.
+   *
+   * Prefetches are best-effort and only use a small amount of
+   * I/O bandwidth at a time in order to not delay uploads. They
+   * are dropped if the prefetch budget is exhausted by entries
+   * that are still being read.
+   * \param [in] subFile Archive sub file to prefetch
+   */
+  void prefetch(
+          IoArchiveSubFileRef           subFile);
+
+  /**
+   * \brief Sets prefetch cache budget
+   *
+   * Evicts least recently used entries as necessary. The
+   * default budget is zero, which disables prefetching.
+   * \param [in] budget Prefetch cache size, in bytes
+   */
+  void setPrefetchBudget(
+          uint64_t                      budget);
+
+  /**
+   * \brief Sets upload cache budget
+   *
+   * Uploaded sub-files are kept in system memory up to the
+   * given budget so that re-streaming them avoids disk I/O.
+   * The default budget is zero, which disables the cache.
+   * \param [in] budget Cache size, in bytes
+   */
+  void setCacheBudget(
+          uint64_t                      budget);
+
+  /**
+   * \brief Retrieves upload cache statistics
+   * \returns Upload cache statistics
+   */
+  GfxTransferCacheStats getCacheStats() const;
+
   /**
    * \brief Flushes current transfer batch
    *
@@ -160,11 +507,22 @@ public:
    * may be useful if per-resource batch ID tracking is not desired.
    *
    * No operation will be performed if no transfer is queued up.
-   * \returns ID of the submitted transfer batch. This is always
-   *    equal to the batch ID of the last enqueued transfer operation.
+   * Flushes all queues.
+   * \returns ID of the submitted urgent transfer batch. This is
+   *    always equal to the batch ID of the last transfer operation
+   *    enqueued on the urgent queue.
    */
   uint64_t flush();
 
+  /**
+   * \brief Flushes current transfer batch of a given queue
+   *
+   * \param [in] queue Transfer queue
+   * \returns ID of the submitted transfer batch for the queue
+   */
+  uint64_t flush(
+          GfxTransferQueue              queue);
+
   /**
    * \brief Retrieves last completed batch ID
    *
@@ -174,26 +532,52 @@ public:
    * safely be used.
    *
    * This may flush the current batch in order to guarantee
-   * forward progress.
+   * forward progress. Only applies to the urgent queue.
    * \returns \c true if the batch has completed
    */
   uint64_t getCompletedBatchId();
 
+  /**
+   * \brief Retrieves last completed batch ID of a given queue
+   *
+   * \param [in] queue Transfer queue
+   * \returns Last completed batch ID for the queue
+   */
+  uint64_t getCompletedBatchId(
+          GfxTransferQueue              queue);
+
   /**
    * \brief Waits for a given transfer batch to complete
    *
    * This should be used sparingly, e.g. when loading a minimal
    * set of resources at application startup without which the
    * application cannot run in any meaningful way, such as UI
-   * textures and font resources.
+   * textures and font resources. Only applies to the urgent queue.
    * \param [in] batch ID of the transfer batch to wait for
    */
   void waitForCompletion(
           uint64_t                      batch);
 
+  /**
+   * \brief Waits for a transfer batch on a given queue to complete
+   *
+   * \param [in] queue Transfer queue
+   * \param [in] batch ID of the transfer batch to wait for
+   */
+  void waitForCompletion(
+          GfxTransferQueue              queue,
+          uint64_t                      batch);
+
+  /**
+   * \brief Retrieves transfer statistics
+   * \returns Current statistics
+   */
+  GfxTransferStats getStats();
+
 private:
 
   Io                                m_io;
+  Jobs                              m_jobs;
   GfxDevice                         m_device;
   bool                              m_gpuDecompression;
 
@@ -201,36 +585,87 @@ private:
   GfxBuffer                         m_stagingBuffer;
   GfxBuffer                         m_scratchBuffer;
 
-  GfxSemaphore                      m_semaphore;
-
   std::mutex                        m_mutex;
+  std::mutex                        m_submitMutex;
 
-  uint64_t                          m_batchId = 1;
-  uint64_t                          m_batchSize = 0;
+  std::array<GfxTransferQueueState, QueueCount> m_queues;
+  std::vector<GfxContext>           m_contexts;
 
-  std::array<GfxContext, ContextCount> m_contexts;
+  GfxTransferStats                  m_stats;
+  bool                              m_stop = false;
 
-  std::condition_variable           m_retireCond;
   std::condition_variable           m_submissionCond;
-  std::queue<GfxTransferOp>         m_submissionQueue;
   std::thread                       m_submissionThread;
 
   std::condition_variable           m_completionCond;
   std::queue<GfxTransferOp>         m_completionQueue;
   std::thread                       m_completionThread;
 
-  uint64_t flushLocked();
+  alignas(CacheLineSize)
+  std::mutex                        m_prefetchMutex;
+  std::condition_variable           m_prefetchCond;
+
+  uint64_t                          m_prefetchBudget = 0;
+  uint64_t                          m_prefetchSize = 0;
+  uint64_t                          m_prefetchBytesInFlight = 0;
+  uint32_t                          m_prefetchRequestsInFlight = 0;
+
+  std::queue<IoArchiveSubFileRef>   m_prefetchQueue;
+  std::list<GfxTransferCacheKey>    m_prefetchLru;
+  std::unordered_map<GfxTransferCacheKey,
+    GfxTransferPrefetchEntry, HashMemberProc> m_prefetchCache;
+
+  GfxTransferCache                  m_cache;
+
+  uint64_t flushLocked(
+          GfxTransferQueue              queue);
 
   uint64_t enqueueLocked(
+          GfxTransferQueue              queue,
           GfxTransferOp&&               op);
 
-  GfxContext acquireContext(
-          uint64_t                      batchId);
+  bool dequeueBatchLocked(
+          GfxTransferBatch&             batch,
+          GfxTransferQueue&             queue,
+          uint64_t&                     stagingBufferOffset);
+
+  GfxContext acquireContextLocked();
 
   void submit();
 
+  void submitBatch(
+          GfxTransferQueue              queue,
+          GfxTransferBatch&             batch,
+          uint64_t                      stagingBufferOffset);
+
+  void submitCommands(
+          GfxTransferQueue              queue,
+          uint64_t                      batchId,
+          GfxCommandList&&              commandList);
+
   void retire();
 
+  IoRequest issuePrefetchesLocked();
+
+  bool evictPrefetchesLocked(
+          uint64_t                      size);
+
+  void completePrefetches(
+    const std::vector<GfxTransferCacheKey>& keys,
+          uint64_t                      size,
+          IoStatus                      status);
+
+  std::shared_ptr<std::vector<char>> getPrefetchedData(
+    const IoArchiveSubFileRef&          subFile);
+
+  void readSubFile(
+    const IoRequest&                    request,
+    const GfxTransferOp&                op,
+          void*                         dst);
+
+  static GfxTransferCacheKey getCacheKey(
+    const IoArchiveSubFileRef&          subFile);
+
   uint64_t computeAlignedSize(
     const IoArchiveSubFile&             subFile) const;
 
@@ -262,6 +697,14 @@ public:
   : IfaceRef<GfxTransferManagerIface>(std::make_shared<GfxTransferManagerIface>(
       std::move(io), std::move(device), stagingBufferSize)) { }
 
+  GfxTransferManager(
+          Io                            io,
+          Jobs                          jobs,
+          GfxDevice                     device,
+          uint64_t                      stagingBufferSize)
+  : IfaceRef<GfxTransferManagerIface>(std::make_shared<GfxTransferManagerIface>(
+      std::move(io), std::move(jobs), std::move(device), stagingBufferSize)) { }
+
 };
 
 }
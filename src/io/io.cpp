@@ -11,6 +11,26 @@
 
 namespace as {
 
+void IoIface::trackRequest(
+        IoRequestIface&               request) {
+  uint64_t bytesRead = request.getReadSize();
+  uint64_t bytesWritten = request.getWriteSize();
+
+  m_stats.recordSubmission(request.getItemCount());
+
+  // Completion callbacks run after all item callbacks, so the
+  // measured latency includes any decompression work etc.
+  auto submitTime = std::chrono::steady_clock::now();
+
+  request.executeOnCompletion([this, bytesRead, bytesWritten, submitTime] (IoStatus status) {
+    m_stats.recordCompletion(status, bytesRead, bytesWritten,
+      std::chrono::steady_clock::now() - submitTime);
+  });
+}
+
+
+
+
 Io::Io(
         IoBackend                     backend,
         uint32_t                      workerCount)
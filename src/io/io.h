@@ -5,6 +5,7 @@
 
 #include "io_file.h"
 #include "io_request.h"
+#include "io_stats.h"
 
 namespace as {
 
@@ -63,6 +64,94 @@ public:
   virtual bool submit(
     const IoRequest&                    request) = 0;
 
+  /**
+   * \brief Registers a memory region for I/O
+   *
+   * Allows the backend to pin the given memory region once, so
+   * that reads into and writes from that region do not need to
+   * map pages on every request. This is most useful for large,
+   * persistently mapped staging buffers.
+   *
+   * The memory region \e must remain valid until it is
+   * unregistered, and \e must not overlap with any other
+   * registered region.
+   * \param [in] data Pointer to the start of the region
+   * \param [in] size Size of the region, in bytes
+   * \returns \c true if the region was registered. If this
+   *    returns \c false, the region can still be used for
+   *    I/O, but no special optimizations will be performed.
+   */
+  virtual bool registerBuffer(
+          void*                         data,
+          size_t                        size) = 0;
+
+  /**
+   * \brief Unregisters a memory region
+   *
+   * There \e must not be any pending I/O requests accessing the
+   * region. Has no effect if the region was not registered.
+   * \param [in] data Pointer to the start of the region
+   */
+  virtual void unregisterBuffer(
+          void*                         data) = 0;
+
+  /**
+   * \brief Queries read coalescing parameters
+   * \returns Current coalescing parameters
+   */
+  IoCoalescingParameters getCoalescingParameters() const {
+    IoCoalescingParameters result;
+    result.maxGap = m_coalescingMaxGap.load(std::memory_order_relaxed);
+    result.maxSize = m_coalescingMaxSize.load(std::memory_order_relaxed);
+    return result;
+  }
+
+  /**
+   * \brief Sets read coalescing parameters
+   *
+   * Only affects requests submitted after this call. Useful
+   * to tune the backend for the underlying storage device,
+   * or to disable coalescing altogether.
+   * \param [in] params Coalescing parameters
+   */
+  void setCoalescingParameters(
+    const IoCoalescingParameters&       params) {
+    m_coalescingMaxGap.store(params.maxGap, std::memory_order_relaxed);
+    m_coalescingMaxSize.store(params.maxSize, std::memory_order_relaxed);
+  }
+
+  /**
+   * \brief Queries I/O statistics
+   *
+   * Returns a snapshot of the statistics gathered since the
+   * backend was created. Safe to call from any thread, and
+   * cheap enough to call once per frame.
+   * \returns Current statistics
+   */
+  IoStats getStats() const {
+    return m_stats.getStats();
+  }
+
+protected:
+
+  IoStatsCounters m_stats;
+
+  /**
+   * \brief Starts tracking statistics for a request
+   *
+   * Must be called by the backend on submission, after the
+   * request has been marked as pending but before it can
+   * possibly complete.
+   * \param [in] request Request to track
+   */
+  void trackRequest(
+          IoRequestIface&               request);
+
+private:
+
+  std::atomic<uint64_t> m_coalescingMaxGap  = { IoCoalescingParameters().maxGap };
+  std::atomic<uint64_t> m_coalescingMaxSize = { IoCoalescingParameters().maxSize };
+
 };
 
 
@@ -2,6 +2,8 @@
 #include "../util/util_deflate.h"
 #include "../util/util_error.h"
 #include "../util/util_log.h"
+#include "../util/util_lz4.h"
+#include "../util/util_zstd.h"
 
 #include "io_archive.h"
 
@@ -26,12 +28,30 @@ bool decompressArchiveMemory(
 
     case IoArchiveCompression::eGDeflate:
       return gdeflateDecode(output, input);
+
+    case IoArchiveCompression::eLz4:
+      return lz4Decode(output, input);
+
+    case IoArchiveCompression::eZstd:
+      return zstdDecode(output, input);
   }
 
   return false;
 }
 
 
+bool decompressArchiveMemory(
+  const Jobs&                         jobs,
+        WrMemoryView                  output,
+        RdMemoryView                  input,
+        IoArchiveCompression          compression) {
+  if (compression == IoArchiveCompression::eGDeflate)
+    return gdeflateDecode(jobs, output, input);
+
+  return decompressArchiveMemory(output, input, compression);
+}
+
+
 
 
 IoStatus IoArchiveSubFile::read(
@@ -51,6 +71,24 @@ IoStatus IoArchiveSubFile::read(
 }
 
 
+IoStatus IoArchiveSubFile::read(
+  const Jobs&                         jobs,
+        void*                         dst) const {
+  if (!isCompressed())
+    return readCompressed(dst);
+
+  std::vector<char> compressed(getCompressedSize());
+  IoStatus status = readCompressed(compressed.data());
+
+  if (status != IoStatus::eSuccess)
+    return status;
+
+  return decompress(jobs, dst, compressed.data())
+    ? IoStatus::eSuccess
+    : IoStatus::eError;
+}
+
+
 void IoArchiveSubFile::read(
   const IoRequest&                    request,
         void*                         dst) const {
@@ -71,6 +109,28 @@ void IoArchiveSubFile::read(
 }
 
 
+void IoArchiveSubFile::read(
+  const Jobs&                         jobs,
+  const IoRequest&                    request,
+        void*                         dst) const {
+  if (!isCompressed()) {
+    readCompressed(request, dst);
+  } else {
+    streamCompressed(request, [
+      cJobs     = jobs,
+      cDst      = dst,
+      cSize     = getSize(),
+      cType     = getCompressionType()
+    ] (const void* src, size_t size) {
+      bool result = decompressArchiveMemory(cJobs,
+        WrMemoryView(cDst, cSize),
+        RdMemoryView(src, size), cType);
+      return result ? IoStatus::eSuccess : IoStatus::eError;
+    });
+  }
+}
+
+
 IoStatus IoArchiveSubFile::readCompressed(
         void*                         dst) const {
   return getFile()->read(
@@ -100,6 +160,17 @@ bool IoArchiveSubFile::decompress(
 }
 
 
+bool IoArchiveSubFile::decompress(
+  const Jobs&                         jobs,
+        void*                         dstData,
+  const void*                         srcData) const {
+  return decompressArchiveMemory(jobs,
+    WrMemoryView(dstData, getSize()),
+    RdMemoryView(srcData, getCompressedSize()),
+    getCompressionType());
+}
+
+
 IoFile& IoArchiveSubFile::getFile() const {
   return m_archive.m_file;
 }
@@ -124,6 +195,14 @@ IoArchiveSubFileRef IoArchiveFile::findSubFile(FourCC identifier) const {
 }
 
 
+RdMemoryView IoArchiveFile::getInlineData() const {
+  if (!m_inlineSize)
+    return RdMemoryView();
+
+  return m_archive.getInlineData(m_inlineOffset, m_inlineSize);
+}
+
+
 
 
 IoArchive::IoArchive(Private, IoFile file)
@@ -132,9 +211,14 @@ IoArchive::IoArchive(Private, IoFile file)
     // Reset everything if parsing failed
     m_file = nullptr;
     m_fileNames.clear();
-    m_inlineData.clear();
+    m_inlineData.reset();
+    m_inlineDataSize = 0;
+    m_inlinePages.clear();
+    m_inlinePagesLoaded.reset();
     m_subFiles.clear();
     m_files.clear();
+    m_nameSeeds.clear();
+    m_nameSlots.clear();
     m_lookupTable.clear();
   }
 }
@@ -145,13 +229,28 @@ IoArchive::~IoArchive() {
 }
 
 
-IoArchiveFileRef IoArchive::findFile(const std::string& name) const {
-  auto entry = m_lookupTable.find(name);
+IoArchiveFileRef IoArchive::findFile(std::string_view name) const {
+  if (!m_nameSlots.empty()) {
+    // Perfect hash lookup. The slot only tells us which file could
+    // have the given name, so we still need to compare the name.
+    uint64_t hash = computeArchiveNameHash(name.data(), name.size());
+    uint32_t bucket = computeArchiveNameBucket(hash, uint32_t(m_nameSeeds.size()));
+    uint32_t slot = computeArchiveNameSlot(hash, m_nameSeeds[bucket], uint32_t(m_nameSlots.size()));
 
-  if (entry == m_lookupTable.end())
-    return IoArchiveFileRef();
+    const auto& file = m_files[m_nameSlots[slot]];
+
+    if (!file.getName() || name != file.getName())
+      return IoArchiveFileRef();
+
+    return IoArchiveFileRef(file, shared_from_this());
+  } else {
+    auto entry = m_lookupTable.find(std::string(name));
+
+    if (entry == m_lookupTable.end())
+      return IoArchiveFileRef();
 
-  return IoArchiveFileRef(m_files[entry->second], shared_from_this());
+    return IoArchiveFileRef(m_files[entry->second], shared_from_this());
+  }
 }
 
 
@@ -177,28 +276,43 @@ bool IoArchive::parseMetadata() {
     return false;
   }
 
-  // Version number is currently always 0
-  if (fileHeader.version) {
+  // Version 1 only adds a name table to version 0, and
+  // version 2 moves inline data out of the metadata blob
+  if (fileHeader.version > 2) {
     Log::err("Archive: Unsupported version ", fileHeader.version);
     return false;
   }
 
-  // Metadata is compressed, so we need to decode it.
-  std::vector<char> compressedMetadata(fileHeader.compressedMetadataSize);
+  bool hasInlinePages = fileHeader.version >= 2;
+
   std::vector<char> metadataBlob(fileHeader.rawMetadataSize);
 
-  if (!fileStream.read(compressedMetadata)) {
-    Log::err("Archive: Failed to read compressed metadata");
-    return false;
-  }
+  if (hasInlinePages) {
+    // Metadata only consists of small tables in this case,
+    // and is stored uncompressed so that we can read it directly
+    if (fileHeader.compressedMetadataSize != fileHeader.rawMetadataSize) {
+      Log::err("Archive: Unexpected metadata size");
+      return false;
+    }
 
-  if (!deflateDecode(metadataBlob, compressedMetadata)) {
-    Log::err("Archive: Failed to decompress metadata");
-    return false;
-  }
+    if (!fileStream.read(metadataBlob)) {
+      Log::err("Archive: Failed to read metadata");
+      return false;
+    }
+  } else {
+    // Metadata is compressed, so we need to decode it.
+    std::vector<char> compressedMetadata(fileHeader.compressedMetadataSize);
+
+    if (!fileStream.read(compressedMetadata)) {
+      Log::err("Archive: Failed to read compressed metadata");
+      return false;
+    }
 
-  compressedMetadata.clear();
-  compressedMetadata.shrink_to_fit();
+    if (!deflateDecode(metadataBlob, compressedMetadata)) {
+      Log::err("Archive: Failed to decompress metadata");
+      return false;
+    }
+  }
 
   RdMemoryView metadataView(metadataBlob);
   RdStream stream(metadataView);
@@ -240,10 +354,13 @@ bool IoArchive::parseMetadata() {
     return false;
   }
 
-  // Read all inline data directly into the array
-  m_inlineData.resize(totalInlineDataSize);
+  // Inline data is either stored directly after the sub-file table,
+  // or in pages that we will decompress on demand. In the latter
+  // case, allocate the array without touching any of its memory.
+  m_inlineData.reset(new char[totalInlineDataSize]);
+  m_inlineDataSize = totalInlineDataSize;
 
-  if (!stream.read(m_inlineData)) {
+  if (!hasInlinePages && !stream.read(m_inlineData.get(), totalInlineDataSize)) {
     Log::err("Archive: Failed to read inline data (", totalInlineDataSize, " bytes)");
     return false;
   }
@@ -263,8 +380,20 @@ bool IoArchive::parseMetadata() {
     }
   }
 
+  // Newer archives store a precomputed name table, in which
+  // case we do not need to build a look-up table ourselves
+  if (fileHeader.version >= 1 && !parseNameTable(stream, fileHeader.fileCount))
+    return false;
+
+  if (hasInlinePages && !parseInlinePageTable(stream))
+    return false;
+
+  bool hasNameTable = !m_nameSlots.empty();
+
   // Finally, create and validate all the file objects
-  // and set up the lookup table.
+  // and set up the lookup table if necessary.
+  m_files.reserve(fileHeader.fileCount);
+
   size_t currSubFileIndex = 0;
   size_t currFileNameOffset = 0;
   size_t currInlineDataOffset = 0;
@@ -278,19 +407,15 @@ bool IoArchive::parseMetadata() {
       ? &m_fileNames[currFileNameOffset]
       : nullptr;
 
-    const void* inlineData = files[i].inlineDataSize
-      ? &m_inlineData[currInlineDataOffset]
-      : nullptr;
-
     if (name && name[files[i].nameLength - 1]) {
       Log::err("Archive: File name not null terminated");
       return false;
     }
 
     auto index = m_files.size();
-    m_files.emplace_back(*this, files[i], name, subFiles, inlineData);
+    m_files.emplace_back(*this, files[i], name, subFiles, currInlineDataOffset);
 
-    if (name && !m_lookupTable.insert({ name, index }).second) {
+    if (name && !hasNameTable && !m_lookupTable.insert({ name, index }).second) {
       Log::err("Archive: Duplicate file name: ", name);
       return false;
     }
@@ -304,6 +429,148 @@ bool IoArchive::parseMetadata() {
 }
 
 
+bool IoArchive::parseNameTable(
+        RdStream<RdMemoryView>&       stream,
+        uint32_t                      fileCount) {
+  IoArchiveNameTableHeader header;
+
+  if (!stream.read(header)) {
+    Log::err("Archive: Failed to read name table header");
+    return false;
+  }
+
+  // An empty name table is valid if no file has a name,
+  // but we need at least one bucket for look-ups.
+  if (!header.bucketCount || header.slotCount > fileCount) {
+    Log::err("Archive: Invalid name table"
+      "\n  Buckets: ", header.bucketCount,
+      "\n  Slots:   ", header.slotCount);
+    return false;
+  }
+
+  m_nameSeeds.resize(header.bucketCount);
+  m_nameSlots.resize(header.slotCount);
+
+  if (!stream.read(m_nameSeeds) || !stream.read(m_nameSlots)) {
+    Log::err("Archive: Failed to read name table");
+    return false;
+  }
+
+  for (uint32_t index : m_nameSlots) {
+    if (index >= fileCount) {
+      Log::err("Archive: Name table entry out of bounds: ", index);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+bool IoArchive::parseInlinePageTable(
+        RdStream<RdMemoryView>&       stream) {
+  IoArchiveInlinePageTableHeader header;
+
+  if (!stream.read(header)) {
+    Log::err("Archive: Failed to read inline page table header");
+    return false;
+  }
+
+  m_inlinePageSize = header.pageSize;
+
+  if (!m_inlinePageSize && m_inlineDataSize) {
+    Log::err("Archive: Invalid inline page size: ", m_inlinePageSize);
+    return false;
+  }
+
+  m_inlinePages.resize(header.pageCount);
+
+  if (!stream.read(m_inlinePages)) {
+    Log::err("Archive: Failed to read inline page table");
+    return false;
+  }
+
+  // Pages must tile the inline data array exactly, or
+  // otherwise we cannot find the page for a given offset
+  uint64_t expectedPageCount = m_inlinePageSize
+    ? (m_inlineDataSize + m_inlinePageSize - 1) / m_inlinePageSize
+    : 0;
+
+  if (expectedPageCount != header.pageCount) {
+    Log::err("Archive: Invalid inline page count"
+      "\n  Page size:   ", m_inlinePageSize,
+      "\n  Page count:  ", header.pageCount,
+      "\n  Inline size: ", m_inlineDataSize);
+    return false;
+  }
+
+  for (uint32_t i = 0; i < header.pageCount; i++) {
+    const auto& page = m_inlinePages[i];
+
+    uint64_t rawSize = std::min<uint64_t>(m_inlinePageSize,
+      m_inlineDataSize - uint64_t(i) * m_inlinePageSize);
+
+    if (page.rawSize != rawSize || page.offset + page.compressedSize > m_file->getSize()) {
+      Log::err("Archive: Invalid inline page:"
+        "\n  Page offset:     ", page.offset,
+        "\n  Compressed size: ", page.compressedSize,
+        "\n  Raw size:        ", page.rawSize);
+      return false;
+    }
+  }
+
+  m_inlinePagesLoaded.reset(new std::atomic<bool>[header.pageCount]());
+  return true;
+}
+
+
+RdMemoryView IoArchive::getInlineData(
+        uint64_t                      offset,
+        uint32_t                      size) const {
+  if (!m_inlinePages.empty()) {
+    uint32_t firstPage = uint32_t(offset / m_inlinePageSize);
+    uint32_t lastPage = uint32_t((offset + size - 1) / m_inlinePageSize);
+
+    for (uint32_t i = firstPage; i <= lastPage; i++) {
+      if (!loadInlinePage(i))
+        return RdMemoryView();
+    }
+  }
+
+  return RdMemoryView(&m_inlineData[offset], size);
+}
+
+
+bool IoArchive::loadInlinePage(
+        uint32_t                      index) const {
+  if (m_inlinePagesLoaded[index].load(std::memory_order_acquire))
+    return true;
+
+  std::lock_guard lock(m_inlineMutex);
+
+  if (m_inlinePagesLoaded[index].load(std::memory_order_relaxed))
+    return true;
+
+  const auto& page = m_inlinePages[index];
+  std::vector<char> compressed(page.compressedSize);
+
+  if (m_file->read(page.offset, page.compressedSize, compressed.data()) != IoStatus::eSuccess) {
+    Log::err("Archive: Failed to read inline page ", index);
+    return false;
+  }
+
+  WrMemoryView output(&m_inlineData[uint64_t(index) * m_inlinePageSize], page.rawSize);
+
+  if (!deflateDecode(output, compressed)) {
+    Log::err("Archive: Failed to decompress inline page ", index);
+    return false;
+  }
+
+  m_inlinePagesLoaded[index].store(true, std::memory_order_release);
+  return true;
+}
+
+
 
 
 IoArchiveCollection::IoArchiveCollection(Io io)
@@ -335,7 +602,9 @@ IoRequest IoArchiveCollection::loadArchive(IoFile file) {
   { std::unique_lock lock(m_mutex);
     for (uint32_t i = 0; i < archive->getFileCount(); i++) {
       auto file = archive->getFile(i);
-      auto result = m_files.insert(std::make_pair(std::string(file->getName()), file));
+      // File names are owned by the archive, which in turn is kept
+      // alive by the file reference, so we do not need a copy here.
+      auto result = m_files.insert(std::make_pair(std::string_view(file->getName()), file));
 
       if (result.second)
         files.push_back(std::move(file));
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <shared_mutex>
 #include <vector>
@@ -25,13 +29,18 @@ class IoArchive;
 struct IoArchiveHeader {
   /** 'ASFILE' */
   char magic[6];
-  /** File version, currently 0 */
+  /** File version. Version 0 archives do not contain a name
+   *  table, version 1 archives store a perfect hash table for
+   *  file names at the end of the metadata blob. Version 2
+   *  archives store the metadata blob uncompressed, and move
+   *  inline data into separately compressed pages. */
   uint16_t version;
   /** Number of files */
   uint32_t fileCount;
   /** Offset to file data section */
   uint32_t fileOffset;
-  /** Compressed metadata size */
+  /** Compressed metadata size. For version 2 archives, this
+   *  is equal to the raw metadata size. */
   uint32_t compressedMetadataSize;
   /** Size of uncompressed metadata */
   uint32_t rawMetadataSize;
@@ -68,6 +77,12 @@ enum class IoArchiveCompression : uint16_t {
   eDeflate      = 1,
   /** File is encoded using GDEFLATE. */
   eGDeflate     = 2,
+  /** File is a raw LZ4 block. Only supported if the
+   *  library was built with LZ4 support. */
+  eLz4          = 3,
+  /** File is a Zstandard frame. Only supported if the
+   *  library was built with Zstandard support. */
+  eZstd         = 4,
 };
 
 
@@ -94,6 +109,121 @@ struct IoArchiveSubFileMetadata {
 };
 
 
+/**
+ * \brief Archive name table header
+ *
+ * Stored after the inline data in the metadata blob of version 1
+ * archives, and followed by \c bucketCount 32-bit seeds and then
+ * \c slotCount 32-bit file indices. Together, these form a minimal
+ * perfect hash table for all named files in the archive, which
+ * allows looking up files without building any data structures
+ * at load time.
+ *
+ * To look up a name, compute its hash with \c computeArchiveNameHash,
+ * find the bucket with \c computeArchiveNameBucket, and then use the
+ * bucket's seed to compute the slot via \c computeArchiveNameSlot.
+ * The slot contains the index of the only file that can possibly
+ * have the given name, so a single string comparison is needed.
+ */
+struct IoArchiveNameTableHeader {
+  /** Number of hash buckets */
+  uint32_t bucketCount;
+  /** Number of slots. Equal to the number of named files. */
+  uint32_t slotCount;
+};
+
+
+/**
+ * \brief Inline data page table header
+ *
+ * Stored after the name table in the metadata blob of version 2
+ * archives, and followed by \c pageCount page descriptors. The
+ * inline data of all files is concatenated and split into pages
+ * of \c pageSize bytes, each of which is deflate-compressed on its
+ * own and stored between the metadata blob and sub-file data.
+ * This way, inline data only needs to be read and decompressed
+ * when it is first accessed.
+ */
+struct IoArchiveInlinePageTableHeader {
+  /** Uncompressed size of each page, except the last */
+  uint32_t pageSize;
+  /** Number of pages */
+  uint32_t pageCount;
+};
+
+
+/**
+ * \brief Inline data page
+ */
+struct IoArchiveInlinePage {
+  /** Offset of the compressed page within the archive, in bytes,
+   *  counted from the start of the archive file. */
+  uint64_t offset;
+  /** Size of the compressed page, in bytes */
+  uint32_t compressedSize;
+  /** Size of the page after decompression, in bytes */
+  uint32_t rawSize;
+};
+
+
+/**
+ * \brief Computes hash of an archive file name
+ *
+ * Uses 64-bit FNV-1a. The result must be stable across
+ * platforms since it is stored in archive files.
+ * \param [in] name File name, excluding the null terminator
+ * \param [in] length Name length, in bytes
+ * \returns Name hash
+ */
+inline uint64_t computeArchiveNameHash(
+    const char*                         name,
+          size_t                        length) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  for (size_t i = 0; i < length; i++) {
+    hash ^= uint8_t(name[i]);
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+
+/**
+ * \brief Computes name table bucket for a name hash
+ *
+ * \param [in] hash Name hash
+ * \param [in] bucketCount Number of buckets
+ * \returns Bucket index
+ */
+inline uint32_t computeArchiveNameBucket(
+          uint64_t                      hash,
+          uint32_t                      bucketCount) {
+  return uint32_t((hash >> 32) % bucketCount);
+}
+
+
+/**
+ * \brief Computes name table slot for a name hash
+ *
+ * \param [in] hash Name hash
+ * \param [in] seed Seed of the bucket the name belongs to
+ * \param [in] slotCount Number of slots
+ * \returns Slot index
+ */
+inline uint32_t computeArchiveNameSlot(
+          uint64_t                      hash,
+          uint32_t                      seed,
+          uint32_t                      slotCount) {
+  // SplitMix64 finalizer to scramble the seeded hash
+  uint64_t x = hash + (uint64_t(seed) + 1u) * 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  x = (x ^ (x >> 31));
+  return uint32_t(x % slotCount);
+}
+
+
 /**
  * \brief Generic archive decompression function
  *
@@ -107,6 +237,23 @@ bool decompressArchiveMemory(
         IoArchiveCompression          compression);
 
 
+/**
+ * \brief Parallel archive decompression function
+ *
+ * Decodes large GDeflate streams on multiple threads. Other
+ * compression types are decoded on the calling thread.
+ * \param [in] jobs Job manager
+ * \param [in] output Destination memory, appropriately sized
+ * \param [in] input Source memory, appropriately sized
+ * \param [in] compression Compression type
+ */
+bool decompressArchiveMemory(
+  const Jobs&                         jobs,
+        WrMemoryView                  output,
+        RdMemoryView                  input,
+        IoArchiveCompression          compression);
+
+
 /**
  * \brief Archive sub-file object
  */
@@ -182,6 +329,19 @@ public:
   IoStatus read(
           void*                         dst) const;
 
+  /**
+   * \brief Synchronously reads sub file using multiple threads
+   *
+   * Same as the regular synchronous read, but decompresses
+   * large sub-files in parallel using the given job manager.
+   * \param [in] jobs Job manager
+   * \param [in] dst Destination buffer
+   * \returns Result of the I/O operation
+   */
+  IoStatus read(
+    const Jobs&                         jobs,
+          void*                         dst) const;
+
   /**
    * \brief Reads sub file
    *
@@ -194,6 +354,22 @@ public:
     const IoRequest&                    request,
           void*                         dst) const;
 
+  /**
+   * \brief Reads sub file using multiple threads for decoding
+   *
+   * Same as the regular asynchronous read, but decompresses
+   * large sub-files in parallel using the given job manager.
+   * The I/O callback blocks until decoding has finished, but
+   * participates in executing the decoding jobs.
+   * \param [in] jobs Job manager
+   * \param [in] request I/O request object
+   * \param [in] dst Destination buffer
+   */
+  void read(
+    const Jobs&                         jobs,
+    const IoRequest&                    request,
+          void*                         dst) const;
+
   /**
    * \brief Reads sub file with callback
    *
@@ -319,6 +495,19 @@ public:
           void*                         dstData,
     const void*                         srcData) const;
 
+  /**
+   * \brief Decompresses sub-file in memory using multiple threads
+   *
+   * \param [in] jobs Job manager
+   * \param [in] dstData Buffer to write decompressed data to
+   * \param [in] srcData Buffer containing compressed sub file
+   * \returns \c true on success
+   */
+  bool decompress(
+    const Jobs&                         jobs,
+          void*                         dstData,
+    const void*                         srcData) const;
+
 private:
 
   IoArchive&                m_archive;
@@ -343,14 +532,14 @@ public:
     const IoArchiveFileMetadata&        metadata,
     const char*                         name,
     const IoArchiveSubFile*             subFiles,
-    const void*                         inlineData)
+          uint64_t                      inlineOffset)
   : m_archive       (archive)
   , m_name          (metadata.nameLength ? name : nullptr)
   , m_type          (metadata.type)
   , m_subFileCount  (metadata.subFileCount)
   , m_subFiles      (metadata.subFileCount ? subFiles : nullptr)
   , m_inlineSize    (metadata.inlineDataSize)
-  , m_inlineData    (metadata.inlineDataSize ? inlineData : nullptr) { }
+  , m_inlineOffset  (inlineOffset) { }
 
   /**
    * \brief Retrieves file name
@@ -399,11 +588,14 @@ public:
    *
    * Note that this pointer does not necessarily
    * meet any specific alignment requirements.
+   *
+   * For archives that store inline data in pages, the first
+   * access to any given page will synchronously read and
+   * decompress that page. If that fails, an empty view
+   * will be returned.
    * \returns Pointer to inline data
    */
-  RdMemoryView getInlineData() const {
-    return RdMemoryView(m_inlineData, m_inlineSize);
-  }
+  RdMemoryView getInlineData() const;
 
 private:
 
@@ -416,7 +608,7 @@ private:
   const IoArchiveSubFile* m_subFiles      = nullptr;
 
   uint32_t                m_inlineSize    = 0;
-  const void*             m_inlineData    = nullptr;
+  uint64_t                m_inlineOffset  = 0;
 
 };
 
@@ -494,7 +686,7 @@ public:
    * \returns Pointer to file object, or \c nullptr
    *    if no file with the given name could be found.
    */
-  IoArchiveFileRef findFile(const std::string& name) const;
+  IoArchiveFileRef findFile(std::string_view name) const;
 
   /**
    * \brief Checks whether the archive file is valid
@@ -509,15 +701,40 @@ private:
   IoFile                        m_file;
 
   std::vector<char>             m_fileNames;
-  std::vector<char>             m_inlineData;
+
+  std::unique_ptr<char[]>       m_inlineData;
+  uint64_t                      m_inlineDataSize = 0;
+
+  uint32_t                      m_inlinePageSize = 0;
+  std::vector<IoArchiveInlinePage> m_inlinePages;
+  std::unique_ptr<std::atomic<bool>[]> m_inlinePagesLoaded;
+
+  mutable std::mutex            m_inlineMutex;
 
   std::vector<IoArchiveSubFile> m_subFiles;
   std::vector<IoArchiveFile>    m_files;
 
+  std::vector<uint32_t>         m_nameSeeds;
+  std::vector<uint32_t>         m_nameSlots;
+
   std::unordered_map<std::string, size_t> m_lookupTable;
 
   bool parseMetadata();
 
+  bool parseNameTable(
+          RdStream<RdMemoryView>&       stream,
+          uint32_t                      fileCount);
+
+  bool parseInlinePageTable(
+          RdStream<RdMemoryView>&       stream);
+
+  RdMemoryView getInlineData(
+          uint64_t                      offset,
+          uint32_t                      size) const;
+
+  bool loadInlinePage(
+          uint32_t                      index) const;
+
   std::shared_ptr<const IoArchive> getPtr() const {
     return shared_from_this();
   }
@@ -582,7 +799,7 @@ private:
 
   std::shared_mutex m_mutex;
 
-  std::unordered_map<std::string, IoArchiveFileRef> m_files;
+  std::unordered_map<std::string_view, IoArchiveFileRef> m_files;
   std::unordered_map<FourCC, IoArchiveFileHandler, HashMemberProc> m_handlers;
 
 };
@@ -127,6 +127,29 @@ public:
           uint64_t                      size,
     const void*                         src) = 0;
 
+  /**
+   * \brief Reserves storage for the file
+   *
+   * Hints the file system that the file will grow to the given
+   * size, which can reduce fragmentation and metadata updates when
+   * writing large files. Does not change the reported file size.
+   * Backends that cannot reserve storage treat this as a no-op.
+   * \param [in] size Expected final file size, in bytes
+   * \returns Status of the operation
+   */
+  virtual IoStatus allocate(
+          uint64_t                      size) = 0;
+
+  /**
+   * \brief Flushes written data to storage
+   *
+   * Blocks until all data written to the file so far is durable.
+   * This \e must not be called while there are any pending
+   * asynchronous write requests for this file.
+   * \returns Status of the operation
+   */
+  virtual IoStatus sync() = 0;
+
 protected:
 
   std::filesystem::path m_path;
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "io_request.h"
 
 namespace as {
@@ -72,8 +74,108 @@ void IoRequestIface::setStatus(
 }
 
 
+uint64_t IoRequestIface::getReadSize() const {
+  uint64_t size = 0;
+
+  for (size_t i = 0; i < m_items.size(); i++) {
+    const auto& item = m_items[i];
+
+    if (item.type == IoRequestType::eRead || item.type == IoRequestType::eStream)
+      size += item.size;
+  }
+
+  return size;
+}
+
+
+uint64_t IoRequestIface::getWriteSize() const {
+  uint64_t size = 0;
+
+  for (size_t i = 0; i < m_items.size(); i++) {
+    if (m_items[i].type == IoRequestType::eWrite)
+      size += m_items[i].size;
+  }
+
+  return size;
+}
+
+
 IoBufferedRequest& IoRequestIface::allocItem() {
   return m_items.emplace_back();
 }
 
+
+void IoRequestIface::batchItems(
+  const IoCoalescingParameters&       params,
+        std::vector<uint32_t>&        indices,
+        std::vector<IoItemBatch>&     batches) const {
+  indices.clear();
+  batches.clear();
+
+  // Writes must execute in order with respect to reads from the
+  // same file, so do not reorder anything if there are any.
+  bool coalesce = params.maxSize != 0;
+
+  for (uint32_t i = 0; i < m_items.size(); i++) {
+    if (m_items[i].type == IoRequestType::eNone)
+      continue;
+
+    if (m_items[i].type == IoRequestType::eWrite)
+      coalesce = false;
+
+    indices.push_back(i);
+  }
+
+  if (coalesce) {
+    std::sort(indices.begin(), indices.end(), [this] (uint32_t a, uint32_t b) {
+      const auto& aItem = m_items[a];
+      const auto& bItem = m_items[b];
+
+      if (aItem.file != bItem.file)
+        return aItem.file.hash() < bItem.file.hash();
+
+      return aItem.offset < bItem.offset;
+    });
+  }
+
+  // Open and stat operations do not transfer any data and
+  // always get their own batch
+  auto isMergeable = [] (const IoBufferedRequest& item) {
+    return item.type == IoRequestType::eRead
+        || item.type == IoRequestType::eStream;
+  };
+
+  for (uint32_t i = 0; i < indices.size(); i++) {
+    const auto& item = m_items[indices[i]];
+
+    if (coalesce && !batches.empty()) {
+      auto& batch = batches.back();
+      const auto& prev = m_items[indices[batch.first]];
+
+      // Overlapping items cannot be scattered with one single
+      // read, so only merge if the new item starts after the end
+      // of the current batch and if all size limits are met.
+      uint64_t batchEnd = batch.offset + batch.size;
+      uint64_t itemEnd = item.offset + item.size;
+
+      if (isMergeable(item) && isMergeable(prev)
+       && item.file == prev.file
+       && item.offset >= batchEnd
+       && item.offset - batchEnd <= params.maxGap
+       && itemEnd - batch.offset <= params.maxSize
+       && batch.count < MaxItemsPerBatch) {
+        batch.size = itemEnd - batch.offset;
+        batch.count += 1;
+        continue;
+      }
+    }
+
+    auto& batch = batches.emplace_back();
+    batch.offset = item.offset;
+    batch.size = item.size;
+    batch.first = i;
+    batch.count = 1;
+  }
+}
+
 }
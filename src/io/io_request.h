@@ -4,6 +4,7 @@
 #include <condition_variable>
 #include <functional>
 #include <mutex>
+#include <vector>
 
 #include "../util/util_iface.h"
 #include "../util/util_small_vector.h"
@@ -41,6 +42,8 @@ enum class IoRequestType : uint32_t {
   eRead         = 1,
   eWrite        = 2,
   eStream       = 3,
+  eOpen         = 4,
+  eStat         = 5,
 };
 
 
@@ -57,6 +60,48 @@ struct IoBufferedRequest {
   const void*   src     = nullptr;
   void*         dst     = nullptr;
   IoCallback    cb;
+  /** File path and open mode, only used for open operations.
+   *  On completion, the opened file is stored in \c file. */
+  std::filesystem::path path;
+  IoOpenMode    mode    = IoOpenMode::eRead;
+};
+
+
+/**
+ * \brief Read coalescing parameters
+ *
+ * Backends may merge read and stream operations on the same file
+ * into one larger read if they are close enough to each other in
+ * the file. This reduces the number of system calls and can help
+ * throughput on slow storage, at the cost of reading and discarding
+ * data that lies between two items.
+ */
+struct IoCoalescingParameters {
+  /** Maximum number of bytes between two items for them to
+   *  be merged. Zero will only merge adjacent items. */
+  uint64_t maxGap = 64ull << 10;
+  /** Maximum size of a merged read, including gaps. Setting
+   *  this to zero disables read coalescing entirely. */
+  uint64_t maxSize = 16ull << 20;
+};
+
+
+/**
+ * \brief Item batch
+ *
+ * Describes a set of buffered items that can be processed with
+ * a single file operation. Item indices are stored in a separate
+ * array, ordered by their offset within the file.
+ */
+struct IoItemBatch {
+  /** Offset of the first byte to read or write */
+  uint64_t offset = 0;
+  /** Total number of bytes covered by the batch, including gaps */
+  uint64_t size = 0;
+  /** Index of the first item in the index array */
+  uint32_t first = 0;
+  /** Number of items in the batch */
+  uint32_t count = 0;
 };
 
 
@@ -252,6 +297,96 @@ public:
     });
   }
 
+  /**
+   * \brief Enqueues a file open operation
+   *
+   * Opens the given file asynchronously. This is useful when many
+   * files need to be opened at once, e.g. archives during startup.
+   * If the file cannot be opened, the operation and therefore the
+   * entire request will fail, and the callback will not be called.
+   *
+   * Note that the file object only becomes available once the
+   * operation has completed, so reads from the opened file must
+   * be submitted with a separate request.
+   * \param [in] path File path, in a platform-specific format
+   * \param [in] mode Mode to open the file with
+   * \param [in] callback Callback. Takes the opened file.
+   */
+  template<typename Cb>
+  void open(
+    const std::filesystem::path&        path,
+          IoOpenMode                    mode,
+          Cb&&                          callback) {
+    auto& item = allocItem();
+    item.type = IoRequestType::eOpen;
+    item.path = path;
+    item.mode = mode;
+    item.cb = IoCallback([
+      cb = std::move(callback)
+    ] (const IoBufferedRequest& item) {
+      return cb(item.file);
+    });
+  }
+
+  /**
+   * \brief Enqueues a file size query
+   *
+   * Queries the current size of the given file without blocking
+   * the calling thread. The same restrictions as for
+   * IoFileIface::getSize apply.
+   * \param [in] file File to query
+   * \param [in] callback Callback. Takes the file size in bytes.
+   */
+  template<typename Cb>
+  void stat(
+          IoFile                        file,
+          Cb&&                          callback) {
+    auto& item = allocItem();
+    item.type = IoRequestType::eStat;
+    item.file = std::move(file);
+    item.cb = IoCallback([
+      cb = std::move(callback)
+    ] (const IoBufferedRequest& item) {
+      return cb(item.size);
+    });
+  }
+
+  /**
+   * \brief Queries number of buffered items
+   *
+   * Only meaningful before the request is submitted,
+   * since items are consumed during execution.
+   * \returns Number of read, stream and write items
+   */
+  uint32_t getItemCount() const {
+    return uint32_t(m_items.size());
+  }
+
+  /**
+   * \brief Computes total number of bytes to read
+   *
+   * Includes stream items. Only meaningful before
+   * the request is submitted.
+   * \returns Total read size, in bytes
+   */
+  uint64_t getReadSize() const;
+
+  /**
+   * \brief Computes total number of bytes to write
+   *
+   * Only meaningful before the request is submitted.
+   * \returns Total write size, in bytes
+   */
+  uint64_t getWriteSize() const;
+
+  /**
+   * \brief Maximum number of items per coalesced batch
+   *
+   * Limits the number of I/O vectors needed to scatter the
+   * result of a merged read, taking gaps into account.
+   */
+  constexpr static uint32_t MaxItemsPerBatch = 256;
+
 protected:
 
   std::mutex                  m_mutex;
@@ -267,6 +402,24 @@ protected:
 
   IoBufferedRequest& allocItem();
 
+  /**
+   * \brief Groups buffered items into batches
+   *
+   * Sorts read and stream items by file and offset, and merges
+   * items that are close to each other in the same file into one
+   * batch as per the given parameters. Open and stat operations are
+   * never merged. If the request contains any write operations,
+   * items will not be reordered or merged, and each item will get
+   * its own batch in submission order.
+   * \param [in] params Coalescing parameters
+   * \param [out] indices Item indices, ordered by batch
+   * \param [out] batches Item batches
+   */
+  void batchItems(
+    const IoCoalescingParameters&       params,
+          std::vector<uint32_t>&        indices,
+          std::vector<IoItemBatch>&     batches) const;
+
 };
 
 /** See IoRequestIface. */
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cmath>
+
+#include "../util/util_math.h"
+#include "../util/util_string.h"
+
+#include "io_stats.h"
+
+namespace as {
+
+std::chrono::microseconds IoStats::getLatencyPercentile(
+        double                        percentile) const {
+  uint64_t total = 0;
+
+  for (uint64_t count : latencyHistogram)
+    total += count;
+
+  if (!total)
+    return std::chrono::microseconds(0);
+
+  // Find the first bucket at which the accumulated
+  // request count reaches the requested percentile
+  uint64_t threshold = uint64_t(std::ceil(double(total) * std::clamp(percentile, 0.0, 1.0)));
+  threshold = std::max<uint64_t>(threshold, 1u);
+
+  uint64_t accum = 0;
+
+  for (uint32_t i = 0; i < LatencyBucketCount; i++) {
+    accum += latencyHistogram[i];
+
+    if (accum >= threshold)
+      return std::chrono::microseconds(1ull << i);
+  }
+
+  return std::chrono::microseconds(1ull << (LatencyBucketCount - 1));
+}
+
+
+std::string IoStats::toString() const {
+  auto p50 = getLatencyPercentile(0.5).count();
+  auto p99 = getLatencyPercentile(0.99).count();
+  auto p999 = getLatencyPercentile(0.999).count();
+
+  return strcat(
+    "Requests: ", requestsSubmitted, " submitted, ",
+      requestsCompleted, " completed, ", requestsFailed, " failed\n",
+    "In flight: ", requestsInFlight, " (max ", requestsInFlightMax, ")\n",
+    "Items: ", itemsSubmitted, "\n",
+    "Read: ", (bytesRead >> 10), " kiB, written: ", (bytesWritten >> 10), " kiB\n",
+    "Stream buffer allocation failures: ", streamAllocFailures, "\n",
+    "Latency: p50 < ", p50, " us, p99 < ", p99, " us, p999 < ", p999, " us");
+}
+
+
+
+
+void IoStatsCounters::recordSubmission(
+        uint64_t                      itemCount) {
+  m_requestsSubmitted.fetch_add(1, std::memory_order_relaxed);
+  m_itemsSubmitted.fetch_add(itemCount, std::memory_order_relaxed);
+
+  uint64_t inFlight = m_requestsInFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+  uint64_t inFlightMax = m_requestsInFlightMax.load(std::memory_order_relaxed);
+
+  while (inFlight > inFlightMax && !m_requestsInFlightMax.compare_exchange_weak(
+    inFlightMax, inFlight, std::memory_order_relaxed))
+    continue;
+}
+
+
+void IoStatsCounters::recordCompletion(
+        IoStatus                      status,
+        uint64_t                      bytesRead,
+        uint64_t                      bytesWritten,
+        std::chrono::nanoseconds      latency) {
+  m_requestsInFlight.fetch_sub(1, std::memory_order_relaxed);
+  m_requestsCompleted.fetch_add(1, std::memory_order_relaxed);
+
+  if (status == IoStatus::eSuccess) {
+    m_bytesRead.fetch_add(bytesRead, std::memory_order_relaxed);
+    m_bytesWritten.fetch_add(bytesWritten, std::memory_order_relaxed);
+  } else {
+    m_requestsFailed.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Bucket i covers the range [2^(i-1), 2^i) microseconds
+  uint64_t us = uint64_t(std::max<int64_t>(latency.count(), 0)) / 1000u;
+  uint32_t bucket = us ? uint32_t(findmsb(us) + 1) : 0u;
+  bucket = std::min(bucket, IoStats::LatencyBucketCount - 1);
+
+  m_latencyHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+
+IoStats IoStatsCounters::getStats() const {
+  IoStats result;
+  result.requestsSubmitted = m_requestsSubmitted.load(std::memory_order_relaxed);
+  result.requestsCompleted = m_requestsCompleted.load(std::memory_order_relaxed);
+  result.requestsFailed = m_requestsFailed.load(std::memory_order_relaxed);
+  result.requestsInFlight = m_requestsInFlight.load(std::memory_order_relaxed);
+  result.requestsInFlightMax = m_requestsInFlightMax.load(std::memory_order_relaxed);
+  result.itemsSubmitted = m_itemsSubmitted.load(std::memory_order_relaxed);
+  result.bytesRead = m_bytesRead.load(std::memory_order_relaxed);
+  result.bytesWritten = m_bytesWritten.load(std::memory_order_relaxed);
+  result.streamAllocFailures = m_streamAllocFailures.load(std::memory_order_relaxed);
+
+  for (uint32_t i = 0; i < IoStats::LatencyBucketCount; i++)
+    result.latencyHistogram[i] = m_latencyHistogram[i].load(std::memory_order_relaxed);
+
+  return result;
+}
+
+}
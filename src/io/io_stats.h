@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "io_file.h"
+
+namespace as {
+
+/**
+ * \brief I/O statistics
+ *
+ * Snapshot of the counters maintained by an I/O backend. All
+ * counters are accumulated since the backend was created, so
+ * applications can compute rates by comparing two snapshots.
+ */
+struct IoStats {
+  /** Number of latency histogram buckets. Bucket \c i counts
+   *  requests that completed in less than 2^i microseconds,
+   *  but not faster than the previous bucket. The last bucket
+   *  counts all requests that took longer than that. */
+  constexpr static uint32_t LatencyBucketCount = 32;
+
+  /** Number of successfully submitted requests */
+  uint64_t requestsSubmitted = 0;
+  /** Number of completed requests, including failed ones */
+  uint64_t requestsCompleted = 0;
+  /** Number of requests that completed with an error */
+  uint64_t requestsFailed = 0;
+  /** Number of requests currently in flight */
+  uint64_t requestsInFlight = 0;
+  /** Highest number of requests in flight at any time */
+  uint64_t requestsInFlightMax = 0;
+  /** Number of read, stream and write items submitted */
+  uint64_t itemsSubmitted = 0;
+  /** Number of bytes read by successful requests */
+  uint64_t bytesRead = 0;
+  /** Number of bytes written by successful requests */
+  uint64_t bytesWritten = 0;
+  /** Number of stream operations that could not be served from
+   *  the backend's stream buffer and needed a separate allocation */
+  uint64_t streamAllocFailures = 0;
+  /** Request latency histogram, measured from submission until
+   *  completion of the request, including item callbacks. */
+  std::array<uint64_t, LatencyBucketCount> latencyHistogram = { };
+
+  /**
+   * \brief Estimates a latency percentile
+   *
+   * \param [in] percentile Percentile, between 0 and 1
+   * \returns Upper bound of the histogram bucket that contains
+   *    the given percentile, or zero if no request completed.
+   */
+  std::chrono::microseconds getLatencyPercentile(
+          double                        percentile) const;
+
+  /**
+   * \brief Formats statistics as human-readable text
+   * \returns Multi-line summary of the statistics
+   */
+  std::string toString() const;
+
+};
+
+
+/**
+ * \brief I/O statistics counters
+ *
+ * Thread-safe set of counters that backends update as requests
+ * get submitted and retired. All updates use relaxed atomics,
+ * so snapshots may be slightly inconsistent.
+ */
+class IoStatsCounters {
+
+public:
+
+  /**
+   * \brief Records request submission
+   *
+   * \param [in] itemCount Number of items in the request
+   */
+  void recordSubmission(
+          uint64_t                      itemCount);
+
+  /**
+   * \brief Records request completion
+   *
+   * \param [in] status Final request status
+   * \param [in] bytesRead Number of bytes read
+   * \param [in] bytesWritten Number of bytes written
+   * \param [in] latency Time from submission to completion
+   */
+  void recordCompletion(
+          IoStatus                      status,
+          uint64_t                      bytesRead,
+          uint64_t                      bytesWritten,
+          std::chrono::nanoseconds      latency);
+
+  /**
+   * \brief Records a stream buffer allocation failure
+   */
+  void recordStreamAllocFailure() {
+    m_streamAllocFailures.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * \brief Retrieves a snapshot of all counters
+   * \returns Current statistics
+   */
+  IoStats getStats() const;
+
+private:
+
+  std::atomic<uint64_t> m_requestsSubmitted   = { 0ull };
+  std::atomic<uint64_t> m_requestsCompleted   = { 0ull };
+  std::atomic<uint64_t> m_requestsFailed      = { 0ull };
+  std::atomic<uint64_t> m_requestsInFlight    = { 0ull };
+  std::atomic<uint64_t> m_requestsInFlightMax = { 0ull };
+  std::atomic<uint64_t> m_itemsSubmitted      = { 0ull };
+  std::atomic<uint64_t> m_bytesRead           = { 0ull };
+  std::atomic<uint64_t> m_bytesWritten        = { 0ull };
+  std::atomic<uint64_t> m_streamAllocFailures = { 0ull };
+
+  std::array<std::atomic<uint64_t>, IoStats::LatencyBucketCount> m_latencyHistogram = { };
+
+};
+
+}
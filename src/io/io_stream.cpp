@@ -1,3 +1,5 @@
+#include "../util/util_log.h"
+
 #include "io_stream.h"
 
 namespace as {
@@ -65,4 +67,115 @@ std::pair<size_t, size_t> WrFileStream::writeToContainer(
   return std::make_pair(size, size_t(-1));
 }
 
+
+
+
+WrAsyncFileStream::WrAsyncFileStream() {
+
+}
+
+
+WrAsyncFileStream::WrAsyncFileStream(
+        Io                            io,
+        IoFile                        file,
+  const WrAsyncFileStreamDesc&        desc)
+: m_io          (std::move(io))
+, m_file        (std::move(file))
+, m_durability  (desc.durability) {
+  if (!m_file)
+    return;
+
+  m_fileOffset = m_file->getSize();
+
+  for (auto& buffer : m_buffers)
+    buffer.resize(std::max<size_t>(desc.bufferSize, 1));
+
+  if (desc.allocationSize > m_fileOffset)
+    m_file->allocate(desc.allocationSize);
+}
+
+
+WrAsyncFileStream::~WrAsyncFileStream() {
+  if (m_file && !flush())
+    Log::err("WrAsyncFileStream: Failed to flush file on destruction");
+}
+
+
+bool WrAsyncFileStream::flush() {
+  if (!m_file)
+    return false;
+
+  // Make sure to wait for all pending writes
+  // even if any part of this fails
+  bool success = WrBufferedStream::flush();
+  success &= submitBuffer();
+
+  for (uint32_t i = 0; i < m_buffers.size(); i++)
+    success &= waitForBuffer(i);
+
+  if (success && m_durability == IoDurability::eSync)
+    success = m_file->sync() == IoStatus::eSuccess;
+
+  return success && !m_error;
+}
+
+
+std::pair<size_t, size_t> WrAsyncFileStream::writeToContainer(
+  const void*                         data,
+        size_t                        size) {
+  auto src = reinterpret_cast<const char*>(data);
+  size_t written = 0;
+
+  while (written < size) {
+    auto& buffer = m_buffers[m_bufferIndex];
+
+    size_t chunkSize = std::min(size - written, buffer.size() - m_bufferFill);
+    std::memcpy(&buffer[m_bufferFill], &src[written], chunkSize);
+
+    m_bufferFill += chunkSize;
+    written += chunkSize;
+
+    if (m_bufferFill == buffer.size() && !submitBuffer())
+      return std::make_pair(size_t(0), size_t(0));
+  }
+
+  return std::make_pair(size, size_t(-1));
+}
+
+
+bool WrAsyncFileStream::submitBuffer() {
+  if (!m_bufferFill)
+    return !m_error;
+
+  IoRequest request = m_io->createRequest();
+  request->write(m_file, m_fileOffset, m_bufferFill, m_buffers[m_bufferIndex].data());
+
+  if (!m_io->submit(request)) {
+    m_error = true;
+    return false;
+  }
+
+  m_requests[m_bufferIndex] = std::move(request);
+  m_fileOffset += m_bufferFill;
+  m_bufferFill = 0;
+
+  // Switch to the other buffer, and wait for any previous
+  // write from that buffer so that we can safely reuse it
+  m_bufferIndex ^= 1;
+  return waitForBuffer(m_bufferIndex);
+}
+
+
+bool WrAsyncFileStream::waitForBuffer(
+        uint32_t                      index) {
+  if (m_requests[index]) {
+    if (m_requests[index]->wait() != IoStatus::eSuccess)
+      m_error = true;
+
+    m_requests[index] = nullptr;
+  }
+
+  return !m_error;
+}
+
 }
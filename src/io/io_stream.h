@@ -1,7 +1,11 @@
 #pragma once
 
+#include <array>
+#include <vector>
+
 #include "../util/util_stream.h"
 
+#include "io.h"
 #include "io_file.h"
 
 namespace as {
@@ -120,4 +124,122 @@ protected:
 
 };
 
+
+/**
+ * \brief Durability mode for file streams
+ */
+enum class IoDurability : uint32_t {
+  /** Data is handed off to the operating system on flush,
+   *  but may not have reached storage yet. */
+  eNone   = 0,
+  /** Flushing the stream blocks until all data written
+   *  so far has been committed to storage. */
+  eSync   = 1,
+};
+
+
+/**
+ * \brief Asynchronous output file stream parameters
+ */
+struct WrAsyncFileStreamDesc {
+  /** Size of each of the two staging buffers. Larger buffers
+   *  mean fewer and larger write requests. */
+  size_t bufferSize = 4u << 20;
+  /** Expected final file size, if known. If non-zero, storage
+   *  for the file will be reserved up front. */
+  uint64_t allocationSize = 0;
+  /** Durability mode */
+  IoDurability durability = IoDurability::eNone;
+};
+
+
+/**
+ * \brief Asynchronous output file stream
+ *
+ * Write-behind stream that accumulates data in one large buffer
+ * and submits it as an asynchronous write request once full,
+ * while the next buffer is being filled. This way, producing data
+ * and writing it to disk can overlap, and the file only sees large
+ * sequential writes.
+ */
+class WrAsyncFileStream : public WrBufferedStream {
+
+public:
+
+  WrAsyncFileStream();
+
+  /**
+   * \brief Initializes file writer
+   *
+   * Any write operations to this stream
+   * will append data to the file.
+   * \param [in] io I/O instance to submit writes to
+   * \param [in] file File to write to
+   * \param [in] desc Stream parameters
+   */
+  WrAsyncFileStream(
+          Io                            io,
+          IoFile                        file,
+    const WrAsyncFileStreamDesc&        desc);
+
+  ~WrAsyncFileStream();
+
+  /**
+   * \brief Queries file size
+   *
+   * Includes data that has not yet been written.
+   * \returns File size, in bytes
+   */
+  uint64_t getSize() {
+    WrBufferedStream::flush();
+    return m_fileOffset + m_bufferFill;
+  }
+
+  /**
+   * \brief Flushes all buffered data
+   *
+   * Submits any buffered data and waits for all pending
+   * writes to complete. If the stream was created with
+   * IoDurability::eSync, this will also wait for the
+   * data to be committed to storage.
+   * \returns \c true on success, or \c false if any
+   *    write operation failed.
+   */
+  bool flush() override;
+
+  /**
+   * \brief Checks whether the file is valid
+   * \returns \c true if the file is valid
+   */
+  operator bool () const {
+    return bool(m_file);
+  }
+
+private:
+
+  Io            m_io;
+  IoFile        m_file;
+  IoDurability  m_durability = IoDurability::eNone;
+
+  std::array<std::vector<char>, 2> m_buffers;
+  std::array<IoRequest, 2>         m_requests;
+
+  uint32_t      m_bufferIndex   = 0;
+  uint64_t      m_fileOffset    = 0;
+  size_t        m_bufferFill    = 0;
+  bool          m_error         = false;
+
+  bool submitBuffer();
+
+  bool waitForBuffer(
+          uint32_t                      index);
+
+protected:
+
+  std::pair<size_t, size_t> writeToContainer(
+    const void*                         data,
+          size_t                        size) override;
+
+};
+
 }
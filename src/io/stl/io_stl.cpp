@@ -31,6 +31,47 @@ IoBackend IoStl::getBackendType() const {
 
 
 IoFile IoStl::open(
+  const std::filesystem::path&        path,
+        IoOpenMode                    mode) {
+  return openFile(path, mode);
+}
+
+
+IoRequest IoStl::createRequest() {
+  return IoRequest(std::make_shared<IoStlRequest>());
+}
+
+
+bool IoStl::submit(
+  const IoRequest&                    request) {
+  std::unique_lock lock(m_mutex);
+
+  if (!request || request->getStatus() != IoStatus::eReset)
+    return false;
+
+  static_cast<IoStlRequest&>(*request).setPending();
+  trackRequest(*request);
+
+  m_queue.push(request);
+  m_cond.notify_one();
+  return true;
+}
+
+
+bool IoStl::registerBuffer(
+        void*                         data,
+        size_t                        size) {
+  return false;
+}
+
+
+void IoStl::unregisterBuffer(
+        void*                         data) {
+
+}
+
+
+IoFile IoStl::openFile(
   const std::filesystem::path&        path,
         IoOpenMode                    mode) {
   if (mode == IoOpenMode::eRead || mode == IoOpenMode::eWrite || mode == IoOpenMode::eCreateOrFail) {
@@ -60,26 +101,6 @@ IoFile IoStl::open(
 }
 
 
-IoRequest IoStl::createRequest() {
-  return IoRequest(std::make_shared<IoStlRequest>());
-}
-
-
-bool IoStl::submit(
-  const IoRequest&                    request) {
-  std::unique_lock lock(m_mutex);
-
-  if (!request || request->getStatus() != IoStatus::eReset)
-    return false;
-
-  static_cast<IoStlRequest&>(*request).setPending();
-
-  m_queue.push(request);
-  m_cond.notify_one();
-  return true;
-}
-
-
 void IoStl::run() {
   while (true) {
     std::unique_lock lock(m_mutex);
@@ -97,7 +118,7 @@ void IoStl::run() {
     lock.unlock();
 
     auto& stlRequest = static_cast<IoStlRequest&>(*request);
-    stlRequest.execute();
+    stlRequest.execute(getCoalescingParameters());
   }
 }
 
@@ -58,6 +58,38 @@ public:
   bool submit(
     const IoRequest&                    request) override;
 
+  /**
+   * \brief Registers a memory region for I/O
+   *
+   * Not supported by this backend.
+   * \param [in] data Pointer to the start of the region
+   * \param [in] size Size of the region, in bytes
+   * \returns Always \c false
+   */
+  bool registerBuffer(
+          void*                         data,
+          size_t                        size) override;
+
+  /**
+   * \brief Unregisters a memory region
+   * \param [in] data Pointer to the start of the region
+   */
+  void unregisterBuffer(
+          void*                         data) override;
+
+  /**
+   * \brief Opens a file synchronously
+   *
+   * Used to implement both synchronous and
+   * asynchronous open operations.
+   * \param [in] path File path
+   * \param [in] mode Mode to open the file with
+   * \returns File object on success, or \c nullptr on error.
+   */
+  static IoFile openFile(
+    const std::filesystem::path&        path,
+          IoOpenMode                    mode);
+
 private:
 
   std::mutex              m_mutex;
@@ -84,6 +84,26 @@ IoStatus IoStlFile::write(
 }
 
 
+IoStatus IoStlFile::allocate(
+        uint64_t                      size) {
+  // Not supported by the STL, treat as no-op
+  return m_mode == IoMode::eWrite ? IoStatus::eSuccess : IoStatus::eError;
+}
+
+
+IoStatus IoStlFile::sync() {
+  if (m_mode != IoMode::eWrite)
+    return IoStatus::eError;
+
+  // This only flushes the stream to the OS, there is
+  // no portable way to wait for data to hit the disk
+  if (!m_ostream.flush())
+    return IoStatus::eError;
+
+  return IoStatus::eSuccess;
+}
+
+
 uint64_t IoStlFile::computeFileSize() const {
   return std::filesystem::file_size(m_path);
 }
@@ -1,3 +1,6 @@
+#include <cstring>
+
+#include "io_stl.h"
 #include "io_stl_file.h"
 #include "io_stl_request.h"
 
@@ -13,39 +16,21 @@ IoStlRequest::~IoStlRequest() {
 }
 
 
-void IoStlRequest::execute() {
+void IoStlRequest::execute(
+  const IoCoalescingParameters&       params) {
   std::vector<char> streamBuffer;
 
-  IoStatus status = IoStatus::eSuccess;
-
-  for (size_t i = 0; i < m_items.size(); i++) {
-    auto& item = m_items[i];
-    auto& file = static_cast<IoStlFile&>(*item.file);
+  std::vector<uint32_t> indices;
+  std::vector<IoItemBatch> batches;
 
-    switch (item.type) {
-      case IoRequestType::eNone:
-        status = IoStatus::eSuccess;
-        break;
+  batchItems(params, indices, batches);
 
-      case IoRequestType::eRead:
-        status = file.read(item.offset, item.size, item.dst);
-        break;
-
-      case IoRequestType::eWrite:
-        status = file.write(item.offset, item.size, item.src);
-        break;
-
-      case IoRequestType::eStream:
-        streamBuffer.resize(item.size);
-        item.dst = streamBuffer.data();
-        status = file.read(item.offset, item.size, item.dst);
-        break;
-    }
-
-    if (status == IoStatus::eSuccess && item.cb)
-      status = item.cb(item);
+  IoStatus status = IoStatus::eSuccess;
 
-    item = IoBufferedRequest();
+  for (const auto& batch : batches) {
+    status = batch.count == 1
+      ? executeItem(m_items[indices[batch.first]], streamBuffer)
+      : executeBatch(batch, &indices[batch.first], streamBuffer);
 
     if (status == IoStatus::eError)
       break;
@@ -60,4 +45,80 @@ void IoStlRequest::setPending() {
   setStatus(IoStatus::ePending);
 }
 
+
+IoStatus IoStlRequest::executeItem(
+        IoBufferedRequest&            item,
+        std::vector<char>&            streamBuffer) {
+  IoStatus status = IoStatus::eSuccess;
+
+  switch (item.type) {
+    case IoRequestType::eNone:
+      status = IoStatus::eSuccess;
+      break;
+
+    case IoRequestType::eRead:
+      status = static_cast<IoStlFile&>(*item.file).read(item.offset, item.size, item.dst);
+      break;
+
+    case IoRequestType::eWrite:
+      status = static_cast<IoStlFile&>(*item.file).write(item.offset, item.size, item.src);
+      break;
+
+    case IoRequestType::eStream:
+      streamBuffer.resize(item.size);
+      item.dst = streamBuffer.data();
+      status = static_cast<IoStlFile&>(*item.file).read(item.offset, item.size, item.dst);
+      break;
+
+    case IoRequestType::eOpen:
+      item.file = IoStl::openFile(item.path, item.mode);
+      status = item.file ? IoStatus::eSuccess : IoStatus::eError;
+      break;
+
+    case IoRequestType::eStat:
+      item.size = item.file->getSize();
+      break;
+  }
+
+  if (status == IoStatus::eSuccess && item.cb)
+    status = item.cb(item);
+
+  item = IoBufferedRequest();
+  return status;
+}
+
+
+IoStatus IoStlRequest::executeBatch(
+  const IoItemBatch&                  batch,
+  const uint32_t*                     indices,
+        std::vector<char>&            streamBuffer) {
+  auto& file = static_cast<IoStlFile&>(*m_items[indices[0]].file);
+
+  // Read the entire range in one go, including any gaps,
+  // and scatter the data to the individual items after.
+  streamBuffer.resize(batch.size);
+
+  IoStatus status = file.read(batch.offset, batch.size, streamBuffer.data());
+
+  for (uint32_t i = 0; i < batch.count; i++) {
+    auto& item = m_items[indices[i]];
+
+    if (status == IoStatus::eSuccess) {
+      char* data = &streamBuffer[item.offset - batch.offset];
+
+      if (item.type == IoRequestType::eRead)
+        std::memcpy(item.dst, data, item.size);
+      else
+        item.dst = data;
+
+      if (item.cb)
+        status = item.cb(item);
+    }
+
+    item = IoBufferedRequest();
+  }
+
+  return status;
+}
+
 }
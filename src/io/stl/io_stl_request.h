@@ -25,14 +25,27 @@ public:
    *
    * Once all requests are executed, this will notify
    * any waiting thread and invoke callbacks.
+   * \param [in] params Read coalescing parameters
    */
-  void execute();
+  void execute(
+    const IoCoalescingParameters&       params);
 
   /**
    * \brief Sets status to pending
    */
   void setPending();
 
+private:
+
+  IoStatus executeItem(
+          IoBufferedRequest&            item,
+          std::vector<char>&            streamBuffer);
+
+  IoStatus executeBatch(
+    const IoItemBatch&                  batch,
+    const uint32_t*                     indices,
+          std::vector<char>&            streamBuffer);
+
 };
 
 }
@@ -37,15 +37,37 @@ IoUring::IoUring(
   m_streamBuffer = std::calloc(1, streamBufferSize);
   m_streamAllocator = ChunkAllocator(uint32_t(streamBufferSize));
 
+  // Gaps between coalesced reads are read into this buffer and
+  // discarded. The contents are never used, so all vector reads
+  // can share the same buffer.
+  m_discardBuffer.resize(DiscardBufferSize);
+
+  // Try to allocate a sparse buffer table so that applications can
+  // register additional buffers later. If this is not supported,
+  // fall back to registering only the stream buffer.
+  m_useSparse = !io_uring_register_buffers_sparse(&m_ring, MaxFixedBuffers);
+
+  if (!m_useSparse)
+    Log::warn("IoUring: io_uring_register_buffers_sparse() failed, cannot register app buffers");
+
   // Even if registering the fixed buffer fails, we should keep
   // the fixed buffer around to avoid frequent allocations when
   // performing stream operations.
   if (m_useFixed) {
-    ::iovec streamBufferDesc;
-    streamBufferDesc.iov_base = m_streamBuffer;
-    streamBufferDesc.iov_len = streamBufferSize;
+    if (m_useSparse) {
+      m_useFixed = updateFixedBuffer(0, m_streamBuffer, streamBufferSize);
+    } else {
+      ::iovec streamBufferDesc;
+      streamBufferDesc.iov_base = m_streamBuffer;
+      streamBufferDesc.iov_len = streamBufferSize;
 
-    m_useFixed = !io_uring_register_buffers(&m_ring, &streamBufferDesc, 1);
+      m_useFixed = !io_uring_register_buffers(&m_ring, &streamBufferDesc, 1);
+
+      if (m_useFixed) {
+        m_fixedBuffers[0].data = static_cast<char*>(m_streamBuffer);
+        m_fixedBuffers[0].size = streamBufferSize;
+      }
+    }
 
     if (m_useFixed)
       Log::info("IoUring: Using fixed ", (streamBufferSize >> 20), " MiB stream buffer");
@@ -111,32 +133,8 @@ IoBackend IoUring::getBackendType() const {
 IoFile IoUring::open(
   const std::filesystem::path&        path,
         IoOpenMode                    mode) {
-  int openFlags = 0;
-
-  switch (mode) {
-    case IoOpenMode::eRead:
-      openFlags = O_RDONLY;
-      break;
-
-    case IoOpenMode::eWrite:
-      openFlags = O_WRONLY;
-      break;
-
-    case IoOpenMode::eWriteOrCreate:
-      openFlags = O_WRONLY | O_CREAT;
-      break;
-
-    case IoOpenMode::eCreate:
-      openFlags = O_WRONLY | O_CREAT | O_TRUNC;
-      break;
-
-    case IoOpenMode::eCreateOrFail:
-      openFlags = O_WRONLY | O_CREAT | O_EXCL;
-      break;
-  }
-
   mode_t openMode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-  int fd = ::open(path.c_str(), openFlags, openMode);
+  int fd = ::open(path.c_str(), getOpenFlags(mode), openMode);
 
   if (fd < 0)
     return IoFile();
@@ -160,64 +158,18 @@ bool IoUring::submit(
 
   auto& uringRequest = static_cast<IoUringRequest&>(*request);
   uringRequest.setPending();
+  trackRequest(uringRequest);
 
-  bool result = uringRequest.processRequests(
-    [this, request] (uint32_t index, IoBufferedRequest& item) {
-      if (item.type == IoRequestType::eNone)
-        return true;
-
-      auto& file = static_cast<IoUringFile&>(*item.file);
-      auto workItem = allocWorkItem();
-
-      workItem->request = request;
-      workItem->requestIndex = index;
-      workItem->index = file.getIndex();
-      workItem->fd = file.getFd();
-      workItem->offset = item.offset;
-      workItem->size = item.size;
-
-      switch (item.type) {
-        case IoRequestType::eRead:
-          workItem->type = IoUringWorkItemType::eRead;
-          workItem->dst = static_cast<char*>(item.dst);
-          break;
-
-        case IoRequestType::eWrite:
-          workItem->type = IoUringWorkItemType::eWrite;
-          workItem->src = static_cast<const char*>(item.src);
-          break;
-
-        case IoRequestType::eStream:
-          workItem->type = IoUringWorkItemType::eStream;
-
-          // Try to allocate memory from the fixed buffer,
-          // otherwise allocate a new memory block.
-          if (workItem->size <= m_streamAllocator.capacity()) {
-            uint32_t alignment = 4096;
-            uint32_t size = align(uint32_t(workItem->size), alignment);
-
-            auto offset = m_streamAllocator.alloc(size, alignment);
-
-            if (offset) {
-              workItem->flags |= IoUringWorkItemFlag::eStreamBuffer;
-              workItem->bufferRange.offset = *offset;
-              workItem->bufferRange.size = size;
-              workItem->dst = static_cast<char*>(m_streamBuffer) + workItem->bufferRange.offset;
-            }
-          }
-
-          if (!workItem->dst) {
-            workItem->flags |= IoUringWorkItemFlag::eStreamAlloc;
-            workItem->bufferAlloc = static_cast<char*>(std::calloc(1, workItem->size));
-            workItem->dst = workItem->bufferAlloc;
-          }
-
-          item.dst = workItem->dst;
-          break;
-
-        default:
-          throw Error("IoUring: Unsupported request type");
-      }
+  // Gaps are read into the discard buffer, so they
+  // must not be larger than that buffer
+  IoCoalescingParameters params = getCoalescingParameters();
+  params.maxGap = std::min<uint64_t>(params.maxGap, DiscardBufferSize);
+
+  bool result = uringRequest.processRequests(params,
+    [this, &request, &uringRequest] (const IoItemBatch& batch, const uint32_t* indices) {
+      IoUringWorkItem* workItem = batch.count == 1
+        ? createWorkItem(request, indices[0], uringRequest.getItem(indices[0]))
+        : createVectorWorkItem(request, batch, indices);
 
       return enqueue(workItem);
     });
@@ -226,6 +178,42 @@ bool IoUring::submit(
 }
 
 
+bool IoUring::registerBuffer(
+        void*                         data,
+        size_t                        size) {
+  std::unique_lock lock(m_mutex);
+
+  if (!m_useSparse || !data || !size)
+    return false;
+
+  // Slot 0 is reserved for the stream buffer
+  for (uint32_t i = 1; i < MaxFixedBuffers; i++) {
+    if (!m_fixedBuffers[i].data) {
+      if (!updateFixedBuffer(i, data, size)) {
+        Log::warn("IoUring: Failed to register ", (size >> 10), " kiB buffer");
+        return false;
+      }
+
+      return true;
+    }
+  }
+
+  Log::warn("IoUring: Fixed buffer table full");
+  return false;
+}
+
+
+void IoUring::unregisterBuffer(
+        void*                         data) {
+  std::unique_lock lock(m_mutex);
+
+  for (uint32_t i = 1; i < MaxFixedBuffers; i++) {
+    if (data && m_fixedBuffers[i].data == data)
+      updateFixedBuffer(i, nullptr, 0);
+  }
+}
+
+
 int IoUring::registerFile(
         int                           fd) {
   if (!m_useFdTable)
@@ -278,6 +266,41 @@ void IoUring::unregisterFile(
 }
 
 
+bool IoUring::updateFixedBuffer(
+        uint32_t                      index,
+        void*                         data,
+        size_t                        size) {
+  // An empty I/O vector removes the buffer from the table
+  ::iovec desc;
+  desc.iov_base = data;
+  desc.iov_len = size;
+
+  if (io_uring_register_buffers_update_tag(&m_ring, index, &desc, nullptr, 1) != 1)
+    return false;
+
+  m_fixedBuffers[index].data = static_cast<char*>(data);
+  m_fixedBuffers[index].size = size;
+  return true;
+}
+
+
+int IoUring::findFixedBuffer(
+  const void*                         data,
+        uint64_t                      size) const {
+  auto ptr = reinterpret_cast<const char*>(data);
+
+  for (uint32_t i = 0; i < MaxFixedBuffers; i++) {
+    const auto& buffer = m_fixedBuffers[i];
+
+    if (buffer.data && ptr >= buffer.data
+     && ptr + size <= buffer.data + buffer.size)
+      return int(i);
+  }
+
+  return -1;
+}
+
+
 bool IoUring::enqueue(
       IoUringWorkItem*              item) {
   io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
@@ -296,25 +319,47 @@ bool IoUring::enqueue(
   // index if possible.
   int fd = item->index < 0 ? item->fd : item->index;
 
+  // Use fixed buffer operations if the memory region
+  // involved is part of a registered buffer
+  int bufferIndex = -1;
+
   switch (item->type) {
     case IoUringWorkItemType::eRead:
-      io_uring_prep_read(sqe, fd, item->dst, size, item->offset);
+    case IoUringWorkItemType::eStream:
+      bufferIndex = findFixedBuffer(item->dst, size);
+
+      if (bufferIndex >= 0)
+        io_uring_prep_read_fixed(sqe, fd, item->dst, size, item->offset, bufferIndex);
+      else
+        io_uring_prep_read(sqe, fd, item->dst, size, item->offset);
       break;
 
     case IoUringWorkItemType::eWrite:
-      io_uring_prep_write(sqe, fd, item->src, size, item->offset);
-      break;
+      bufferIndex = findFixedBuffer(item->src, size);
 
-    case IoUringWorkItemType::eStream:
-      if ((item->flags & IoUringWorkItemFlag::eStreamBuffer) && m_useFixed)
-        io_uring_prep_read_fixed(sqe, fd, item->dst, size, item->offset, 0);
+      if (bufferIndex >= 0)
+        io_uring_prep_write_fixed(sqe, fd, item->src, size, item->offset, bufferIndex);
       else
-        io_uring_prep_read(sqe, fd, item->dst, size, item->offset);
+        io_uring_prep_write(sqe, fd, item->src, size, item->offset);
+      break;
+
+    case IoUringWorkItemType::eReadVector:
+      io_uring_prep_readv(sqe, fd, &item->iovs[item->iovIndex],
+        item->iovs.size() - item->iovIndex, item->offset);
       break;
 
     case IoUringWorkItemType::eRegister:
       io_uring_prep_files_update(sqe, &m_fdTable[item->index], item->fd, item->index);
       break;
+
+    case IoUringWorkItemType::eOpen:
+      io_uring_prep_openat(sqe, AT_FDCWD, item->path, getOpenFlags(item->openMode),
+        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+      break;
+
+    case IoUringWorkItemType::eStat:
+      io_uring_prep_statx(sqe, item->fd, "", AT_EMPTY_PATH, STATX_SIZE, &item->statx);
+      break;
   }
 
   io_uring_sqe_set_data(sqe, item);
@@ -351,6 +396,180 @@ bool IoUring::submit() {
 }
 
 
+IoUringWorkItem* IoUring::createWorkItem(
+  const IoRequest&                    request,
+        uint32_t                      index,
+        IoBufferedRequest&            item) {
+  auto workItem = allocWorkItem();
+
+  workItem->request = request;
+  workItem->requestIndex = index;
+  workItem->offset = item.offset;
+  workItem->size = item.size;
+
+  if (item.file) {
+    auto& file = static_cast<IoUringFile&>(*item.file);
+    workItem->index = file.getIndex();
+    workItem->fd = file.getFd();
+  }
+
+  switch (item.type) {
+    case IoRequestType::eRead:
+      workItem->type = IoUringWorkItemType::eRead;
+      workItem->dst = static_cast<char*>(item.dst);
+      break;
+
+    case IoRequestType::eWrite:
+      workItem->type = IoUringWorkItemType::eWrite;
+      workItem->src = static_cast<const char*>(item.src);
+      break;
+
+    case IoRequestType::eStream:
+      workItem->type = IoUringWorkItemType::eStream;
+
+      // Try to allocate memory from the fixed buffer,
+      // otherwise allocate a new memory block.
+      if (workItem->size <= m_streamAllocator.capacity()) {
+        uint32_t alignment = 4096;
+        uint32_t size = align(uint32_t(workItem->size), alignment);
+
+        auto offset = m_streamAllocator.alloc(size, alignment);
+
+        if (offset) {
+          workItem->flags |= IoUringWorkItemFlag::eStreamBuffer;
+          workItem->bufferRange.offset = *offset;
+          workItem->bufferRange.size = size;
+          workItem->dst = static_cast<char*>(m_streamBuffer) + workItem->bufferRange.offset;
+        }
+      }
+
+      if (!workItem->dst) {
+        m_stats.recordStreamAllocFailure();
+
+        workItem->flags |= IoUringWorkItemFlag::eStreamAlloc;
+        workItem->bufferAlloc = static_cast<char*>(std::calloc(1, workItem->size));
+        workItem->dst = workItem->bufferAlloc;
+      }
+
+      item.dst = workItem->dst;
+      break;
+
+    case IoRequestType::eOpen:
+      workItem->type = IoUringWorkItemType::eOpen;
+      workItem->index = -1;
+      workItem->fd = -1;
+      workItem->path = item.path.c_str();
+      workItem->openMode = item.mode;
+      break;
+
+    case IoRequestType::eStat:
+      // Registered file descriptors cannot be used with statx
+      workItem->type = IoUringWorkItemType::eStat;
+      workItem->index = -1;
+      break;
+
+    default:
+      throw Error("IoUring: Unsupported request type");
+  }
+
+  return workItem;
+}
+
+
+IoUringWorkItem* IoUring::createVectorWorkItem(
+  const IoRequest&                    request,
+  const IoItemBatch&                  batch,
+  const uint32_t*                     indices) {
+  auto& uringRequest = static_cast<IoUringRequest&>(*request);
+  auto workItem = allocWorkItem();
+
+  workItem->type = IoUringWorkItemType::eReadVector;
+  workItem->request = request;
+  workItem->offset = batch.offset;
+  workItem->size = batch.size;
+
+  workItem->iovs.reserve(2 * batch.count - 1);
+  workItem->children.reserve(batch.count);
+
+  // Create regular work items for all sub-requests, so that stream
+  // buffers get allocated as usual, and scatter the vector read to
+  // their destinations. Gaps are directed to the discard buffer.
+  uint64_t offset = batch.offset;
+
+  for (uint32_t i = 0; i < batch.count; i++) {
+    auto child = createWorkItem(request, indices[i], uringRequest.getItem(indices[i]));
+
+    if (child->offset > offset) {
+      auto& gap = workItem->iovs.emplace_back();
+      gap.iov_base = m_discardBuffer.data();
+      gap.iov_len = child->offset - offset;
+    }
+
+    auto& iov = workItem->iovs.emplace_back();
+    iov.iov_base = child->dst;
+    iov.iov_len = child->size;
+
+    offset = child->offset + child->size;
+    workItem->children.push_back(child);
+  }
+
+  workItem->index = workItem->children.front()->index;
+  workItem->fd = workItem->children.front()->fd;
+  return workItem;
+}
+
+
+bool IoUring::completeWorkItem(
+        IoUringWorkItem*              item) {
+  auto& request = static_cast<IoUringRequest&>(*item->request);
+
+  if (request.hasCallback(item->requestIndex)) {
+    // Forward sub-request to one of the workers to process the
+    // callback there. We don't want callbacks to stall I/O.
+    std::unique_lock callbackLock(m_callbackMutex);
+    m_callbackQueue.push(item);
+    m_callbackCond.notify_one();
+    return true;
+  } else {
+    // If no callback is present, notify sub-request
+    // immediately in order to to avoid overhead
+    request.notify(item->requestIndex, IoStatus::eSuccess);
+    return false;
+  }
+}
+
+
+void IoUring::completeMetadataWorkItem(
+        IoUringWorkItem*              item,
+        int                           result) {
+  auto& request = static_cast<IoUringRequest&>(*item->request);
+  auto& requestItem = request.getItem(item->requestIndex);
+
+  if (item->type == IoUringWorkItemType::eOpen) {
+    // Wrap the new file descriptor in a file object. This may
+    // enqueue a registration, which needs the global I/O lock.
+    IoMode fileMode = item->openMode == IoOpenMode::eRead ? IoMode::eRead : IoMode::eWrite;
+
+    requestItem.file = IoFile(std::make_shared<IoUringFile>(shared_from_this(),
+      requestItem.path, fileMode, result, registerFile(result)));
+  } else {
+    requestItem.size = item->statx.stx_size;
+  }
+}
+
+
+void IoUring::failWorkItem(
+        IoUringWorkItem*              item) {
+  if (item->type == IoUringWorkItemType::eReadVector) {
+    for (auto child : item->children)
+      failWorkItem(child);
+  } else {
+    auto& request = static_cast<IoUringRequest&>(*item->request);
+    request.notify(item->requestIndex, IoStatus::eError);
+  }
+}
+
+
 IoUringWorkItem* IoUring::allocWorkItem() {
   IoUringWorkItem* item;
 
@@ -371,6 +590,15 @@ void IoUring::freeWorkItem(
         IoUringWorkItem*              item) {
   m_workItems.push_back(item);
 
+  // Free child items of vector reads that have not
+  // been forwarded to a callback worker
+  for (auto child : item->children) {
+    if (child)
+      freeWorkItem(child);
+  }
+
+  item->children.clear();
+
   // Free allocated buffer for stream requests
   if (item->flags & IoUringWorkItemFlag::eStreamAlloc)
     std::free(item->bufferAlloc);
@@ -413,10 +641,21 @@ void IoUring::consume() {
     if (item->type == IoUringWorkItemType::eRegister) {
       if (res < 0)
         Log::err("IoUring: Updating registered files failed");
+    } else if (item->type == IoUringWorkItemType::eOpen
+            || item->type == IoUringWorkItemType::eStat) {
+      // Metadata operations complete in one go and return
+      // zero or a file descriptor on success
+      if (res < 0) {
+        failWorkItem(item);
+      } else {
+        completeMetadataWorkItem(item, res);
+
+        if (completeWorkItem(item))
+          item = nullptr;
+      }
     } else if (res <= 0) {
       // On error, notify the request and destroy the work item
-      auto& request = static_cast<IoUringRequest&>(*item->request);
-      request.notify(item->requestIndex, IoStatus::eError);
+      failWorkItem(item);
     } else if (uint64_t(res) < item->size) {
       // If only a portion of the request has completed
       // so far, adjust the parameters and re-queue it
@@ -424,27 +663,37 @@ void IoUring::consume() {
       item->offset += size;
       item->size -= res;
 
-      if (item->dst) item->dst += size;
-      if (item->src) item->src += size;
+      if (item->type == IoUringWorkItemType::eReadVector) {
+        // Skip I/O vectors that have been fully consumed, and
+        // adjust the first one that has been partially read.
+        while (size) {
+          auto& iov = item->iovs[item->iovIndex];
+          size_t consumed = std::min<uint64_t>(size, iov.iov_len);
+
+          iov.iov_base = reinterpret_cast<char*>(iov.iov_base) + consumed;
+          iov.iov_len -= consumed;
+          size -= consumed;
+
+          if (!iov.iov_len)
+            item->iovIndex += 1;
+        }
+      } else {
+        if (item->dst) item->dst += size;
+        if (item->src) item->src += size;
+      }
 
       requeue = true;
+    } else if (item->type == IoUringWorkItemType::eReadVector) {
+      // Complete all sub-requests individually. Children that were
+      // forwarded to a callback worker will be freed by the worker.
+      for (auto& child : item->children) {
+        if (completeWorkItem(child))
+          child = nullptr;
+      }
     } else {
       // Otherwise, the entrie request has completed
-      auto& request = static_cast<IoUringRequest&>(*item->request);
-
-      if (request.hasCallback(item->requestIndex)) {
-        // Forward sub-request to one of the workers to process the
-        // callback there. We don't want callbacks to stall I/O.
-        std::unique_lock callbackLock(m_callbackMutex);
-        m_callbackQueue.push(item);
-        m_callbackCond.notify_one();
-
+      if (completeWorkItem(item))
         item = nullptr;
-      } else {
-        // If no callback is present, notify sub-request
-        // immediately in order to to avoid overhead
-        request.notify(item->requestIndex, IoStatus::eSuccess);
-      }
     }
 
     lock.lock();
@@ -455,8 +704,7 @@ void IoUring::consume() {
         // Requeue item. If this goes wrong for whatever
         // reason, mark the request as failed.
         if (!enqueue(item)) {
-          auto& request = static_cast<IoUringRequest&>(*item->request);
-          request.notify(item->requestIndex, IoStatus::eError);
+          failWorkItem(item);
           freeWorkItem(item);
         }
       } else {
@@ -501,4 +749,27 @@ void IoUring::notify() {
   }
 }
 
+
+int IoUring::getOpenFlags(
+        IoOpenMode                    mode) {
+  switch (mode) {
+    case IoOpenMode::eRead:
+      return O_RDONLY;
+
+    case IoOpenMode::eWrite:
+      return O_WRONLY;
+
+    case IoOpenMode::eWriteOrCreate:
+      return O_WRONLY | O_CREAT;
+
+    case IoOpenMode::eCreate:
+      return O_WRONLY | O_CREAT | O_TRUNC;
+
+    case IoOpenMode::eCreateOrFail:
+      return O_WRONLY | O_CREAT | O_EXCL;
+  }
+
+  return 0;
+}
+
 }
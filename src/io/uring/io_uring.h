@@ -21,10 +21,13 @@ namespace as {
  * \brief Work item type
  */
 enum class IoUringWorkItemType : uint16_t {
-  eRead     = 0,
-  eWrite    = 1,
-  eStream   = 2,
-  eRegister = 3,
+  eRead       = 0,
+  eWrite      = 1,
+  eStream     = 2,
+  eRegister   = 3,
+  eReadVector = 4,
+  eOpen       = 5,
+  eStat       = 6,
 };
 
 
@@ -49,6 +52,15 @@ struct IoUringBufferInfo {
 };
 
 
+/**
+ * \brief Fixed buffer info
+ */
+struct IoUringFixedBuffer {
+  char*                 data;
+  size_t                size;
+};
+
+
 /**
  * \brief Work item
  *
@@ -74,6 +86,19 @@ struct IoUringWorkItem {
     const char*         src;
     char*               dst;
   };
+
+  /** I/O vectors and child items for coalesced reads. The
+   *  children describe the actual sub-requests, and will be
+   *  completed individually once the vector read completes. */
+  uint32_t              iovIndex;
+  std::vector<::iovec>  iovs;
+  std::vector<IoUringWorkItem*> children;
+
+  /** Path and open mode for open operations, and the
+   *  result buffer for stat operations. */
+  const char*           path;
+  IoOpenMode            openMode;
+  struct ::statx        statx;
 };
 
 
@@ -87,9 +112,12 @@ class IoUring : public IoIface
 , public std::enable_shared_from_this<IoUring> {
   constexpr static uint32_t QueueDepth = 128;
   constexpr static uint32_t MaxFds = 256;
+  constexpr static uint32_t MaxFixedBuffers = 16;
 
   constexpr static size_t MinStreamBufferSize =  8u << 20;
   constexpr static size_t MaxStreamBufferSize = 64u << 20;
+
+  constexpr static size_t DiscardBufferSize = 64u << 10;
 public:
 
   IoUring(
@@ -129,6 +157,27 @@ public:
   bool submit(
     const IoRequest&                    request) override;
 
+  /**
+   * \brief Registers a memory region for I/O
+   *
+   * Adds the region to the ring's fixed buffer table, so that
+   * reads and writes within the region can use fixed buffer
+   * operations. Requires support for sparse buffer tables.
+   * \param [in] data Pointer to the start of the region
+   * \param [in] size Size of the region, in bytes
+   * \returns \c true if the region was registered
+   */
+  bool registerBuffer(
+          void*                         data,
+          size_t                        size) override;
+
+  /**
+   * \brief Unregisters a memory region
+   * \param [in] data Pointer to the start of the region
+   */
+  void unregisterBuffer(
+          void*                         data) override;
+
   /**
    * \brief Unregisters a file
    * \param [in] index File index
@@ -147,11 +196,16 @@ private:
 
   bool                          m_useFdTable  = false;
   bool                          m_useFixed    = false;
+  bool                          m_useSparse   = false;
   bool                          m_stop        = false;
 
   void*                         m_streamBuffer = nullptr;
   ChunkAllocator<uint32_t>      m_streamAllocator;
 
+  std::vector<char>             m_discardBuffer;
+
+  std::array<IoUringFixedBuffer, MaxFixedBuffers> m_fixedBuffers = { };
+
   std::vector<IoUringWorkItem*> m_workItems;
 
   std::array<int,       MaxFds>       m_fdTable;
@@ -168,11 +222,40 @@ private:
   int registerFile(
           int                           fd);
 
+  bool updateFixedBuffer(
+          uint32_t                      index,
+          void*                         data,
+          size_t                        size);
+
+  int findFixedBuffer(
+    const void*                         data,
+          uint64_t                      size) const;
+
   bool enqueue(
           IoUringWorkItem*              item);
 
   bool submit();
 
+  IoUringWorkItem* createWorkItem(
+    const IoRequest&                    request,
+          uint32_t                      index,
+          IoBufferedRequest&            item);
+
+  IoUringWorkItem* createVectorWorkItem(
+    const IoRequest&                    request,
+    const IoItemBatch&                  batch,
+    const uint32_t*                     indices);
+
+  bool completeWorkItem(
+          IoUringWorkItem*              item);
+
+  void completeMetadataWorkItem(
+          IoUringWorkItem*              item,
+          int                           result);
+
+  void failWorkItem(
+          IoUringWorkItem*              item);
+
   IoUringWorkItem* allocWorkItem();
 
   void freeWorkItem(
@@ -185,6 +268,9 @@ private:
   static IoUringWorkItemType getRequestType(
           IoRequestType                   type);
 
+  static int getOpenFlags(
+          IoOpenMode                    mode);
+
 };
 
 }
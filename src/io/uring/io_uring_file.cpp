@@ -107,4 +107,32 @@ IoStatus IoUringFile::write(
   return IoStatus::eSuccess;
 }
 
+
+IoStatus IoUringFile::allocate(
+        uint64_t                      size) {
+  if (m_mode != IoMode::eWrite)
+    return IoStatus::eError;
+
+  // Keep the file size intact so that appending writes behave
+  // as expected. Not all file systems support fallocate, which
+  // is fine since this is merely an optimization.
+  if (::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, off_t(size))) {
+    if (errno != EOPNOTSUPP && errno != ENOSYS)
+      return IoStatus::eError;
+  }
+
+  return IoStatus::eSuccess;
+}
+
+
+IoStatus IoUringFile::sync() {
+  if (m_mode != IoMode::eWrite)
+    return IoStatus::eError;
+
+  if (::fdatasync(m_fd))
+    return IoStatus::eError;
+
+  return IoStatus::eSuccess;
+}
+
 }
\ No newline at end of file
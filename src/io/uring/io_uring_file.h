@@ -74,6 +74,21 @@ public:
           uint64_t                      size,
     const void*                         src) override;
 
+  /**
+   * \brief Reserves storage for the file
+   *
+   * \param [in] size Expected final file size, in bytes
+   * \returns Status of the operation
+   */
+  IoStatus allocate(
+          uint64_t                      size) override;
+
+  /**
+   * \brief Flushes written data to storage
+   * \returns Status of the operation
+   */
+  IoStatus sync() override;
+
 private:
 
   std::shared_ptr<IoUring> m_io;
@@ -41,16 +41,37 @@ public:
   bool hasCallback(
           uint32_t                      index);
 
+  /**
+   * \brief Retrieves buffered request
+   *
+   * \param [in] index Sub-request index
+   * \returns Reference to buffered request
+   */
+  IoBufferedRequest& getItem(
+          uint32_t                      index) {
+    return m_items[index];
+  }
+
   /**
    * \brief Processes requests
    *
-   * Iterates over all buffered requests.
-   * \param [in] proc Request callback
+   * Groups buffered requests into batches and
+   * iterates over all batches in order.
+   * \param [in] params Read coalescing parameters
+   * \param [in] proc Batch callback. Takes the batch as
+   *    well as a pointer to the batch's item indices.
    */
   template<typename Proc>
-  bool processRequests(const Proc& proc) {
-    for (uint32_t i = 0; i < m_items.size(); i++) {
-      if (!proc(i, m_items[i]))
+  bool processRequests(
+    const IoCoalescingParameters&       params,
+    const Proc&                         proc) {
+    std::vector<uint32_t> indices;
+    std::vector<IoItemBatch> batches;
+
+    batchItems(params, indices, batches);
+
+    for (const auto& batch : batches) {
+      if (!proc(batch, &indices[batch.first]))
         return false;
     }
 
@@ -1,14 +1,242 @@
+#include <array>
+#include <atomic>
+
 #include <libdeflate.h>
 
 #include "util_deflate.h"
+#include "util_gdeflate.h"
 #include "util_math.h"
 
 namespace as {
 
+/**
+ * \brief Per-thread libdeflate contexts
+ *
+ * Lazily allocates compressor and decompressor objects
+ * on first use. Objects are owned by the thread-local
+ * instance and freed when the thread exits.
+ */
+class DeflateContext {
+
+public:
+
+  DeflateContext() { }
+
+  DeflateContext             (const DeflateContext&) = delete;
+  DeflateContext& operator = (const DeflateContext&) = delete;
+
+  ~DeflateContext() {
+    for (auto* compressor : m_compressors) {
+      if (compressor)
+        libdeflate_free_compressor(compressor);
+    }
+
+    for (auto* compressor : m_gdeflateCompressors) {
+      if (compressor)
+        libdeflate_free_gdeflate_compressor(compressor);
+    }
+
+    if (m_decompressor)
+      libdeflate_free_decompressor(m_decompressor);
+
+    if (m_gdeflateDecompressor)
+      libdeflate_free_gdeflate_decompressor(m_gdeflateDecompressor);
+  }
+
+  libdeflate_compressor* getCompressor(
+          int                           level) {
+    if (level < 0 || level > DeflateMaxLevel)
+      return nullptr;
+
+    auto& compressor = m_compressors[level];
+
+    if (!compressor)
+      compressor = libdeflate_alloc_compressor(level);
+
+    return compressor;
+  }
+
+  libdeflate_gdeflate_compressor* getGDeflateCompressor(
+          int                           level) {
+    if (level < 0 || level > DeflateMaxLevel)
+      return nullptr;
+
+    auto& compressor = m_gdeflateCompressors[level];
+
+    if (!compressor)
+      compressor = libdeflate_alloc_gdeflate_compressor(level);
+
+    return compressor;
+  }
+
+  libdeflate_decompressor* getDecompressor() {
+    if (!m_decompressor)
+      m_decompressor = libdeflate_alloc_decompressor();
+
+    return m_decompressor;
+  }
+
+  libdeflate_gdeflate_decompressor* getGDeflateDecompressor() {
+    if (!m_gdeflateDecompressor)
+      m_gdeflateDecompressor = libdeflate_alloc_gdeflate_decompressor();
+
+    return m_gdeflateDecompressor;
+  }
+
+  static DeflateContext& get() {
+    thread_local DeflateContext s_context;
+    return s_context;
+  }
+
+private:
+
+  std::array<libdeflate_compressor*, DeflateMaxLevel + 1> m_compressors = { };
+  std::array<libdeflate_gdeflate_compressor*, DeflateMaxLevel + 1> m_gdeflateCompressors = { };
+
+  libdeflate_decompressor*          m_decompressor          = nullptr;
+  libdeflate_gdeflate_decompressor* m_gdeflateDecompressor  = nullptr;
+
+};
+
+
+static std::atomic<bool> g_gdeflateBuiltinDecoder = { false };
+
+
+static bool gdeflateWritePages(
+        WrVectorStream&                 output,
+        size_t                          rawSize,
+  const std::vector<libdeflate_gdeflate_out_page>& pages) {
+  size_t pageCount = pages.size();
+
+  WrStream writer(output);
+  bool success = true;
+
+  GDeflateHeader header = { };
+  header.workgroupCountX = pageCount;
+  header.workgroupCountY = 1;
+  header.workgroupCountZ = 1;
+  header.uncompressedSize = rawSize;
+
+  success &= writer.write(header);
+
+  // Generate page metadata and write it out
+  std::vector<GDeflatePage> metadata(pageCount);
+  size_t pageOffset = sizeof(GDeflateHeader) + sizeof(GDeflatePage) * pageCount;
+
+  for (size_t i = 0; i < pageCount; i++) {
+    metadata[i].pageOffset = pageOffset;
+    metadata[i].pageSize = pages[i].nbytes;
+
+    pageOffset += align(size_t(metadata[i].pageSize), sizeof(uint32_t));
+  }
+
+  success &= writer.write(metadata);
+
+  // Write actual compressed data
+  for (size_t i = 0; i < pageCount; i++) {
+    size_t pageSize = pages[i].nbytes;
+    writer.write(pages[i].data, pageSize);
+
+    // Pad page for dword alignment
+    if ((pageSize &= (sizeof(uint32_t) - 1))) {
+      std::array<char, 3> padding = { };
+      writer.write(padding.data(), sizeof(uint32_t) - pageSize);
+    }
+  }
+
+  return success;
+}
+
+
+static bool gdeflateDecodePages(
+        WrMemoryView                    output,
+        RdMemoryView                    input,
+  const GDeflatePage*                   pages,
+        size_t                          pageCount) {
+  // Every page except the last one must decode to a full page
+  if (!pageCount)
+    return !output.getSize();
+
+  if (output.getSize() > pageCount * GDeflatePageSize
+   || output.getSize() <= (pageCount - 1u) * GDeflatePageSize)
+    return false;
+
+  for (size_t i = 0; i < pageCount; i++) {
+    const auto& page = pages[i];
+
+    if (page.pageOffset > input.getSize()
+     || page.pageSize > input.getSize() - page.pageOffset)
+      return false;
+  }
+
+  if (g_gdeflateBuiltinDecoder.load(std::memory_order_relaxed)) {
+    for (size_t i = 0; i < pageCount; i++) {
+      size_t offset = i * GDeflatePageSize;
+      size_t size = std::min(GDeflatePageSize, output.getSize() - offset);
+
+      if (!gdeflateDecodePage(
+          WrMemoryView(output.getData(offset), size),
+          RdMemoryView(input.getData(pages[i].pageOffset), pages[i].pageSize)))
+        return false;
+    }
+
+    return true;
+  }
+
+  auto* decoder = DeflateContext::get().getGDeflateDecompressor();
+
+  if (!decoder)
+    return false;
+
+  // Create page structs for libdeflate in small batches
+  // so that we do not need to allocate memory for them
+  std::array<libdeflate_gdeflate_in_page, GDeflatePagesPerJob> inPages;
+
+  for (size_t i = 0; i < pageCount; i += inPages.size()) {
+    size_t count = std::min(inPages.size(), pageCount - i);
+
+    for (size_t j = 0; j < count; j++) {
+      inPages[j].data = input.getData(pages[i + j].pageOffset);
+      inPages[j].nbytes = pages[i + j].pageSize;
+    }
+
+    size_t offset = i * GDeflatePageSize;
+    size_t size = std::min(count * GDeflatePageSize, output.getSize() - offset);
+
+    auto status = libdeflate_gdeflate_decompress(decoder,
+      inPages.data(), count, output.getData(offset), size, nullptr);
+
+    if (status != LIBDEFLATE_SUCCESS)
+      return false;
+  }
+
+  return true;
+}
+
+
+void gdeflateSetBuiltinDecoderEnabled(
+        bool                            enable) {
+  g_gdeflateBuiltinDecoder.store(enable, std::memory_order_relaxed);
+}
+
+
+bool gdeflateIsBuiltinDecoderEnabled() {
+  return g_gdeflateBuiltinDecoder.load(std::memory_order_relaxed);
+}
+
+
 bool deflateEncode(
         WrVectorStream&                 output,
         RdMemoryView                    input) {
-  auto* encoder = libdeflate_alloc_compressor(12);
+  return deflateEncode(output, input, DeflateDefaultLevel);
+}
+
+
+bool deflateEncode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level) {
+  auto* encoder = DeflateContext::get().getCompressor(level);
 
   if (!encoder)
     return false;
@@ -24,8 +252,6 @@ bool deflateEncode(
     &vector[oldSize], maxSize);
 
   vector.resize(oldSize + compressed);
-
-  libdeflate_free_compressor(encoder);
   return compressed != 0;
 }
 
@@ -33,7 +259,7 @@ bool deflateEncode(
 bool deflateDecode(
         WrMemoryView                    output,
         RdMemoryView                    input) {
-  auto* decoder = libdeflate_alloc_decompressor();
+  auto* decoder = DeflateContext::get().getDecompressor();
 
   if (!decoder)
     return false;
@@ -42,7 +268,6 @@ bool deflateDecode(
     input.getData(), input.getSize(),
     output.getData(), output.getSize(), nullptr);
 
-  libdeflate_free_decompressor(decoder);
   return status == LIBDEFLATE_SUCCESS;
 }
 
@@ -50,7 +275,15 @@ bool deflateDecode(
 bool gdeflateEncode(
         WrVectorStream&                 output,
         RdMemoryView                    input) {
-  auto* encoder = libdeflate_alloc_gdeflate_compressor(12);
+  return gdeflateEncode(output, input, DeflateDefaultLevel);
+}
+
+
+bool gdeflateEncode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level) {
+  auto* encoder = DeflateContext::get().getGDeflateCompressor(level);
 
   if (!encoder)
     return false;
@@ -69,54 +302,82 @@ bool gdeflateEncode(
     pages[i].nbytes = maxPageSize;
   }
 
-  // Perform the actual compression and free encoder object. We're
-  // done with gdeflate after this, we only need to write the data.
+  // Perform the actual compression. We're done with
+  // gdeflate after this, we only need to write the data.
   size_t compressed = libdeflate_gdeflate_compress(encoder,
     input.getData(), input.getSize(), pages.data(), pages.size());
 
-  libdeflate_free_gdeflate_compressor(encoder);
-
   if (!compressed)
     return false;
 
-  // Now we can actually write the bit stream
-  WrStream writer(output);
-  bool success = true;
+  return gdeflateWritePages(output, input.getSize(), pages);
+}
 
-  GDeflateHeader header = { };
-  header.workgroupCountX = pageCount;
-  header.workgroupCountY = 1;
-  header.workgroupCountZ = 1;
-  header.uncompressedSize = input.getSize();
 
-  success &= writer.write(header);
+bool gdeflateEncode(
+  const Jobs&                           jobs,
+        WrVectorStream&                 output,
+        RdMemoryView                    input) {
+  return gdeflateEncode(jobs, output, input, DeflateDefaultLevel);
+}
 
-  // Generate page metadata and write it out
-  std::vector<GDeflatePage> metadata(pageCount);
-  size_t pageOffset = sizeof(GDeflateHeader) + sizeof(GDeflatePage) * pageCount;
 
-  for (size_t i = 0; i < pageCount; i++) {
-    metadata[i].pageOffset = pageOffset;
-    metadata[i].pageSize = pages[i].nbytes;
+bool gdeflateEncode(
+  const Jobs&                           jobs,
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level) {
+  size_t chunkSize = GDeflatePageSize * GDeflatePagesPerJob;
+  size_t chunkCount = (input.getSize() + chunkSize - 1) / chunkSize;
+
+  if (chunkCount <= 1)
+    return gdeflateEncode(output, input, level);
+
+  // Compress each chunk of pages into its own buffer. Since pages
+  // are independent, we can simply concatenate the page lists.
+  std::vector<std::vector<char>> chunkData(chunkCount);
+  std::vector<std::vector<libdeflate_gdeflate_out_page>> chunkPages(chunkCount);
+  std::atomic<bool> success = { true };
+
+  jobs->execute<BatchJob>([&] (uint32_t chunk) {
+    auto* encoder = DeflateContext::get().getGDeflateCompressor(level);
+
+    if (!encoder) {
+      success = false;
+      return;
+    }
 
-    pageOffset += align(size_t(metadata[i].pageSize), sizeof(uint32_t));
-  }
+    size_t offset = chunk * chunkSize;
+    size_t size = std::min(chunkSize, input.getSize() - offset);
 
-  success &= writer.write(metadata);
+    size_t pageCount = 0;
+    size_t maxSize = libdeflate_gdeflate_compress_bound(encoder, size, &pageCount);
+    size_t maxPageSize = maxSize / pageCount;
 
-  // Write actual compressed data
-  for (size_t i = 0; i < pageCount; i++) {
-    size_t pageSize = pages[i].nbytes;
-    writer.write(pages[i].data, pageSize);
+    auto& pages = chunkPages[chunk];
+    auto& data = chunkData[chunk];
 
-    // Pad page for dword alignment
-    if ((pageSize &= (sizeof(uint32_t) - 1))) {
-      std::array<char, 3> padding = { };
-      writer.write(padding.data(), sizeof(uint32_t) - pageSize);
+    pages.resize(pageCount);
+    data.resize(maxSize);
+
+    for (size_t i = 0; i < pageCount; i++) {
+      pages[i].data = &data[i * maxPageSize];
+      pages[i].nbytes = maxPageSize;
     }
-  }
 
-  return success;
+    if (!libdeflate_gdeflate_compress(encoder, input.getData(offset), size, pages.data(), pages.size()))
+      success = false;
+  }, uint32_t(chunkCount), 1u);
+
+  if (!success)
+    return false;
+
+  std::vector<libdeflate_gdeflate_out_page> pages;
+
+  for (const auto& chunk : chunkPages)
+    pages.insert(pages.end(), chunk.begin(), chunk.end());
+
+  return gdeflateWritePages(output, input.getSize(), pages);
 }
 
 
@@ -137,25 +398,54 @@ bool gdeflateDecode(
   if (!reader.read(metadata))
     return false;
 
-  // Create block structs for libdeflate
-  std::vector<libdeflate_gdeflate_in_page> pages(header.workgroupCountX);
+  // Perform actual decompression
+  return gdeflateDecodePages(output, input, metadata.data(), metadata.size());
+}
 
-  for (size_t i = 0; i < pages.size(); i++) {
-    pages[i].data = input.getData(metadata[i].pageOffset);
-    pages[i].nbytes = metadata[i].pageSize;
-  }
 
-  // Perform actual decompression
-  auto* decoder = libdeflate_alloc_gdeflate_decompressor();
+bool gdeflateDecode(
+  const Jobs&                           jobs,
+        WrMemoryView                    output,
+        RdMemoryView                    input) {
+  RdStream reader(input);
 
-  if (!decoder)
+  GDeflateHeader header = { };
+
+  if (!reader.read(header))
     return false;
 
-  auto status = libdeflate_gdeflate_decompress(decoder,
-    pages.data(), pages.size(), output.getData(), output.getSize(), nullptr);
+  size_t chunkCount = (header.workgroupCountX + GDeflatePagesPerJob - 1) / GDeflatePagesPerJob;
 
-  libdeflate_free_gdeflate_decompressor(decoder);
-  return status == LIBDEFLATE_SUCCESS;
+  if (chunkCount <= 1 || output.getSize() != header.uncompressedSize)
+    return gdeflateDecode(output, input);
+
+  std::vector<GDeflatePage> metadata(header.workgroupCountX);
+
+  if (!reader.read(metadata))
+    return false;
+
+  // Each range of pages decodes to a known range of the output
+  std::atomic<bool> success = { true };
+
+  jobs->execute<BatchJob>([&] (uint32_t chunk) {
+    size_t firstPage = chunk * GDeflatePagesPerJob;
+    size_t pageCount = std::min(GDeflatePagesPerJob, metadata.size() - firstPage);
+
+    size_t offset = firstPage * GDeflatePageSize;
+
+    if (offset >= output.getSize()) {
+      success = false;
+      return;
+    }
+
+    size_t size = std::min(pageCount * GDeflatePageSize, output.getSize() - offset);
+
+    if (!gdeflateDecodePages(WrMemoryView(output.getData(offset), size),
+        input, &metadata[firstPage], pageCount))
+      success = false;
+  }, uint32_t(chunkCount), 1u);
+
+  return success;
 }
 
 
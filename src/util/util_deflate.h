@@ -2,10 +2,30 @@
 
 #include <vector>
 
+#include "../job/job.h"
+
 #include "util_stream.h"
 
 namespace as {
 
+/** Compression level used when none is specified. This
+ *  is the highest level supported by libdeflate, which
+ *  is slow but produces the smallest output. */
+constexpr int DeflateDefaultLevel = 12;
+
+/** Highest supported compression level. Valid levels
+ *  range from 0, which disables compression, to this. */
+constexpr int DeflateMaxLevel = 12;
+
+/** Uncompressed size of a single GDeflate page. Every
+ *  page except the last one decodes to exactly this
+ *  many bytes, which allows decoding pages in parallel. */
+constexpr size_t GDeflatePageSize = 64u << 10;
+
+/** Number of GDeflate pages processed by a single
+ *  work item when encoding or decoding in parallel. */
+constexpr size_t GDeflatePagesPerJob = 16u;
+
 /**
  * \brief GDeflate file header
  *
@@ -37,6 +57,35 @@ struct GDeflatePage {
 };
 
 
+/*
+ * All functions below reuse compressor and decompressor
+ * objects that are cached per thread and per compression
+ * level, since allocating them is expensive relative to
+ * processing small inputs. Cached objects are freed when
+ * the thread that created them exits.
+ */
+
+
+/**
+ * \brief Enables the built-in GDeflate decoder
+ *
+ * By default, GDeflate data is decoded with libdeflate. If enabled,
+ * the lane-parallel decoder from \c util_gdeflate.h is used instead.
+ * It is opt-in until it has been checked against libdeflate on real
+ * archives, which \c gdeflatebench can do. Affects all threads.
+ * \param [in] enable Whether to use the built-in decoder
+ */
+void gdeflateSetBuiltinDecoderEnabled(
+        bool                            enable);
+
+
+/**
+ * \brief Checks whether the built-in GDeflate decoder is used
+ * \returns \c true if GDeflate data is not decoded by libdeflate
+ */
+bool gdeflateIsBuiltinDecoderEnabled();
+
+
 /**
  * \brief Compresses data using libdeflate
  *
@@ -49,6 +98,20 @@ bool deflateEncode(
         RdMemoryView                    input);
 
 
+/**
+ * \brief Compresses data using libdeflate
+ *
+ * \param [in] output Output vector
+ * \param [in] input Input memory
+ * \param [in] level Compression level
+ * \returns \c true on success
+ */
+bool deflateEncode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level);
+
+
 /**
  * \brief Decompresses data using libdeflate
  *
@@ -73,6 +136,53 @@ bool gdeflateEncode(
         RdMemoryView                    input);
 
 
+/**
+ * \brief Compresses data using gdeflate
+ *
+ * \param [in] output Output vector
+ * \param [in] input Input memory
+ * \param [in] level Compression level
+ * \returns \c true on success
+ */
+bool gdeflateEncode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level);
+
+
+/**
+ * \brief Compresses data using gdeflate on multiple threads
+ *
+ * Splits the input into ranges of pages, compresses them in
+ * parallel and produces the exact same format as the single
+ * threaded version. Blocks until compression is complete.
+ * \param [in] jobs Job manager
+ * \param [in] output Output vector
+ * \param [in] input Input memory
+ * \returns \c true on success
+ */
+bool gdeflateEncode(
+  const Jobs&                           jobs,
+        WrVectorStream&                 output,
+        RdMemoryView                    input);
+
+
+/**
+ * \brief Compresses data using gdeflate on multiple threads
+ *
+ * \param [in] jobs Job manager
+ * \param [in] output Output vector
+ * \param [in] input Input memory
+ * \param [in] level Compression level
+ * \returns \c true on success
+ */
+bool gdeflateEncode(
+  const Jobs&                           jobs,
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level);
+
+
 /**
  * \brief Decompresses data using gdeflate
  *
@@ -85,4 +195,21 @@ bool gdeflateDecode(
         RdMemoryView                    input);
 
 
+/**
+ * \brief Decompresses data using gdeflate on multiple threads
+ *
+ * Decodes ranges of pages in parallel. Falls back to the single
+ * threaded version if the input is small. Blocks until the
+ * entire output has been written.
+ * \param [in] jobs Job manager
+ * \param [in] output Output memory
+ * \param [in] input Input memory
+ * \returns \c true on success
+ */
+bool gdeflateDecode(
+  const Jobs&                           jobs,
+        WrMemoryView                    output,
+        RdMemoryView                    input);
+
+
 }
@@ -0,0 +1,1030 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "util_deflate.h"
+#include "util_gdeflate.h"
+#include "util_likely.h"
+#include "util_math.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define AS_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#else
+  #define AS_TARGET_AVX2
+#endif
+
+namespace as {
+
+/*
+ * GDeflate is Deflate with the bit stream split across 32 lanes.
+ * Each lane decodes one symbol at a time, and symbols are assigned
+ * to lanes in a round-robin fashion, except that a lane that read
+ * a length code reads the matching distance code in the following
+ * round. After each round, every lane that consumed bits and has
+ * fewer than 32 bits buffered reads the next dword of the input,
+ * in lane order. Block headers and code lengths follow the same
+ * scheme, see the compute shader in gdeflate/gdeflate.glsl
+ * under src/third_party.
+ */
+constexpr uint32_t GDeflateLaneCount = 32u;
+
+constexpr uint32_t GDeflateLitLenSymbolCount = 288u;
+constexpr uint32_t GDeflateDistSymbolCount = 32u;
+constexpr uint32_t GDeflatePrecodeSymbolCount = 19u;
+
+constexpr uint32_t GDeflateMaxCodeLength = 15u;
+constexpr uint32_t GDeflateMaxPrecodeLength = 7u;
+
+constexpr uint32_t GDeflateLitLenRootBits = 10u;
+constexpr uint32_t GDeflateDistRootBits = 8u;
+
+/* Table sizes include room for sub-tables. Table construction
+ * checks the capacity, so these only need to be large enough
+ * for any code that valid encoders can produce. */
+constexpr uint32_t GDeflateLitLenTableSize = 2048u;
+constexpr uint32_t GDeflateDistTableSize = 1024u;
+constexpr uint32_t GDeflateDistTableOffset = GDeflateLitLenTableSize;
+
+/**
+ * \brief Decode table entry type
+ */
+enum class GDeflateEntryType : uint32_t {
+  eLiteral  = 0u,
+  eCopy     = 1u,
+  eEnd      = 2u,
+  eLink     = 3u,
+  eInvalid  = 4u,
+};
+
+/*
+ * Decode table entries are packed into a single dword:
+ *   [0:4]   Code length, or root table bits for links
+ *   [5:9]   Number of extra bits, or sub-table bits for links
+ *   [10:12] Entry type
+ *   [16:31] Literal or base value, or sub-table offset for links
+ */
+constexpr uint32_t gdeflateMakeEntry(
+        GDeflateEntryType               type,
+        uint32_t                        value,
+        uint32_t                        extra) {
+  return (value << 16) | (uint32_t(type) << 10) | (extra << 5);
+}
+
+constexpr uint32_t GDeflateInvalidEntry = gdeflateMakeEntry(GDeflateEntryType::eInvalid, 0u, 0u);
+
+force_inline uint32_t gdeflateEntryLength(uint32_t entry) {
+  return entry & 0x1fu;
+}
+
+force_inline uint32_t gdeflateEntryExtra(uint32_t entry) {
+  return (entry >> 5) & 0x1fu;
+}
+
+force_inline GDeflateEntryType gdeflateEntryType(uint32_t entry) {
+  return GDeflateEntryType((entry >> 10) & 0x7u);
+}
+
+force_inline uint32_t gdeflateEntryValue(uint32_t entry) {
+  return entry >> 16;
+}
+
+force_inline uint32_t gdeflateMask(uint32_t bits) {
+  return (1u << bits) - 1u;
+}
+
+
+/* Base values and extra bits for length codes 257 to 285. Note that
+ * unlike Deflate, GDeflate encodes lengths of up to 65538 bytes
+ * using length code 285 with 16 extra bits. */
+static const std::array<uint16_t, 29> g_gdeflateLengthBase = {{
+    3,   4,   5,   6,   7,   8,   9,  10,
+   11,  13,  15,  17,  19,  23,  27,  31,
+   35,  43,  51,  59,  67,  83,  99, 115,
+  131, 163, 195, 227,   3,
+}};
+
+static const std::array<uint8_t, 29> g_gdeflateLengthExtra = {{
+  0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4,
+  5, 5, 5, 5, 16,
+}};
+
+/* Base values and extra bits for distance codes. Codes 30 and 31
+ * are valid in GDeflate, even though they are never produced for
+ * pages of 64 kiB or less. */
+static const std::array<uint16_t, 32> g_gdeflateDistBase = {{
+     1,    2,    3,     4,     5,     7,     9,    13,
+    17,   25,   33,    49,    65,    97,   129,   193,
+   257,  385,  513,   769,  1025,  1537,  2049,  3073,
+  4097, 6145, 8193, 12289, 16385, 24577, 32769, 49153,
+}};
+
+static const std::array<uint8_t, 32> g_gdeflateDistExtra = {{
+   0,  0,  0,  0,  1,  1,  2,  2,
+   3,  3,  4,  4,  5,  5,  6,  6,
+   7,  7,  8,  8,  9,  9, 10, 10,
+  11, 11, 12, 12, 13, 13, 14, 14,
+}};
+
+/* Order in which code length code lengths are stored, one per lane */
+static const std::array<uint8_t, GDeflatePrecodeSymbolCount> g_gdeflatePrecodeOrder = {{
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+}};
+
+
+/**
+ * \brief Builds Huffman decode table
+ *
+ * Uses a root table indexed by the first bits of a code, with
+ * sub-tables for longer codes. Since Deflate stores codes with
+ * the most significant bit first, tables are indexed using the
+ * bit-reversed code. Incomplete codes are allowed, unused
+ * entries decode to an invalid entry.
+ * \param [out] table Decode table array. Link entries store
+ *    offsets relative to the start of this array.
+ * \param [in] tableOffset Offset of the root table in the array
+ * \param [in] tableSize Number of entries available for the table
+ * \param [in] rootBits Number of bits used to index the root table
+ * \param [in] lengths Code length for each symbol
+ * \param [in] entries Entry template for each symbol
+ * \param [in] symbolCount Number of symbols
+ * \returns \c false if the code is over-subscribed or
+ *    the table does not fit into the available space.
+ */
+static bool gdeflateBuildTable(
+        uint32_t*                       table,
+        uint32_t                        tableOffset,
+        uint32_t                        tableSize,
+        uint32_t                        rootBits,
+  const uint8_t*                        lengths,
+  const uint32_t*                       entries,
+        uint32_t                        symbolCount) {
+  std::array<uint32_t, GDeflateMaxCodeLength + 1u> counts = { };
+  std::array<uint32_t, GDeflateMaxCodeLength + 2u> offsets = { };
+  std::array<uint16_t, GDeflateLitLenSymbolCount> sorted;
+
+  for (uint32_t i = 0; i < symbolCount; i++)
+    counts[lengths[i]] += 1u;
+
+  // Reject over-subscribed codes
+  int32_t left = 1;
+  uint32_t maxLength = 0u;
+
+  for (uint32_t i = 1; i <= GDeflateMaxCodeLength; i++) {
+    left = 2 * left - int32_t(counts[i]);
+
+    if (left < 0)
+      return false;
+
+    if (counts[i])
+      maxLength = i;
+  }
+
+  // Sort symbols by code length, then by symbol index
+  for (uint32_t i = 1; i <= GDeflateMaxCodeLength; i++)
+    offsets[i + 1u] = offsets[i] + counts[i];
+
+  uint32_t codeCount = offsets[GDeflateMaxCodeLength + 1u];
+
+  for (uint32_t i = 0; i < symbolCount; i++) {
+    if (lengths[i])
+      sorted[offsets[lengths[i]]++] = uint16_t(i);
+  }
+
+  uint32_t rootSize = 1u << rootBits;
+
+  if (rootSize > tableSize)
+    return false;
+
+  for (uint32_t i = 0; i < rootSize; i++)
+    table[tableOffset + i] = GDeflateInvalidEntry;
+
+  // Assign canonical codes in sorted order
+  uint32_t symbolIndex = 0u;
+  uint32_t code = 0u;
+  uint32_t codeLength = 0u;
+
+  uint32_t subTablePrefix = ~0u;
+  uint32_t subTableOffset = 0u;
+  uint32_t subTableBits = 0u;
+  uint32_t nextOffset = tableOffset + rootSize;
+
+  while (symbolIndex < codeCount) {
+    uint32_t symbol = sorted[symbolIndex++];
+    uint32_t length = lengths[symbol];
+
+    code <<= length - codeLength;
+    codeLength = length;
+
+    uint32_t reversed = 0u;
+
+    for (uint32_t i = 0; i < length; i++)
+      reversed |= ((code >> i) & 1u) << (length - i - 1u);
+
+    uint32_t entry = entries[symbol] | length;
+
+    if (length <= rootBits) {
+      for (uint32_t i = reversed; i < rootSize; i += 1u << length)
+        table[tableOffset + i] = entry;
+    } else {
+      uint32_t prefix = reversed & gdeflateMask(rootBits);
+
+      if (prefix != subTablePrefix) {
+        // Codes sharing a prefix are contiguous in canonical order.
+        // Size the sub-table so that it covers the remaining codes
+        // with that prefix, using the remaining code counts.
+        subTableBits = length - rootBits;
+        int32_t subLeft = int32_t(1u << subTableBits);
+
+        while (subTableBits + rootBits < maxLength) {
+          subLeft -= int32_t(counts[subTableBits + rootBits]);
+
+          if (subLeft <= 0)
+            break;
+
+          subTableBits += 1u;
+          subLeft <<= 1;
+        }
+
+        subTablePrefix = prefix;
+        subTableOffset = nextOffset;
+        nextOffset += 1u << subTableBits;
+
+        if (nextOffset > tableOffset + tableSize)
+          return false;
+
+        for (uint32_t i = subTableOffset; i < nextOffset; i++)
+          table[i] = GDeflateInvalidEntry;
+
+        table[tableOffset + prefix] = gdeflateMakeEntry(
+          GDeflateEntryType::eLink, subTableOffset, subTableBits) | rootBits;
+      }
+
+      uint32_t subSize = 1u << subTableBits;
+
+      for (uint32_t i = reversed >> rootBits; i < subSize; i += 1u << (length - rootBits))
+        table[subTableOffset + i] = entry;
+    }
+
+    code += 1u;
+
+    // Sub-table sizes are based on the number of codes
+    // that have not been assigned yet, including this one.
+    counts[length] -= 1u;
+  }
+
+  return true;
+}
+
+
+/**
+ * \brief Entry templates for literal and length symbols
+ */
+static const std::array<uint32_t, GDeflateLitLenSymbolCount> g_gdeflateLitLenEntries = [] {
+  std::array<uint32_t, GDeflateLitLenSymbolCount> result = { };
+
+  for (uint32_t i = 0; i < 256u; i++)
+    result[i] = gdeflateMakeEntry(GDeflateEntryType::eLiteral, i, 0u);
+
+  result[256] = gdeflateMakeEntry(GDeflateEntryType::eEnd, 0u, 0u);
+
+  for (uint32_t i = 0; i < g_gdeflateLengthBase.size(); i++) {
+    result[257u + i] = gdeflateMakeEntry(GDeflateEntryType::eCopy,
+      g_gdeflateLengthBase[i], g_gdeflateLengthExtra[i]);
+  }
+
+  // Symbols 286 and 287 take part in the code but must not occur
+  result[286] = GDeflateInvalidEntry;
+  result[287] = GDeflateInvalidEntry;
+  return result;
+}();
+
+
+/**
+ * \brief Entry templates for distance symbols
+ */
+static const std::array<uint32_t, GDeflateDistSymbolCount> g_gdeflateDistEntries = [] {
+  std::array<uint32_t, GDeflateDistSymbolCount> result = { };
+
+  for (uint32_t i = 0; i < GDeflateDistSymbolCount; i++) {
+    result[i] = gdeflateMakeEntry(GDeflateEntryType::eCopy,
+      g_gdeflateDistBase[i], g_gdeflateDistExtra[i]);
+  }
+
+  return result;
+}();
+
+
+/**
+ * \brief Entry templates for code length symbols
+ *
+ * Repeat symbols store the number of extra bits,
+ * the base repeat count is applied separately.
+ */
+static const std::array<uint32_t, GDeflatePrecodeSymbolCount> g_gdeflatePrecodeEntries = [] {
+  std::array<uint32_t, GDeflatePrecodeSymbolCount> result = { };
+
+  for (uint32_t i = 0; i < 16u; i++)
+    result[i] = gdeflateMakeEntry(GDeflateEntryType::eLiteral, i, 0u);
+
+  result[16] = gdeflateMakeEntry(GDeflateEntryType::eCopy, 16u, 2u);
+  result[17] = gdeflateMakeEntry(GDeflateEntryType::eCopy, 17u, 3u);
+  result[18] = gdeflateMakeEntry(GDeflateEntryType::eCopy, 18u, 7u);
+  return result;
+}();
+
+
+/**
+ * \brief Exclusive prefix bit counts for byte masks
+ *
+ * Entry \c i of row \c m is the number of bits set in \c m
+ * below bit \c i. Used to assign input dwords to lanes.
+ */
+alignas(8) static const std::array<std::array<uint8_t, 8>, 256> g_gdeflatePrefixCounts = [] {
+  std::array<std::array<uint8_t, 8>, 256> result = { };
+
+  for (uint32_t m = 0; m < 256u; m++) {
+    uint32_t count = 0u;
+
+    for (uint32_t i = 0; i < 8u; i++) {
+      result[m][i] = uint8_t(count);
+      count += (m >> i) & 1u;
+    }
+  }
+
+  return result;
+}();
+
+
+/**
+ * \brief GDeflate page decoder
+ *
+ * Stores the bit buffers of all lanes as well as the
+ * decode tables for the current block.
+ */
+class GDeflatePageDecoder {
+
+public:
+
+  GDeflatePageDecoder(
+          GDeflateDecoder                 decoder,
+          WrMemoryView                    output,
+          RdMemoryView                    input)
+  : m_decoder   (decoder)
+  , m_output    (reinterpret_cast<uint8_t*>(output.getData()))
+  , m_outputSize(output.getSize())
+  , m_input     (reinterpret_cast<const uint8_t*>(input.getData()))
+  , m_dwordCount(input.getSize() / sizeof(uint32_t)) {
+    // Every lane starts with one dword of its own
+    for (uint32_t i = 0; i < GDeflateLaneCount; i++) {
+      m_bits[i] = readDword(i);
+      m_counts[i] = 32u;
+    }
+
+    m_nextDword = GDeflateLaneCount;
+  }
+
+  bool decode() {
+    bool final = false;
+
+    while (!final) {
+      // Reads past the end of the input return zero, which decodes to
+      // empty stored blocks. Valid pages never read far past the end,
+      // so stop here rather than looping on a truncated page forever.
+      if (m_nextDword > m_dwordCount + 2u * GDeflateLaneCount)
+        return false;
+
+      uint32_t header = peek(0);
+      final = header & 1u;
+
+      eat(0, 3);
+
+      switch ((header >> 1) & 3u) {
+        case 0u: {
+          if (!decodeStoredBlock())
+            return false;
+        } break;
+
+        case 1u: {
+          if (!initFixedTables() || !decodeHuffmanBlock())
+            return false;
+        } break;
+
+        case 2u: {
+          eat(0, 14);
+
+          uint32_t hlit = bextract(header, 3, 5) + 257u;
+          uint32_t hdist = bextract(header, 8, 5) + 1u;
+          uint32_t hclen = bextract(header, 13, 4) + 4u;
+
+          if (!initDynamicTables(hlit, hdist, hclen) || !decodeHuffmanBlock())
+            return false;
+        } break;
+
+        default:
+          return false;
+      }
+    }
+
+    return m_outputOffset == m_outputSize;
+  }
+
+private:
+
+  GDeflateDecoder m_decoder;
+
+  uint8_t*        m_output      = nullptr;
+  size_t          m_outputSize  = 0u;
+  size_t          m_outputOffset= 0u;
+
+  const uint8_t*  m_input       = nullptr;
+  size_t          m_dwordCount  = 0u;
+  size_t          m_nextDword   = 0u;
+
+  alignas(32) std::array<uint64_t, GDeflateLaneCount> m_bits = { };
+  alignas(32) std::array<uint32_t, GDeflateLaneCount> m_counts = { };
+
+  alignas(32) std::array<uint32_t, GDeflateLaneCount> m_copyLength = { };
+  alignas(32) std::array<uint32_t, GDeflateLaneCount> m_copyOffset = { };
+
+  alignas(32) std::array<uint32_t, GDeflateLitLenTableSize + GDeflateDistTableSize> m_table;
+  std::array<uint32_t, 1u << GDeflateMaxPrecodeLength> m_precodeTable;
+
+  uint32_t readDword(size_t index) const {
+    uint32_t dword = 0u;
+
+    // Reads past the end of the page return zero
+    if (likely(index < m_dwordCount))
+      std::memcpy(&dword, &m_input[index * sizeof(uint32_t)], sizeof(dword));
+
+    return dword;
+  }
+
+  uint32_t peek(uint32_t lane) const {
+    return uint32_t(m_bits[lane]);
+  }
+
+  void eat(uint32_t lane, uint32_t count) {
+    m_bits[lane] >>= count;
+    m_counts[lane] -= count;
+
+    if (m_counts[lane] < 32u) {
+      m_bits[lane] |= uint64_t(readDword(m_nextDword++)) << m_counts[lane];
+      m_counts[lane] += 32u;
+    }
+  }
+
+  uint32_t lookup(uint32_t bits, uint32_t offset, uint32_t rootBits) const {
+    uint32_t entry = m_table[offset + (bits & gdeflateMask(rootBits))];
+
+    if (gdeflateEntryType(entry) == GDeflateEntryType::eLink) {
+      entry = m_table[gdeflateEntryValue(entry)
+        + ((bits >> rootBits) & gdeflateMask(gdeflateEntryExtra(entry)))];
+    }
+
+    return entry;
+  }
+
+  bool initFixedTables() {
+    std::array<uint8_t, GDeflateLitLenSymbolCount> litLenLengths;
+    std::array<uint8_t, GDeflateDistSymbolCount> distLengths;
+
+    for (uint32_t i = 0; i < GDeflateLitLenSymbolCount; i++)
+      litLenLengths[i] = i < 144u ? 8u : (i < 256u ? 9u : (i < 280u ? 7u : 8u));
+
+    for (uint32_t i = 0; i < GDeflateDistSymbolCount; i++)
+      distLengths[i] = 5u;
+
+    return buildTables(litLenLengths.data(), GDeflateLitLenSymbolCount,
+      distLengths.data(), GDeflateDistSymbolCount);
+  }
+
+  bool initDynamicTables(
+          uint32_t                      hlit,
+          uint32_t                      hdist,
+          uint32_t                      hclen) {
+    if (hlit > GDeflateLitLenSymbolCount)
+      return false;
+
+    // Each of the first lanes reads the length of one code length code
+    std::array<uint8_t, GDeflatePrecodeSymbolCount> precodeLengths = { };
+
+    for (uint32_t i = 0; i < hclen; i++) {
+      precodeLengths[g_gdeflatePrecodeOrder[i]] = peek(i) & 0x7u;
+      eat(i, 3);
+    }
+
+    if (!gdeflateBuildTable(m_precodeTable.data(), 0u, m_precodeTable.size(),
+        GDeflateMaxPrecodeLength, precodeLengths.data(),
+        g_gdeflatePrecodeEntries.data(), GDeflatePrecodeSymbolCount))
+      return false;
+
+    // Code lengths are decoded one symbol per lane and round. Repeat
+    // codes refer to the last lane that did not use a repeat code.
+    std::array<uint8_t, GDeflateLitLenSymbolCount + GDeflateDistSymbolCount> lengths;
+
+    uint32_t count = hlit + hdist;
+    uint32_t total = 0u;
+    uint32_t prevLength = ~0u;
+
+    while (total < count) {
+      for (uint32_t i = 0; i < GDeflateLaneCount && total < count; i++) {
+        uint32_t bits = peek(i);
+        uint32_t entry = m_precodeTable[bits & gdeflateMask(GDeflateMaxPrecodeLength)];
+
+        if (gdeflateEntryType(entry) == GDeflateEntryType::eInvalid)
+          return false;
+
+        uint32_t length = gdeflateEntryLength(entry);
+        uint32_t extra = gdeflateEntryExtra(entry);
+        uint32_t symbol = gdeflateEntryValue(entry);
+        uint32_t repeat = (bits >> length) & gdeflateMask(extra);
+
+        uint32_t codeLength = 0u;
+
+        if (symbol < 16u) {
+          codeLength = symbol;
+          prevLength = symbol;
+          repeat = 1u;
+        } else if (symbol == 16u) {
+          if (prevLength == ~0u)
+            return false;
+
+          codeLength = prevLength;
+          repeat += 3u;
+        } else {
+          prevLength = 0u;
+          repeat += symbol == 17u ? 3u : 11u;
+        }
+
+        if (total + repeat > count)
+          return false;
+
+        for (uint32_t j = 0; j < repeat; j++)
+          lengths[total++] = uint8_t(codeLength);
+
+        eat(i, length + extra);
+      }
+    }
+
+    return buildTables(&lengths[0], hlit, &lengths[hlit], hdist);
+  }
+
+  bool buildTables(
+    const uint8_t*                      litLenLengths,
+          uint32_t                      litLenCount,
+    const uint8_t*                      distLengths,
+          uint32_t                      distCount) {
+    // The end of block symbol must be decodable
+    if (litLenCount <= 256u || !litLenLengths[256])
+      return false;
+
+    return gdeflateBuildTable(m_table.data(), 0u, GDeflateLitLenTableSize,
+        GDeflateLitLenRootBits, litLenLengths, g_gdeflateLitLenEntries.data(), litLenCount)
+      && gdeflateBuildTable(m_table.data(), GDeflateDistTableOffset, GDeflateDistTableSize,
+        GDeflateDistRootBits, distLengths, g_gdeflateDistEntries.data(), distCount);
+  }
+
+  bool decodeStoredBlock() {
+    uint32_t size = peek(0) & 0xffffu;
+    eat(0, 16);
+
+    if (size > m_outputSize - m_outputOffset)
+      return false;
+
+    // Bytes are distributed across lanes in a round-robin fashion
+    uint8_t* dst = &m_output[m_outputOffset];
+    m_outputOffset += size;
+
+    for (uint32_t i = 0; i < size; i += GDeflateLaneCount) {
+      uint32_t n = std::min(size - i, GDeflateLaneCount);
+
+      for (uint32_t j = 0; j < n; j++) {
+        dst[i + j] = uint8_t(peek(j));
+        eat(j, 8);
+      }
+    }
+
+    return true;
+  }
+
+  static void copyChunk(
+          uint8_t*                      dst,
+    const uint8_t*                      src) {
+    uint64_t data;
+    std::memcpy(&data, src, sizeof(data));
+    std::memcpy(dst, &data, sizeof(data));
+  }
+
+  bool copyMatch(
+          uint32_t                      lane,
+          uint32_t                      distance) {
+    uint32_t offset = m_copyOffset[lane];
+    uint32_t length = m_copyLength[lane];
+
+    // Pages are independent, so matches cannot reach outside the page
+    if (unlikely(distance > offset))
+      return false;
+
+    uint8_t* dst = &m_output[offset];
+    const uint8_t* src = dst - distance;
+
+    // Copies must not write past their own range since later lanes
+    // may already have written literals there. Copy 8-byte chunks
+    // where the distance allows it, and finish with a chunk that
+    // ends exactly at the end of the copied range.
+    if (distance >= 8u && length >= 8u) {
+      for (uint32_t i = 0; i + 8u <= length; i += 8u)
+        copyChunk(&dst[i], &src[i]);
+
+      copyChunk(&dst[length - 8u], &src[length - 8u]);
+    } else {
+      for (uint32_t i = 0; i < length; i++)
+        dst[i] = src[i];
+    }
+
+    m_copyLength[lane] = 0u;
+    return true;
+  }
+
+  bool decodeHuffmanBlock() {
+    if (m_decoder == GDeflateDecoder::eAvx2)
+      return decodeHuffmanBlockAvx2();
+
+    // Lanes with a pending copy read a distance code, all other lanes
+    // read a literal or length code until one lane reads the end of
+    // block symbol. Symbols are written in lane order, and copies are
+    // resolved as soon as their distance is known since they can only
+    // depend on data from preceding lanes or rounds.
+    bool end = false;
+    bool done = false;
+
+    while (!done) {
+      done = end;
+
+      for (uint32_t i = 0; i < GDeflateLaneCount; i++) {
+        uint32_t bits = peek(i);
+
+        if (m_copyLength[i]) {
+          uint32_t entry = lookup(bits, GDeflateDistTableOffset, GDeflateDistRootBits);
+
+          if (unlikely(gdeflateEntryType(entry) != GDeflateEntryType::eCopy))
+            return false;
+
+          uint32_t length = gdeflateEntryLength(entry);
+          uint32_t extra = gdeflateEntryExtra(entry);
+          uint32_t distance = gdeflateEntryValue(entry) + ((bits >> length) & gdeflateMask(extra));
+
+          if (!copyMatch(i, distance))
+            return false;
+
+          eat(i, length + extra);
+        } else if (!end) {
+          uint32_t entry = lookup(bits, 0u, GDeflateLitLenRootBits);
+
+          uint32_t length = gdeflateEntryLength(entry);
+          uint32_t extra = gdeflateEntryExtra(entry);
+
+          switch (gdeflateEntryType(entry)) {
+            case GDeflateEntryType::eLiteral: {
+              if (unlikely(m_outputOffset >= m_outputSize))
+                return false;
+
+              m_output[m_outputOffset++] = uint8_t(gdeflateEntryValue(entry));
+            } break;
+
+            case GDeflateEntryType::eCopy: {
+              uint32_t copyLength = gdeflateEntryValue(entry) + ((bits >> length) & gdeflateMask(extra));
+
+              if (unlikely(copyLength > m_outputSize - m_outputOffset))
+                return false;
+
+              m_copyLength[i] = copyLength;
+              m_copyOffset[i] = m_outputOffset;
+              m_outputOffset += copyLength;
+            } break;
+
+            case GDeflateEntryType::eEnd: {
+              end = true;
+            } break;
+
+            default:
+              return false;
+          }
+
+          eat(i, length + extra);
+        }
+      }
+    }
+
+    return true;
+  }
+
+  AS_TARGET_AVX2
+  bool decodeHuffmanBlockAvx2();
+
+};
+
+
+AS_TARGET_AVX2
+bool GDeflatePageDecoder::decodeHuffmanBlockAvx2() {
+  constexpr uint32_t Groups = GDeflateLaneCount / 8u;
+
+  // Split bit buffers into low and high dwords
+  alignas(32) std::array<uint32_t, GDeflateLaneCount> lo;
+  alignas(32) std::array<uint32_t, GDeflateLaneCount> hi;
+
+  for (uint32_t i = 0; i < GDeflateLaneCount; i++) {
+    lo[i] = uint32_t(m_bits[i]);
+    hi[i] = uint32_t(m_bits[i] >> 32);
+  }
+
+  __m256i vLo[Groups];
+  __m256i vHi[Groups];
+  __m256i vCount[Groups];
+
+  for (uint32_t g = 0; g < Groups; g++) {
+    vLo[g] = _mm256_load_si256(reinterpret_cast<const __m256i*>(&lo[8u * g]));
+    vHi[g] = _mm256_load_si256(reinterpret_cast<const __m256i*>(&hi[8u * g]));
+    vCount[g] = _mm256_load_si256(reinterpret_cast<const __m256i*>(&m_counts[8u * g]));
+  }
+
+  const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  const __m256i litLenMask = _mm256_set1_epi32(gdeflateMask(GDeflateLitLenRootBits));
+  const __m256i distMask = _mm256_set1_epi32(gdeflateMask(GDeflateDistRootBits));
+  const __m256i distOffset = _mm256_set1_epi32(GDeflateDistTableOffset);
+  const __m256i mask5 = _mm256_set1_epi32(0x1f);
+  const __m256i mask3 = _mm256_set1_epi32(0x7);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i thirtyTwo = _mm256_set1_epi32(32);
+  const __m256i typeLink = _mm256_set1_epi32(uint32_t(GDeflateEntryType::eLink));
+
+  const int* table = reinterpret_cast<const int*>(m_table.data());
+  const int* input = reinterpret_cast<const int*>(m_input);
+
+  alignas(32) std::array<uint32_t, GDeflateLaneCount> values;
+  alignas(32) std::array<uint32_t, GDeflateLaneCount> advance;
+
+  bool end = false;
+  bool done = false;
+
+  while (!done) {
+    done = end;
+
+    uint32_t copyMask = 0u;
+    uint32_t lengthMask = 0u;
+    uint32_t endMask = 0u;
+    uint32_t invalidMask = 0u;
+
+    __m256i vConsumed[Groups];
+
+    // Decode one symbol for each lane, without consuming any bits yet
+    for (uint32_t g = 0; g < Groups; g++) {
+      __m256i bits = vLo[g];
+      __m256i copy = _mm256_cmpgt_epi32(
+        _mm256_load_si256(reinterpret_cast<const __m256i*>(&m_copyLength[8u * g])),
+        _mm256_setzero_si256());
+
+      __m256i index = _mm256_blendv_epi8(
+        _mm256_and_si256(bits, litLenMask),
+        _mm256_add_epi32(distOffset, _mm256_and_si256(bits, distMask)), copy);
+
+      __m256i entry = _mm256_i32gather_epi32(table, index, 4);
+      __m256i type = _mm256_and_si256(_mm256_srli_epi32(entry, 10), mask3);
+      __m256i link = _mm256_cmpeq_epi32(type, typeLink);
+
+      if (!_mm256_testz_si256(link, link)) {
+        __m256i subBits = _mm256_and_si256(_mm256_srli_epi32(entry, 5), mask5);
+        __m256i subIndex = _mm256_add_epi32(_mm256_srli_epi32(entry, 16),
+          _mm256_and_si256(_mm256_srlv_epi32(bits, _mm256_and_si256(entry, mask5)),
+            _mm256_sub_epi32(_mm256_sllv_epi32(one, subBits), one)));
+
+        entry = _mm256_mask_i32gather_epi32(entry, table, subIndex, link, 4);
+        type = _mm256_and_si256(_mm256_srli_epi32(entry, 10), mask3);
+      }
+
+      __m256i length = _mm256_and_si256(entry, mask5);
+      __m256i extra = _mm256_and_si256(_mm256_srli_epi32(entry, 5), mask5);
+
+      __m256i value = _mm256_add_epi32(_mm256_srli_epi32(entry, 16),
+        _mm256_and_si256(_mm256_srlv_epi32(bits, length),
+          _mm256_sub_epi32(_mm256_sllv_epi32(one, extra), one)));
+
+      // Number of output bytes produced or reserved by each lane
+      // if it reads a literal or length symbol in this round
+      __m256i literal = _mm256_cmpeq_epi32(type, _mm256_setzero_si256());
+      __m256i copyType = _mm256_cmpeq_epi32(type, one);
+
+      vConsumed[g] = _mm256_add_epi32(length, extra);
+
+      _mm256_store_si256(reinterpret_cast<__m256i*>(&values[8u * g]), value);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(&advance[8u * g]), _mm256_or_si256(
+        _mm256_and_si256(literal, one), _mm256_and_si256(copyType, value)));
+
+      // Invalid entries have bit 12 set, end of block entries bit 11
+      uint32_t shift = 8u * g;
+
+      copyMask |= uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(copy))) << shift;
+      lengthMask |= uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(copyType))) << shift;
+      endMask |= uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_slli_epi32(entry, 20)))) << shift;
+      invalidMask |= uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_slli_epi32(entry, 19)))) << shift;
+    }
+
+    // Lanes with pending copies always read their distance. Other lanes
+    // read a symbol unless they come after the lane that ended the block.
+    uint32_t symbolMask = end ? 0u : ~copyMask;
+    uint32_t lastMask = symbolMask & endMask & ~invalidMask;
+
+    if (lastMask) {
+      symbolMask &= (2u << tzcnt(lastMask)) - 1u;
+      end = true;
+    }
+
+    uint32_t activeMask = copyMask | symbolMask;
+
+    if (unlikely(invalidMask & activeMask))
+      return false;
+
+    // Copies resolved in this round only write data before the first
+    // byte produced in this round, so they can be executed first.
+    for (uint32_t mask = copyMask; mask; mask &= mask - 1u) {
+      uint32_t i = tzcnt(mask);
+
+      if (unlikely(!copyMatch(i, values[i])))
+        return false;
+    }
+
+    // Assign output ranges in lane order using a prefix sum over the
+    // number of bytes each lane produces or reserves for a copy.
+    alignas(32) std::array<uint32_t, GDeflateLaneCount> offsets;
+    lengthMask &= symbolMask;
+
+    uint32_t offset = uint32_t(m_outputOffset);
+
+    for (uint32_t g = 0; g < Groups; g++) {
+      uint32_t shift = 8u * g;
+
+      __m256i symbol = _mm256_cmpeq_epi32(laneBits,
+        _mm256_and_si256(laneBits, _mm256_set1_epi32(int32_t(symbolMask >> shift))));
+      __m256i length = _mm256_cmpeq_epi32(laneBits,
+        _mm256_and_si256(laneBits, _mm256_set1_epi32(int32_t(lengthMask >> shift))));
+
+      __m256i value = _mm256_load_si256(reinterpret_cast<const __m256i*>(&values[shift]));
+      __m256i size = _mm256_and_si256(symbol,
+        _mm256_load_si256(reinterpret_cast<const __m256i*>(&advance[shift])));
+
+      __m256i sum = size;
+
+      // Inclusive prefix sum within each 128-bit half, then across halves
+      sum = _mm256_add_epi32(sum, _mm256_slli_si256(sum, 4));
+      sum = _mm256_add_epi32(sum, _mm256_slli_si256(sum, 8));
+      sum = _mm256_add_epi32(sum, _mm256_permute2x128_si256(
+        _mm256_shuffle_epi32(sum, 0xff), sum, 0x08));
+
+      __m256i total = _mm256_permutevar8x32_epi32(sum, _mm256_set1_epi32(7));
+      __m256i start = _mm256_add_epi32(_mm256_set1_epi32(int32_t(offset)),
+        _mm256_sub_epi32(sum, size));
+
+      _mm256_store_si256(reinterpret_cast<__m256i*>(&offsets[shift]), start);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(&m_copyOffset[shift]), start);
+      _mm256_store_si256(reinterpret_cast<__m256i*>(&m_copyLength[shift]), _mm256_and_si256(length, value));
+
+      offset += uint32_t(_mm_cvtsi128_si32(_mm256_castsi256_si128(total)));
+    }
+
+    if (unlikely(offset > m_outputSize))
+      return false;
+
+    // Write literals, copies are resolved once the distance is known
+    for (uint32_t mask = symbolMask & ~lengthMask & ~endMask; mask; mask &= mask - 1u) {
+      uint32_t i = tzcnt(mask);
+      m_output[offsets[i]] = uint8_t(values[i]);
+    }
+
+    m_outputOffset = offset;
+
+    // Consume bits and refill lanes in lane order
+    uint32_t refillBase = 0u;
+
+    for (uint32_t g = 0; g < Groups; g++) {
+      __m256i active = _mm256_cmpeq_epi32(laneBits,
+        _mm256_and_si256(laneBits, _mm256_set1_epi32(int32_t(activeMask >> (8u * g)))));
+
+      __m256i consumed = _mm256_and_si256(vConsumed[g], active);
+
+      vLo[g] = _mm256_or_si256(
+        _mm256_srlv_epi32(vLo[g], consumed),
+        _mm256_sllv_epi32(vHi[g], _mm256_sub_epi32(thirtyTwo, consumed)));
+      vHi[g] = _mm256_srlv_epi32(vHi[g], consumed);
+      vCount[g] = _mm256_sub_epi32(vCount[g], consumed);
+
+      __m256i refill = _mm256_and_si256(active, _mm256_cmpgt_epi32(thirtyTwo, vCount[g]));
+      uint32_t refillMask = uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(refill)));
+
+      if (!refillMask)
+        continue;
+
+      uint64_t prefix;
+      std::memcpy(&prefix, g_gdeflatePrefixCounts[refillMask].data(), sizeof(prefix));
+
+      __m256i index = _mm256_add_epi32(
+        _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(int64_t(prefix))),
+        _mm256_set1_epi32(int32_t(m_nextDword + refillBase)));
+
+      // Reads past the end of the page return zero
+      __m256i valid = _mm256_and_si256(refill,
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(int32_t(m_dwordCount)), index));
+
+      __m256i dwords = _mm256_mask_i32gather_epi32(
+        _mm256_setzero_si256(), input, index, valid, 4);
+
+      vLo[g] = _mm256_or_si256(vLo[g], _mm256_sllv_epi32(dwords, vCount[g]));
+      vHi[g] = _mm256_or_si256(vHi[g], _mm256_srlv_epi32(dwords, _mm256_sub_epi32(thirtyTwo, vCount[g])));
+      vCount[g] = _mm256_add_epi32(vCount[g], _mm256_and_si256(refill, thirtyTwo));
+
+      refillBase += popcnt(refillMask);
+    }
+
+    m_nextDword += refillBase;
+  }
+
+  // Write bit buffers back for the next block header
+  for (uint32_t g = 0; g < Groups; g++) {
+    _mm256_store_si256(reinterpret_cast<__m256i*>(&lo[8u * g]), vLo[g]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(&hi[8u * g]), vHi[g]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(&m_counts[8u * g]), vCount[g]);
+  }
+
+  for (uint32_t i = 0; i < GDeflateLaneCount; i++)
+    m_bits[i] = uint64_t(lo[i]) | (uint64_t(hi[i]) << 32);
+
+  return true;
+}
+
+
+static bool gdeflateHasAvx2() {
+  #if defined(_MSC_VER) && !defined(__clang__)
+  std::array<int, 4> regs = { };
+  __cpuid(regs.data(), 1);
+
+  // Require OS support for saving YMM registers
+  bool osxsave = (regs[2] & (1 << 27)) && (regs[2] & (1 << 28));
+  bool popcnt = regs[2] & (1 << 23);
+
+  if (!osxsave || !popcnt || (_xgetbv(0) & 0x6) != 0x6)
+    return false;
+
+  __cpuidex(regs.data(), 7, 0);
+  return regs[1] & (1 << 5);
+  #else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  #endif
+}
+
+
+bool gdeflateIsDecoderSupported(
+        GDeflateDecoder                 decoder) {
+  static const bool s_hasAvx2 = gdeflateHasAvx2();
+
+  switch (decoder) {
+    case GDeflateDecoder::eScalar:
+      return true;
+
+    case GDeflateDecoder::eAvx2:
+      return s_hasAvx2;
+  }
+
+  return false;
+}
+
+
+GDeflateDecoder gdeflateGetDefaultDecoder() {
+  return gdeflateIsDecoderSupported(GDeflateDecoder::eAvx2)
+    ? GDeflateDecoder::eAvx2
+    : GDeflateDecoder::eScalar;
+}
+
+
+bool gdeflateDecodePage(
+        WrMemoryView                    output,
+        RdMemoryView                    input) {
+  static const GDeflateDecoder s_decoder = gdeflateGetDefaultDecoder();
+  return gdeflateDecodePage(s_decoder, output, input);
+}
+
+
+bool gdeflateDecodePage(
+        GDeflateDecoder                 decoder,
+        WrMemoryView                    output,
+        RdMemoryView                    input) {
+  if (output.getSize() > GDeflatePageSize)
+    return false;
+
+  return GDeflatePageDecoder(decoder, output, input).decode();
+}
+
+}
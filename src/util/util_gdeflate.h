@@ -0,0 +1,72 @@
+#pragma once
+
+#include "util_stream.h"
+
+namespace as {
+
+/**
+ * \brief GDeflate page decoder implementation
+ *
+ * GDeflate interleaves the bit streams of 32 lanes within each
+ * page, so that a page can be decoded by processing one symbol
+ * per lane at a time. All implementations produce identical
+ * results, they only differ in how many lanes are processed
+ * at once. Note that \c gdeflateDecode only uses these if
+ * \c gdeflateSetBuiltinDecoderEnabled has been called.
+ */
+enum class GDeflateDecoder : uint32_t {
+  /** Processes lanes one after another. Always supported. */
+  eScalar = 0u,
+  /** Decodes symbols for all lanes in parallel using AVX2.
+   *  Only supported on x86 processors with AVX2. */
+  eAvx2   = 1u,
+};
+
+
+/**
+ * \brief Checks whether a decoder is supported
+ *
+ * \param [in] decoder Decoder implementation
+ * \returns \c true if the decoder can be used on the host
+ */
+bool gdeflateIsDecoderSupported(
+        GDeflateDecoder                 decoder);
+
+
+/**
+ * \brief Queries fastest supported decoder
+ * \returns Decoder used by default
+ */
+GDeflateDecoder gdeflateGetDefaultDecoder();
+
+
+/**
+ * \brief Decodes a single GDeflate page
+ *
+ * Uses the fastest decoder supported on the host.
+ * \param [in] output Output memory. Must be exactly as large
+ *    as the uncompressed page, i.e. \c GDeflatePageSize for
+ *    every page except the last one of a stream.
+ * \param [in] input Compressed page data
+ * \returns \c true on success, \c false if the page
+ *    is malformed or does not match the output size.
+ */
+bool gdeflateDecodePage(
+        WrMemoryView                    output,
+        RdMemoryView                    input);
+
+
+/**
+ * \brief Decodes a single GDeflate page with the given decoder
+ *
+ * \param [in] decoder Decoder implementation. Must be supported.
+ * \param [in] output Output memory
+ * \param [in] input Compressed page data
+ * \returns \c true on success
+ */
+bool gdeflateDecodePage(
+        GDeflateDecoder                 decoder,
+        WrMemoryView                    output,
+        RdMemoryView                    input);
+
+}
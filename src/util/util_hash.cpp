@@ -27,7 +27,7 @@ UniqueHash UniqueHash::compute(
 std::string UniqueHash::toString() const {
   static const std::array<char, 16> ch = {
     '0', '1', '2', '3', '4', '5', '6', '7',
-    '8', '9', 'a', 'b', 'c', 'd', 'e', 'e' };
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
 
   std::string result;
   result.resize(m_data.size() * 2);
@@ -0,0 +1,80 @@
+#include <algorithm>
+
+#ifdef ALSEID_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#include "util_log.h"
+#include "util_lz4.h"
+
+namespace as {
+
+bool lz4IsSupported() {
+#ifdef ALSEID_LZ4
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool lz4Encode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level) {
+#ifdef ALSEID_LZ4
+  // Empty inputs produce an empty block
+  if (!input.getSize())
+    return true;
+
+  if (input.getSize() > size_t(LZ4_MAX_INPUT_SIZE))
+    return false;
+
+  auto& vector = output.getVector();
+  size_t oldSize = vector.size();
+
+  int maxSize = LZ4_compressBound(int(input.getSize()));
+  vector.resize(oldSize + size_t(maxSize));
+
+  int compressed = level < LZ4HC_CLEVEL_MIN
+    ? LZ4_compress_default(
+        reinterpret_cast<const char*>(input.getData()), &vector[oldSize],
+        int(input.getSize()), maxSize)
+    : LZ4_compress_HC(
+        reinterpret_cast<const char*>(input.getData()), &vector[oldSize],
+        int(input.getSize()), maxSize, level);
+
+  vector.resize(oldSize + size_t(std::max(compressed, 0)));
+  return compressed > 0;
+#else
+  Log::err("LZ4 support not enabled");
+  return false;
+#endif
+}
+
+
+bool lz4Decode(
+        WrMemoryView                    output,
+        RdMemoryView                    input) {
+#ifdef ALSEID_LZ4
+  if (!output.getSize())
+    return !input.getSize();
+
+  if (input.getSize() > size_t(LZ4_MAX_INPUT_SIZE)
+   || output.getSize() > size_t(LZ4_MAX_INPUT_SIZE))
+    return false;
+
+  int size = LZ4_decompress_safe(
+    reinterpret_cast<const char*>(input.getData()),
+    reinterpret_cast<char*>(output.getData()),
+    int(input.getSize()), int(output.getSize()));
+
+  return size >= 0 && size_t(size) == output.getSize();
+#else
+  Log::err("LZ4 support not enabled");
+  return false;
+#endif
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "util_stream.h"
+
+namespace as {
+
+/** Compression level used when none is specified. Uses the
+ *  high-compression encoder at its maximum level, which is
+ *  slow to encode but does not affect decoding speed. */
+constexpr int Lz4DefaultLevel = 12;
+
+/**
+ * \brief Checks whether LZ4 support is available
+ * \returns \c true if the library was built with LZ4
+ */
+bool lz4IsSupported();
+
+
+/**
+ * \brief Compresses data using LZ4
+ *
+ * Produces a raw LZ4 block without a frame header. The
+ * uncompressed size must be stored separately.
+ * \param [in] output Output vector
+ * \param [in] input Input memory
+ * \param [in] level Compression level. Levels below 3 use
+ *    the fast encoder, higher levels use LZ4HC.
+ * \returns \c true on success
+ */
+bool lz4Encode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level);
+
+
+/**
+ * \brief Decompresses data using LZ4
+ *
+ * \param [in] output Output memory. Must be exactly
+ *    as large as the uncompressed data.
+ * \param [in] input Input memory
+ * \returns \c true on success
+ */
+bool lz4Decode(
+        WrMemoryView                    output,
+        RdMemoryView                    input);
+
+}
@@ -207,6 +207,27 @@ public:
     return result;
   }
 
+  /**
+   * \brief Allocates multiple indices
+   *
+   * Equivalent to calling \c allocate repeatedly,
+   * but only takes the lock once.
+   * \param [in] count Number of indices to allocate
+   * \param [out] indices Newly allocated indices
+   */
+  void allocate(uint32_t count, uint32_t* indices) {
+    std::lock_guard lock(m_mutex);
+
+    for (uint32_t i = 0; i < count; i++) {
+      if (m_free.empty()) {
+        indices[i] = m_next++;
+      } else {
+        indices[i] = m_free.back();
+        m_free.pop_back();
+      }
+    }
+  }
+
   /**
    * \brief Frees index
    *
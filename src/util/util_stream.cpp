@@ -85,7 +85,9 @@ bool WrBufferedStream::writeComplex(const void* src, size_t size) {
     m_bufferOffset += written;
   }
 
-  if (!flush())
+  // Only flush the internal buffer here, derived streams
+  // may implement flush as a potentially expensive sync
+  if (!WrBufferedStream::flush())
     return false;
 
   // Flush will set the buffer size to the actual amount of
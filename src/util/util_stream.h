@@ -591,10 +591,11 @@ public:
   /**
    * \brief Flushes internal buffer
    *
-   * Writes all buffered data to the memory stream.
+   * Writes all buffered data to the memory stream. Derived
+   * streams may override this to flush their own state too.
    * \returns \c true on success, or \c false if an error occured.
    */
-  bool flush();
+  virtual bool flush();
 
 private:
 
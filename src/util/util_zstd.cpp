@@ -0,0 +1,122 @@
+#ifdef ALSEID_ZSTD
+#include <zstd.h>
+#endif
+
+#include "util_log.h"
+#include "util_zstd.h"
+
+namespace as {
+
+#ifdef ALSEID_ZSTD
+/**
+ * \brief Per-thread Zstandard contexts
+ *
+ * Lazily allocates compression and decompression contexts
+ * on first use, and frees them when the thread exits.
+ */
+class ZstdContext {
+
+public:
+
+  ZstdContext() { }
+
+  ZstdContext             (const ZstdContext&) = delete;
+  ZstdContext& operator = (const ZstdContext&) = delete;
+
+  ~ZstdContext() {
+    ZSTD_freeCCtx(m_cctx);
+    ZSTD_freeDCtx(m_dctx);
+  }
+
+  ZSTD_CCtx* getCompressionContext() {
+    if (!m_cctx)
+      m_cctx = ZSTD_createCCtx();
+
+    return m_cctx;
+  }
+
+  ZSTD_DCtx* getDecompressionContext() {
+    if (!m_dctx)
+      m_dctx = ZSTD_createDCtx();
+
+    return m_dctx;
+  }
+
+  static ZstdContext& get() {
+    thread_local ZstdContext s_context;
+    return s_context;
+  }
+
+private:
+
+  ZSTD_CCtx* m_cctx = nullptr;
+  ZSTD_DCtx* m_dctx = nullptr;
+
+};
+#endif
+
+
+bool zstdIsSupported() {
+#ifdef ALSEID_ZSTD
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool zstdEncode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level) {
+#ifdef ALSEID_ZSTD
+  auto* cctx = ZstdContext::get().getCompressionContext();
+
+  if (!cctx)
+    return false;
+
+  auto& vector = output.getVector();
+  size_t oldSize = vector.size();
+
+  size_t maxSize = ZSTD_compressBound(input.getSize());
+  vector.resize(oldSize + maxSize);
+
+  size_t compressed = ZSTD_compressCCtx(cctx,
+    &vector[oldSize], maxSize,
+    input.getData(), input.getSize(), level);
+
+  if (ZSTD_isError(compressed)) {
+    vector.resize(oldSize);
+    return false;
+  }
+
+  vector.resize(oldSize + compressed);
+  return true;
+#else
+  Log::err("Zstandard support not enabled");
+  return false;
+#endif
+}
+
+
+bool zstdDecode(
+        WrMemoryView                    output,
+        RdMemoryView                    input) {
+#ifdef ALSEID_ZSTD
+  auto* dctx = ZstdContext::get().getDecompressionContext();
+
+  if (!dctx)
+    return false;
+
+  size_t size = ZSTD_decompressDCtx(dctx,
+    output.getData(), output.getSize(),
+    input.getData(), input.getSize());
+
+  return !ZSTD_isError(size) && size == output.getSize();
+#else
+  Log::err("Zstandard support not enabled");
+  return false;
+#endif
+}
+
+}
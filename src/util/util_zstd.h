@@ -0,0 +1,46 @@
+#pragma once
+
+#include "util_stream.h"
+
+namespace as {
+
+/** Compression level used when none is specified. Higher
+ *  levels mostly cost encoding time, decoding speed stays
+ *  roughly the same across all levels. */
+constexpr int ZstdDefaultLevel = 19;
+
+/**
+ * \brief Checks whether Zstandard support is available
+ * \returns \c true if the library was built with Zstandard
+ */
+bool zstdIsSupported();
+
+
+/**
+ * \brief Compresses data using Zstandard
+ *
+ * \param [in] output Output vector
+ * \param [in] input Input memory
+ * \param [in] level Compression level
+ * \returns \c true on success
+ */
+bool zstdEncode(
+        WrVectorStream&                 output,
+        RdMemoryView                    input,
+        int                             level);
+
+
+/**
+ * \brief Decompresses data using Zstandard
+ *
+ * Reuses a decompression context that is cached per thread.
+ * \param [in] output Output memory. Must be exactly
+ *    as large as the uncompressed data.
+ * \param [in] input Input memory
+ * \returns \c true on success
+ */
+bool zstdDecode(
+        WrMemoryView                    output,
+        RdMemoryView                    input);
+
+}
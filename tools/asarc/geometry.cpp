@@ -2,6 +2,7 @@
 
 struct GeometryFile {
   std::string name;
+  std::string group;
   std::string input;
 };
 
@@ -10,6 +11,9 @@ void from_json(const json& j, GeometryFile& args) {
   if (j.count("name"))
     j.at("name").get_to(args.name);
 
+  if (j.count("group"))
+    j.at("group").get_to(args.group);
+
   if (j.count("input"))
     j.at("input").get_to(args.input);
 }
@@ -33,6 +37,8 @@ void processGeometries(ArchiveBuilder& builder, const json& j) {
 
   for (const auto& geometry : files) {
     geometryDesc.name = geometry.name;
+
+    builder.setLayoutGroup(geometry.group);
     builder.addBuildJob(std::make_shared<GeometryBuildJob>(g_env, geometryDesc, g_basedir / geometry.input));
   }
 }
@@ -4,7 +4,11 @@
 
 #include "../../src/gfx/gfx_format.h"
 
+#include "../../src/util/util_lz4.h"
+#include "../../src/util/util_zstd.h"
+
 #include "../libasarchive/archive.h"
+#include "../libasarchive/cache.h"
 #include "../libasarchive/geometry.h"
 #include "../libasarchive/merge.h"
 #include "../libasarchive/shader.h"
@@ -72,6 +76,27 @@ std::vector<std::filesystem::path> getInputList(ConsoleArgs& args) {
 }
 
 
+bool parseCompressionPolicy(const std::string& arg, ArchiveCompressionPolicy& policy) {
+  if (arg == "deflate")
+    policy = ArchiveCompressionPolicy::eDeflate;
+  else if (arg == "speed")
+    policy = ArchiveCompressionPolicy::eSpeed;
+  else if (arg == "ratio")
+    policy = ArchiveCompressionPolicy::eRatio;
+  else if (arg == "balanced")
+    policy = ArchiveCompressionPolicy::eBalanced;
+  else {
+    std::cerr << "Unknown compression policy: " << arg << std::endl;
+    return false;
+  }
+
+  if (policy != ArchiveCompressionPolicy::eDeflate && !lz4IsSupported() && !zstdIsSupported())
+    std::cerr << "LZ4 and Zstandard not supported, using deflate" << std::endl;
+
+  return true;
+}
+
+
 bool buildMerge(ArchiveBuilder& builder, const std::filesystem::path& path) {
   auto archive = IoArchive::fromFile(g_env.io->open(path, IoOpenMode::eRead));
 
@@ -80,10 +105,18 @@ bool buildMerge(ArchiveBuilder& builder, const std::filesystem::path& path) {
     return false;
   }
 
-  // Dispatch one merge job per file
+  // Dispatch one merge job per file. Keep all files from the
+  // source archive in one layout group so that the original
+  // data layout is preserved.
+  std::string layoutGroup = builder.getLayoutGroup();
+
+  if (layoutGroup.empty())
+    builder.setLayoutGroup(path.string());
+
   for (uint32_t i = 0; i < archive->getFileCount(); i++)
     builder.addBuildJob(std::make_shared<MergeBuildJob>(g_env, archive, i));
 
+  builder.setLayoutGroup(layoutGroup);
   return true;
 }
 
@@ -162,6 +195,9 @@ bool buildGeometries(ConsoleArgs& args, ArchiveBuilder& builder, const GeometryD
 bool buildJson(ConsoleArgs& args, ArchiveBuilder& builder) {
   std::vector<std::filesystem::path> paths = getInputList(args);
 
+  // Entries in json files set their own layout group
+  std::string layoutGroup = builder.getLayoutGroup();
+
   for (const auto& path : paths) {
     std::ifstream file(path);
 
@@ -171,6 +207,7 @@ bool buildJson(ConsoleArgs& args, ArchiveBuilder& builder) {
     processGeometries(builder, j);
   }
 
+  builder.setLayoutGroup(layoutGroup);
   return true;
 }
 
@@ -193,12 +230,50 @@ int executeBuild(ConsoleArgs& args) {
   GeometryDesc geometryDesc = { };
   geometryDesc.layoutMap = std::make_shared<GltfPackedVertexLayoutMap>();
 
+  bool printIoStats = false;
+
+  std::shared_ptr<BuildCache> cache;
+
   while (args.has(1)) {
     std::string arg = args.next();
     bool status = true;
 
     if (arg == "-j") {
       status = buildJson(args, builder);
+    } else if (arg == "-io-stats") {
+      printIoStats = true;
+    } else if (arg == "-align") {
+      arg = args.next();
+      unsigned long alignment = 0;
+
+      try {
+        alignment = std::stoul(arg);
+      } catch (const std::invalid_argument&) {
+        std::cerr << "Invalid alignment: " << arg << std::endl;
+        return 1;
+      } catch (const std::out_of_range&) {
+        std::cerr << "Alignment out of range: " << arg << std::endl;
+        return 1;
+      }
+
+      if (!alignment || alignment > (1ul << 31) || (alignment & (alignment - 1))) {
+        std::cerr << "Alignment must be a power of two: " << arg << std::endl;
+        return 1;
+      }
+
+      ArchiveLayoutDesc layout;
+      layout.subFileAlignment = uint32_t(alignment);
+      builder.setLayout(layout);
+    } else if (arg == "-cache") {
+      arg = args.next();
+      cache = std::make_shared<BuildCache>(g_env, arg);
+      builder.setCache(cache);
+    } else if (arg == "-stream") {
+      arg = args.next();
+      builder.setStreaming(arg == "on");
+    } else if (arg == "-group") {
+      arg = args.next();
+      builder.setLayoutGroup(arg);
     } else if (arg == "-I") {
       arg = args.next();
       g_basedir = arg;
@@ -206,6 +281,9 @@ int executeBuild(ConsoleArgs& args) {
       status = buildMerges(args, builder);
     } else if (arg == "-s") {
       status = buildShaders(args, builder, shaderDesc);
+    } else if (arg == "-s-compression") {
+      arg = args.next();
+      status = parseCompressionPolicy(arg, shaderDesc.compression);
     } else if (arg == "-t") {
       status = buildTextures(args, builder, textureDesc);
     } else if (arg == "-g") {
@@ -246,6 +324,14 @@ int executeBuild(ConsoleArgs& args) {
   // Wait for build process to complete
   BuildResult status = builder.build(outputPath);
 
+  if (printIoStats)
+    std::cout << g_env.io->getStats().toString() << std::endl;
+
+  if (cache) {
+    Log::info("Build cache: ", cache->getHitCount(), " hits, ",
+      cache->getMissCount(), " misses");
+  }
+
   if (status != BuildResult::eSuccess) {
     std::cerr << "Failed to build archive" << std::endl;
     return 1;
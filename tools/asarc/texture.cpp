@@ -43,6 +43,7 @@ void from_json(const json& j, TextureLayout& args) {
 struct TextureFile {
   std::string name;
   std::string layout;
+  std::string group;
   std::vector<std::string> input;
 };
 
@@ -54,6 +55,9 @@ void from_json(const json& j, TextureFile& args) {
   if (j.count("layout"))
     j.at("layout").get_to(args.layout);
 
+  if (j.count("group"))
+    j.at("group").get_to(args.group);
+
   if (j.count("input"))
     j.at("input").get_to(args.input);
 }
@@ -96,6 +100,7 @@ void processTextures(ArchiveBuilder& builder, const json& j) {
     desc.allowCompression = layout->second.allowCompression;
     desc.allowBc7 = layout->second.allowBc7;
 
+    builder.setLayoutGroup(texture.group);
     builder.addBuildJob(std::make_shared<TextureBuildJob>(g_env, desc, std::move(inputs)));
   }
 }
@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../src/gfx/gfx.h"
+
+#include "../../src/gfx/asset/gfx_asset_manager.h"
+
+#include "../../src/util/util_log.h"
+
+using namespace as;
+
+constexpr uint64_t BenchAssetSize = 64ull << 10u;
+
+/**
+ * \brief Asset without any backing storage
+ *
+ * Becomes resident as soon as it is requested and only reports
+ * its size to the asset manager, so that the benchmark measures
+ * residency tracking rather than resource creation.
+ */
+class BenchAsset : public GfxAssetIface {
+
+public:
+
+  BenchAsset(
+          uint64_t                      size)
+  : m_size(size) { }
+
+  GfxAssetProperties getAssetInfo() const override {
+    GfxAssetProperties result = { };
+    result.type = GfxAssetType::eBuffer;
+    result.status = m_status;
+    result.gpuSize = m_status != GfxAssetStatus::eNonResident ? m_size : 0u;
+    result.streamSize = m_size;
+    return result;
+  }
+
+  bool requestStream(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      frameId) override {
+    m_status = GfxAssetStatus::eStreamRequest;
+    assetManager.notifyMemoryAlloc(m_size);
+    return true;
+  }
+
+  void requestEviction(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      frameId) override {
+    m_status = GfxAssetStatus::eEvictRequest;
+  }
+
+  void makeResident(
+          GfxAssetManagerIface          assetManager) override {
+    m_status = GfxAssetStatus::eResident;
+  }
+
+  void evict(
+          GfxAssetManagerIface          assetManager) override {
+    m_status = GfxAssetStatus::eNonResident;
+    assetManager.notifyMemoryFree(m_size);
+  }
+
+private:
+
+  uint64_t        m_size;
+  GfxAssetStatus  m_status = GfxAssetStatus::eNonResident;
+
+};
+
+
+/**
+ * \brief Asset used to wait for the request worker
+ *
+ * Never becomes resident, so that every stream request for its
+ * group calls into the asset. Stream requests are processed after
+ * regular requests and in order of importance, so streaming the
+ * group with the lowest possible importance signals that all
+ * requests submitted before have been processed.
+ */
+class BenchFence : public GfxAssetIface {
+
+public:
+
+  GfxAssetProperties getAssetInfo() const override {
+    GfxAssetProperties result = { };
+    result.type = GfxAssetType::eBuffer;
+    return result;
+  }
+
+  bool requestStream(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      frameId) override {
+    std::lock_guard lock(m_mutex);
+    m_signaled += 1u;
+    m_cond.notify_one();
+    return true;
+  }
+
+  void requestEviction(
+          GfxAssetManagerIface          assetManager,
+          uint32_t                      frameId) override { }
+
+  void makeResident(
+          GfxAssetManagerIface          assetManager) override { }
+
+  void evict(
+          GfxAssetManagerIface          assetManager) override { }
+
+  void wait(
+          uint64_t                      value) const {
+    std::unique_lock lock(m_mutex);
+    m_cond.wait(lock, [this, value] { return m_signaled >= value; });
+  }
+
+private:
+
+  mutable std::mutex              m_mutex;
+  mutable std::condition_variable m_cond;
+  uint64_t                        m_signaled = 0u;
+
+};
+
+
+struct BenchOptions {
+  uint32_t assetCount = 50000u;
+  uint32_t groupCount = 50000u;
+  uint32_t groupSize = 4u;
+  uint32_t toggleCount = 20000u;
+  uint32_t frameCount = 100u;
+};
+
+
+using CreateProc = void (*)(GfxAssetManager&, const BenchOptions&,
+  std::vector<GfxAsset>&, std::vector<GfxAssetGroup>&);
+
+
+int printHelp() {
+  std::cout << "Usage: assetbench [-a assets] [-g groups] [-s group size] [-t toggles] [-n frames]" << std::endl << std::endl
+            << "Measures how long it takes to create the given number of assets and" << std::endl
+            << "asset groups one by one, compared to the bulk creation functions." << std::endl << std::endl
+            << "Then creates the given number of assets and asset groups, and toggles the" << std::endl
+            << "residency of randomly selected groups every frame. No memory budget is" << std::endl
+            << "set, so that the asset manager evicts every asset that becomes unused." << std::endl
+            << "Reports the time it takes the asset manager to process all requests of" << std::endl
+            << "a frame, including the eviction pass of the previous frame." << std::endl;
+  return 0;
+}
+
+
+bool parseOption(
+  const char*                           arg,
+        uint32_t&                       value) {
+  try {
+    value = std::stoul(arg);
+    return true;
+  } catch (const std::exception&) {
+    std::cerr << "Invalid value: " << arg << std::endl;
+    return false;
+  }
+}
+
+
+std::vector<uint32_t> generateGroupLayout(
+  const BenchOptions&                   options) {
+  std::mt19937 rng(0u);
+  std::uniform_int_distribution<uint32_t> assetDist(0u, options.assetCount - 1u);
+
+  std::vector<uint32_t> layout(options.groupCount * options.groupSize);
+
+  for (uint32_t i = 0; i < options.groupCount; i++) {
+    uint32_t first = assetDist(rng);
+
+    for (uint32_t j = 0; j < options.groupSize; j++)
+      layout[i * options.groupSize + j] = (first + j) % options.assetCount;
+  }
+
+  return layout;
+}
+
+
+void createAssetsSingle(
+        GfxAssetManager&                assetManager,
+  const BenchOptions&                   options,
+        std::vector<GfxAsset>&          assets,
+        std::vector<GfxAssetGroup>&     groups) {
+  std::vector<uint32_t> layout = generateGroupLayout(options);
+  std::vector<GfxAsset> groupAssets(options.groupSize);
+
+  for (uint32_t i = 0; i < options.assetCount; i++) {
+    assets[i] = assetManager.createAsset<BenchAsset>(
+      std::string("asset_") + std::to_string(i), BenchAssetSize);
+  }
+
+  for (uint32_t i = 0; i < options.groupCount; i++) {
+    for (uint32_t j = 0; j < options.groupSize; j++)
+      groupAssets[j] = assets[layout[i * options.groupSize + j]];
+
+    groups[i] = assetManager.createAssetGroup(std::string("group_") + std::to_string(i),
+      GfxAssetGroupType::eAppManaged, options.groupSize, groupAssets.data());
+  }
+}
+
+
+void createAssetsBulk(
+        GfxAssetManager&                assetManager,
+  const BenchOptions&                   options,
+        std::vector<GfxAsset>&          assets,
+        std::vector<GfxAssetGroup>&     groups) {
+  std::vector<uint32_t> layout = generateGroupLayout(options);
+
+  // Reserve space for the fence used by the toggle benchmark
+  assetManager.reserve(options.assetCount + 1u, options.groupCount + 1u,
+    options.groupCount * options.groupSize + 1u);
+
+  std::vector<GfxAssetDesc> assetDescs(options.assetCount);
+
+  for (uint32_t i = 0; i < options.assetCount; i++) {
+    assetDescs[i].name = std::string("asset_") + std::to_string(i);
+    assetDescs[i].iface = std::make_unique<BenchAsset>(BenchAssetSize);
+  }
+
+  assetManager.createAssets(options.assetCount, assetDescs.data(), assets.data());
+
+  std::vector<GfxAsset> groupAssets(layout.size());
+  std::vector<GfxAssetGroupDesc> groupDescs(options.groupCount);
+
+  for (size_t i = 0; i < layout.size(); i++)
+    groupAssets[i] = assets[layout[i]];
+
+  for (uint32_t i = 0; i < options.groupCount; i++) {
+    groupDescs[i].name = std::string("group_") + std::to_string(i);
+    groupDescs[i].assetCount = options.groupSize;
+    groupDescs[i].assets = &groupAssets[i * options.groupSize];
+  }
+
+  assetManager.createAssetGroups(options.groupCount, groupDescs.data(), groups.data());
+}
+
+
+void runCreateBenchmark(
+  const GfxDevice&                      device,
+  const BenchOptions&                   options,
+  const char*                           name,
+        CreateProc                      proc) {
+  std::vector<GfxAsset> assets(options.assetCount);
+  std::vector<GfxAssetGroup> groups(options.groupCount);
+
+  // Use a fresh asset manager so that both
+  // variants start with empty look-up tables
+  GfxAssetManager assetManager(device);
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  proc(assetManager, options, assets, groups);
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  double ms = 1000.0 * std::chrono::duration<double>(t1 - t0).count();
+
+  std::cout << "  " << std::setw(10) << std::left << name
+            << std::setw(10) << std::right << std::fixed << std::setprecision(3) << ms << " ms" << std::endl;
+}
+
+
+void runCreateBenchmarks(
+  const GfxDevice&                      device,
+  const BenchOptions&                   options) {
+  std::cout << "Creating " << options.assetCount << " assets and "
+            << options.groupCount << " groups:" << std::endl;
+
+  runCreateBenchmark(device, options, "single", &createAssetsSingle);
+  runCreateBenchmark(device, options, "bulk", &createAssetsBulk);
+}
+
+
+void runToggleBenchmark(
+  const GfxDevice&                      device,
+  const BenchOptions&                   options) {
+  constexpr uint32_t ContextCount = 2u;
+
+  // Do not set a memory budget. Stream requests are then never
+  // deferred, which would stall the fence, and every asset that
+  // becomes unused goes through the LRU list and gets evicted.
+  GfxAssetManager assetManager(device);
+
+  std::vector<GfxAsset> assets(options.assetCount);
+  std::vector<GfxAssetGroup> groups(options.groupCount);
+
+  createAssetsBulk(assetManager, options, assets, groups);
+
+  std::mt19937 rng(1u);
+  std::uniform_int_distribution<uint32_t> groupDist(0u, options.groupCount - 1u);
+
+  GfxAsset fenceAsset = assetManager.createAsset<BenchFence>("fence");
+  GfxAssetGroup fenceGroup = assetManager.createAssetGroup("fence",
+    GfxAssetGroupType::eAppManaged, 1u, &fenceAsset);
+
+  auto fence = assetManager.getAssetAs<BenchFence>(fenceAsset);
+
+  std::vector<bool> active(options.groupCount);
+  std::array<GfxContext, ContextCount> contexts;
+
+  for (auto& context : contexts)
+    context = device->createContext(GfxQueue::eGraphics);
+
+  GfxSemaphoreDesc semaphoreDesc;
+  semaphoreDesc.debugName = "Frame semaphore";
+
+  GfxSemaphore semaphore = device->createSemaphore(semaphoreDesc);
+
+  std::vector<double> frameTimes;
+  frameTimes.reserve(options.frameCount);
+
+  for (uint32_t frameId = 1u; frameId <= options.frameCount; frameId++) {
+    if (frameId > ContextCount)
+      semaphore->wait(frameId - ContextCount);
+
+    GfxContext context = contexts[frameId % ContextCount];
+    context->reset();
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    for (uint32_t i = 0; i < options.toggleCount; i++) {
+      uint32_t index = groupDist(rng);
+
+      if (active[index])
+        assetManager.evictAssetGroup(groups[index]);
+      else
+        assetManager.streamAssetGroup(groups[index]);
+
+      active[index] = !active[index];
+    }
+
+    // Wait for the worker to process all toggles of this frame, as
+    // well as the eviction pass enqueued by the previous frame.
+    assetManager.streamAssetGroup(fenceGroup, std::numeric_limits<float>::lowest());
+    fence->wait(frameId);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    frameTimes.push_back(std::chrono::duration<double>(t1 - t0).count());
+
+    assetManager.evictAssetGroup(fenceGroup);
+    assetManager.commitUpdates(context, frameId, frameId - 1u);
+
+    GfxCommandSubmission submission;
+    submission.addSignalSemaphore(semaphore, frameId);
+    submission.addCommandList(context->endCommandList());
+
+    device->submit(GfxQueue::eGraphics, std::move(submission));
+  }
+
+  device->waitIdle();
+
+  std::sort(frameTimes.begin(), frameTimes.end());
+
+  double median = frameTimes[frameTimes.size() / 2u];
+  double worst = frameTimes.back();
+  double ns = 1000000000.0 * median / double(std::max(options.toggleCount, 1u));
+
+  auto stats = assetManager.getStats();
+
+  std::cout << "Toggling " << options.toggleCount << " of " << options.groupCount << " groups per frame, "
+            << options.frameCount << " frames:" << std::endl
+            << "  median " << std::fixed << std::setprecision(3) << 1000.0 * median << " ms, "
+            << "worst " << 1000.0 * worst << " ms per frame, "
+            << std::setprecision(1) << ns << " ns per toggle" << std::endl
+            << "  " << stats.evictedAssets << " assets evicted" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+  Log::setLogLevel(LogSeverity::eError);
+
+  BenchOptions options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    bool success = true;
+
+    if (arg == "-h" || arg == "--help")
+      return printHelp();
+    else if (arg == "-a" && i + 1 < argc)
+      success = parseOption(argv[++i], options.assetCount);
+    else if (arg == "-g" && i + 1 < argc)
+      success = parseOption(argv[++i], options.groupCount);
+    else if (arg == "-s" && i + 1 < argc)
+      success = parseOption(argv[++i], options.groupSize);
+    else if (arg == "-t" && i + 1 < argc)
+      success = parseOption(argv[++i], options.toggleCount);
+    else if (arg == "-n" && i + 1 < argc)
+      success = parseOption(argv[++i], options.frameCount);
+    else
+      return printHelp();
+
+    if (!success)
+      return 1;
+  }
+
+  if (!options.assetCount || !options.groupCount || !options.groupSize || !options.frameCount) {
+    std::cerr << "Asset, group and frame counts must not be zero" << std::endl;
+    return 1;
+  }
+
+  Gfx gfx(GfxBackend::eDefault, Wsi(), GfxInstanceFlags());
+
+  if (!gfx) {
+    std::cerr << "Failed to initialize graphics system" << std::endl;
+    return 1;
+  }
+
+  GfxDevice device = gfx->createDevice(gfx->enumAdapters(0));
+
+  if (!device) {
+    std::cerr << "Failed to create device" << std::endl;
+    return 1;
+  }
+
+  runCreateBenchmarks(device, options);
+  runToggleBenchmark(device, options);
+  return 0;
+}
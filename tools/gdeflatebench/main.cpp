@@ -0,0 +1,449 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include <libdeflate.h>
+
+#include "../../src/io/io.h"
+#include "../../src/io/io_archive.h"
+
+#include "../../src/job/job.h"
+
+#include "../../src/util/util_deflate.h"
+#include "../../src/util/util_gdeflate.h"
+#include "../../src/util/util_log.h"
+
+using namespace as;
+
+/**
+ * \brief Compressed test input
+ *
+ * For plain files, \c data is the file itself. For archive
+ * sub-files, it is the output of libdeflate, which serves
+ * as the reference for all other decoders.
+ */
+struct BenchInput {
+  std::string name;
+  std::vector<char> data;
+  std::vector<char> compressed;
+  std::vector<GDeflatePage> pages;
+};
+
+
+using BenchProc = std::function<bool (const BenchInput&, std::vector<char>&)>;
+
+
+int printHelp() {
+  std::cout << "Usage: gdeflatebench [-n iterations] [-s size] [-a archive]... [file]..." << std::endl << std::endl
+            << "Compresses each file with GDeflate and measures decoding throughput" << std::endl
+            << "of libdeflate as well as each supported built-in page decoder." << std::endl << std::endl
+            << "For archives passed with -a, all GDeflate sub-files are decoded with" << std::endl
+            << "libdeflate, and the output of every built-in decoder is compared to" << std::endl
+            << "that byte by byte. Exits with an error if any decoder disagrees." << std::endl << std::endl
+            << "With -s, files are also split into sub-files of the given size, and" << std::endl
+            << "decoding them with cached codec contexts is compared to allocating" << std::endl
+            << "a libdeflate decompressor for every sub-file." << std::endl;
+  return 0;
+}
+
+
+bool parsePages(BenchInput& input) {
+  RdMemoryView view(input.compressed);
+  RdStream reader(view);
+
+  GDeflateHeader header = { };
+
+  if (!reader.read(header))
+    return false;
+
+  input.pages.resize(header.workgroupCountX);
+
+  if (!reader.read(input.pages))
+    return false;
+
+  for (const auto& page : input.pages) {
+    if (page.pageOffset > input.compressed.size()
+     || page.pageSize > input.compressed.size() - page.pageOffset)
+      return false;
+  }
+
+  return true;
+}
+
+
+bool decodeLibdeflate(const BenchInput& input, std::vector<char>& output) {
+  static thread_local libdeflate_gdeflate_decompressor* s_decompressor =
+    libdeflate_alloc_gdeflate_decompressor();
+
+  std::vector<libdeflate_gdeflate_in_page> pages(input.pages.size());
+
+  for (size_t i = 0; i < pages.size(); i++) {
+    pages[i].data = &input.compressed[input.pages[i].pageOffset];
+    pages[i].nbytes = input.pages[i].pageSize;
+  }
+
+  return libdeflate_gdeflate_decompress(s_decompressor, pages.data(), pages.size(),
+    output.data(), output.size(), nullptr) == LIBDEFLATE_SUCCESS;
+}
+
+
+bool decodePages(const BenchInput& input, std::vector<char>& output, GDeflateDecoder decoder) {
+  if (output.size() > input.pages.size() * GDeflatePageSize)
+    return false;
+
+  for (size_t i = 0; i < input.pages.size(); i++) {
+    size_t offset = i * GDeflatePageSize;
+
+    if (offset >= output.size())
+      return false;
+
+    size_t size = std::min(GDeflatePageSize, output.size() - offset);
+
+    if (!gdeflateDecodePage(decoder, WrMemoryView(&output[offset], size),
+        RdMemoryView(&input.compressed[input.pages[i].pageOffset], input.pages[i].pageSize)))
+      return false;
+  }
+
+  return true;
+}
+
+
+bool loadFile(const std::string& path, BenchInput& input) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+  if (!file) {
+    std::cerr << "Failed to open " << path << std::endl;
+    return false;
+  }
+
+  input.name = path;
+  input.data.resize(file.tellg());
+
+  file.seekg(0);
+
+  if (!file.read(input.data.data(), input.data.size())) {
+    std::cerr << "Failed to read " << path << std::endl;
+    return false;
+  }
+
+  WrVectorStream stream(input.compressed);
+
+  if (!gdeflateEncode(stream, input.data)) {
+    std::cerr << "Failed to compress " << path << std::endl;
+    return false;
+  }
+
+  stream.flush();
+  return parsePages(input);
+}
+
+
+bool splitFile(const BenchInput& file, size_t size, std::vector<BenchInput>& deflateInputs, std::vector<BenchInput>& gdeflateInputs) {
+  for (size_t offset = 0; offset < file.data.size(); offset += size) {
+    BenchInput input;
+    input.name = file.name + "@" + std::to_string(offset);
+    input.data.assign(file.data.begin() + offset,
+      file.data.begin() + std::min(offset + size, file.data.size()));
+
+    BenchInput deflateInput = input;
+    WrVectorStream deflateStream(deflateInput.compressed);
+
+    if (!deflateEncode(deflateStream, deflateInput.data) || !deflateStream.flush())
+      return false;
+
+    WrVectorStream gdeflateStream(input.compressed);
+
+    if (!gdeflateEncode(gdeflateStream, input.data) || !gdeflateStream.flush() || !parsePages(input))
+      return false;
+
+    deflateInputs.push_back(std::move(deflateInput));
+    gdeflateInputs.push_back(std::move(input));
+  }
+
+  return true;
+}
+
+
+bool loadArchive(const Io& io, const std::string& path, std::vector<BenchInput>& inputs) {
+  auto archive = IoArchive::fromFile(io->open(path, IoOpenMode::eRead));
+
+  if (!archive || !(*archive)) {
+    std::cerr << "Failed to open archive " << path << std::endl;
+    return false;
+  }
+
+  for (uint32_t i = 0; i < archive->getFileCount(); i++) {
+    auto file = archive->getFile(i);
+
+    for (uint32_t j = 0; j < file->getSubFileCount(); j++) {
+      auto subFile = file->getSubFile(j);
+
+      if (subFile->getCompressionType() != IoArchiveCompression::eGDeflate || !subFile->getSize())
+        continue;
+
+      BenchInput input;
+      input.name = std::string(file->getName()) + ":" + subFile->getIdentifier().toString();
+      input.compressed.resize(subFile->getCompressedSize());
+      input.data.resize(subFile->getSize());
+
+      if (subFile->readCompressed(input.compressed.data()) != IoStatus::eSuccess) {
+        std::cerr << "Failed to read " << input.name << std::endl;
+        return false;
+      }
+
+      if (!parsePages(input) || !decodeLibdeflate(input, input.data)) {
+        std::cerr << "libdeflate failed to decode " << input.name << std::endl;
+        return false;
+      }
+
+      inputs.push_back(std::move(input));
+    }
+  }
+
+  return true;
+}
+
+
+bool runBenchmark(
+  const std::vector<BenchInput>&        inputs,
+  const char*                           name,
+        uint32_t                        iterations,
+  const BenchProc&                      proc) {
+  std::vector<std::vector<char>> outputs(inputs.size());
+  size_t totalSize = 0;
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    outputs[i].resize(inputs[i].data.size());
+    totalSize += inputs[i].data.size();
+  }
+
+  double best = 0.0;
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    for (auto& output : outputs)
+      std::memset(output.data(), 0, output.size());
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    size_t decoded = 0;
+
+    while (decoded < inputs.size() && proc(inputs[decoded], outputs[decoded]))
+      decoded++;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    for (size_t j = 0; j < inputs.size(); j++) {
+      if (j >= decoded || outputs[j] != inputs[j].data) {
+        std::cout << "  " << std::setw(14) << std::left << name << "failed on "
+                  << inputs[j].name << std::endl;
+        return false;
+      }
+    }
+
+    double seconds = std::chrono::duration<double>(t1 - t0).count();
+
+    if (!i || seconds < best)
+      best = seconds;
+  }
+
+  double mibs = double(totalSize) / (best * double(1u << 20));
+  double us = 1000000.0 * best / double(std::max<size_t>(inputs.size(), 1u));
+
+  std::cout << "  " << std::setw(14) << std::left << name
+            << std::setw(10) << std::right << std::fixed << std::setprecision(1) << mibs
+            << " MiB/s" << std::setw(10) << std::setprecision(3) << us << " us per input" << std::endl;
+  return true;
+}
+
+
+bool runBenchmarks(
+  const Jobs&                           jobs,
+  const std::vector<BenchInput>&        inputs,
+        uint32_t                        iterations) {
+  bool success = true;
+
+  success &= runBenchmark(inputs, "libdeflate", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      return decodeLibdeflate(input, output);
+    });
+
+  success &= runBenchmark(inputs, "scalar", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      return decodePages(input, output, GDeflateDecoder::eScalar);
+    });
+
+  if (gdeflateIsDecoderSupported(GDeflateDecoder::eAvx2)) {
+    success &= runBenchmark(inputs, "avx2", iterations,
+      [&] (const BenchInput& input, std::vector<char>& output) {
+        return decodePages(input, output, GDeflateDecoder::eAvx2);
+      });
+  }
+
+  success &= runBenchmark(inputs, "jobs", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      return gdeflateDecode(jobs, output, input.compressed);
+    });
+
+  gdeflateSetBuiltinDecoderEnabled(true);
+
+  success &= runBenchmark(inputs, "jobs-builtin", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      return gdeflateDecode(jobs, output, input.compressed);
+    });
+
+  gdeflateSetBuiltinDecoderEnabled(false);
+  return success;
+}
+
+
+bool runSmallFileBenchmarks(
+  const std::vector<BenchInput>&        deflateInputs,
+  const std::vector<BenchInput>&        gdeflateInputs,
+        uint32_t                        iterations) {
+  bool success = true;
+
+  // Allocating and freeing a decompressor per call is what
+  // the decode functions did before contexts were cached
+  success &= runBenchmark(deflateInputs, "deflate-alloc", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      auto* decompressor = libdeflate_alloc_decompressor();
+
+      auto status = libdeflate_deflate_decompress(decompressor,
+        input.compressed.data(), input.compressed.size(),
+        output.data(), output.size(), nullptr);
+
+      libdeflate_free_decompressor(decompressor);
+      return status == LIBDEFLATE_SUCCESS;
+    });
+
+  success &= runBenchmark(deflateInputs, "deflate", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      return deflateDecode(output, input.compressed);
+    });
+
+  success &= runBenchmark(gdeflateInputs, "gdeflate-alloc", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      auto* decompressor = libdeflate_alloc_gdeflate_decompressor();
+
+      std::vector<libdeflate_gdeflate_in_page> pages(input.pages.size());
+
+      for (size_t i = 0; i < pages.size(); i++) {
+        pages[i].data = &input.compressed[input.pages[i].pageOffset];
+        pages[i].nbytes = input.pages[i].pageSize;
+      }
+
+      auto status = libdeflate_gdeflate_decompress(decompressor,
+        pages.data(), pages.size(), output.data(), output.size(), nullptr);
+
+      libdeflate_free_gdeflate_decompressor(decompressor);
+      return status == LIBDEFLATE_SUCCESS;
+    });
+
+  success &= runBenchmark(gdeflateInputs, "gdeflate", iterations,
+    [&] (const BenchInput& input, std::vector<char>& output) {
+      return gdeflateDecode(output, input.compressed);
+    });
+
+  return success;
+}
+
+
+int main(int argc, char** argv) {
+  Log::setLogLevel(LogSeverity::eError);
+
+  Io io(IoBackend::eDefault, 1);
+  Jobs jobs(std::thread::hardware_concurrency());
+
+  uint32_t iterations = 10;
+  size_t subFileSize = 0;
+  std::vector<std::string> files;
+  std::vector<std::string> archives;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "-h" || arg == "--help") {
+      return printHelp();
+    } else if (arg == "-n" && i + 1 < argc) {
+      try {
+        iterations = std::max(1ul, std::stoul(argv[++i]));
+      } catch (const std::exception&) {
+        std::cerr << "Invalid iteration count: " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (arg == "-s" && i + 1 < argc) {
+      try {
+        subFileSize = std::stoul(argv[++i]);
+      } catch (const std::exception&) {
+        subFileSize = 0;
+      }
+
+      if (!subFileSize) {
+        std::cerr << "Invalid sub-file size: " << argv[i] << std::endl;
+        return 1;
+      }
+    } else if (arg == "-a" && i + 1 < argc) {
+      archives.push_back(argv[++i]);
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (files.empty() && archives.empty())
+    return printHelp();
+
+  bool success = true;
+
+  for (const auto& file : files) {
+    std::vector<BenchInput> inputs(1);
+
+    if (!loadFile(file, inputs[0]))
+      return 1;
+
+    std::cout << file << ": " << inputs[0].data.size() << " bytes, "
+              << inputs[0].compressed.size() << " compressed, "
+              << inputs[0].pages.size() << " pages" << std::endl;
+
+    success &= runBenchmarks(jobs, inputs, iterations);
+
+    if (subFileSize) {
+      std::vector<BenchInput> deflateInputs;
+      std::vector<BenchInput> gdeflateInputs;
+
+      if (!splitFile(inputs[0], subFileSize, deflateInputs, gdeflateInputs)) {
+        std::cerr << "Failed to compress sub-files of " << file << std::endl;
+        return 1;
+      }
+
+      std::cout << file << ": " << gdeflateInputs.size() << " sub-files of "
+                << subFileSize << " bytes" << std::endl;
+
+      success &= runSmallFileBenchmarks(deflateInputs, gdeflateInputs, iterations);
+    }
+  }
+
+  for (const auto& archive : archives) {
+    std::vector<BenchInput> inputs;
+
+    if (!loadArchive(io, archive, inputs))
+      return 1;
+
+    size_t rawSize = 0;
+    size_t compressedSize = 0;
+
+    for (const auto& input : inputs) {
+      rawSize += input.data.size();
+      compressedSize += input.compressed.size();
+    }
+
+    std::cout << archive << ": " << inputs.size() << " GDeflate sub-files, "
+              << rawSize << " bytes, " << compressedSize << " compressed" << std::endl;
+
+    success &= runBenchmarks(jobs, inputs, iterations);
+  }
+
+  return success ? 0 : 1;
+}
@@ -1,9 +1,95 @@
+#include <algorithm>
+
 #include "../../src/util/util_deflate.h"
+#include "../../src/util/util_lz4.h"
+#include "../../src/util/util_math.h"
+#include "../../src/util/util_zstd.h"
 
 #include "archive.h"
+#include "cache.h"
 
 namespace as::archive {
 
+bool compressArchiveData(
+        ArchiveData&                    output,
+        RdMemoryView                    input,
+        IoArchiveCompression            compression) {
+  output.clear();
+
+  switch (compression) {
+    case IoArchiveCompression::eNone:
+      output.resize(input.getSize());
+      return input.read(output.data(), output.size());
+
+    case IoArchiveCompression::eDeflate:
+      return deflateEncode(Lwrap<WrVectorStream>(output), input);
+
+    case IoArchiveCompression::eGDeflate:
+      return gdeflateEncode(Lwrap<WrVectorStream>(output), input);
+
+    case IoArchiveCompression::eLz4:
+      return lz4Encode(Lwrap<WrVectorStream>(output), input, Lz4DefaultLevel);
+
+    case IoArchiveCompression::eZstd:
+      return zstdEncode(Lwrap<WrVectorStream>(output), input, ZstdDefaultLevel);
+  }
+
+  return false;
+}
+
+
+bool compressArchiveData(
+        ArchiveData&                    output,
+        IoArchiveCompression&           compression,
+        RdMemoryView                    input,
+        ArchiveCompressionPolicy        policy) {
+  bool hasLz4 = lz4IsSupported();
+  bool hasZstd = zstdIsSupported();
+
+  switch (policy) {
+    case ArchiveCompressionPolicy::eDeflate:
+      compression = IoArchiveCompression::eDeflate;
+      break;
+
+    case ArchiveCompressionPolicy::eSpeed:
+      compression = hasLz4 ? IoArchiveCompression::eLz4 : IoArchiveCompression::eDeflate;
+      break;
+
+    case ArchiveCompressionPolicy::eRatio:
+      compression = hasZstd ? IoArchiveCompression::eZstd : IoArchiveCompression::eDeflate;
+      break;
+
+    case ArchiveCompressionPolicy::eBalanced: {
+      if (!hasLz4 || !hasZstd) {
+        compression = hasZstd ? IoArchiveCompression::eZstd
+          : (hasLz4 ? IoArchiveCompression::eLz4 : IoArchiveCompression::eDeflate);
+        break;
+      }
+
+      // Zstandard decodes several times slower than LZ4, so
+      // only use it if it saves at least an eighth of the size
+      ArchiveData lz4Data;
+
+      if (!compressArchiveData(lz4Data, input, IoArchiveCompression::eLz4)
+       || !compressArchiveData(output, input, IoArchiveCompression::eZstd))
+        return false;
+
+      compression = IoArchiveCompression::eZstd;
+
+      if (output.size() + output.size() / 8u > lz4Data.size()) {
+        compression = IoArchiveCompression::eLz4;
+        output = std::move(lz4Data);
+      }
+
+      return true;
+    }
+  }
+
+  return compressArchiveData(output, input, compression);
+}
+
+
+
 ArchiveFile::ArchiveFile() {
 
 }
@@ -32,7 +118,8 @@ bool ArchiveFile::addSubFile(
           FourCC                        identifier,
           IoArchiveCompression          compression,
           size_t                        rawSize,
-          ArchiveData&&                 compressedData) {
+          ArchiveData&&                 compressedData,
+          uint64_t                      layoutKey) {
   if (compression == IoArchiveCompression::eNone && rawSize != compressedData.size())
     return false;
 
@@ -41,6 +128,7 @@ bool ArchiveFile::addSubFile(
   item.compression = compression;
   item.rawSize = rawSize;
   item.compressedData = std::move(compressedData);
+  item.layoutKey = layoutKey;
 
   return true;
 }
@@ -70,7 +158,8 @@ void ArchiveFile::getSubFileMetadata(
         uint64_t&                     dataOffset,
         size_t                        entryCount,
         IoArchiveSubFileMetadata*     metadata,
-  const void**                        subFileData) const {
+  const void**                        subFileData,
+        uint64_t*                     layoutKeys) const {
   size_t entry = 0;
 
   for (const auto& subFile : m_subFiles) {
@@ -92,6 +181,9 @@ void ArchiveFile::getSubFileMetadata(
     if (subFileData)
       subFileData[entry] = subFile.compressedData.data();
 
+    if (layoutKeys)
+      layoutKeys[entry] = subFile.layoutKey;
+
     entry += 1;
   }
 }
@@ -104,27 +196,65 @@ BuildJob::~BuildJob() {
 }
 
 
+bool BuildJob::getCacheKey(
+        BuildCacheKey&                key) const {
+  return false;
+}
+
+
 
 
 ArchiveStreams::ArchiveStreams(
-        Environment                   environment)
-: m_environment(std::move(environment)) {
+        Environment                   environment,
+  const ArchiveLayoutDesc&            layout)
+: m_environment (std::move(environment))
+, m_layout      (layout) {
 
 }
 
 
 ArchiveStreams::~ArchiveStreams() {
+  if (!m_spillPath.empty()) {
+    m_spillStream.reset();
+    m_spillFile = IoFile();
+
+    std::error_code ec;
+    std::filesystem::remove(m_spillPath, ec);
+  }
+}
+
 
+bool ArchiveStreams::setSpillFile(
+  const std::filesystem::path&        path) {
+  m_spillPath = path;
+  m_spillFile = m_environment.io->open(path, IoOpenMode::eCreate);
+
+  if (!m_spillFile) {
+    Log::err("Failed to create spill file ", path);
+    return false;
+  }
+
+  m_spillStream = std::make_unique<WrAsyncFileStream>(
+    m_environment.io, m_spillFile, WrAsyncFileStreamDesc());
+  return true;
 }
 
 
 void ArchiveStreams::addFile(
-    const ArchiveFile&                  file) {
+    const ArchiveFile&                  file,
+          uint32_t                      layoutGroup) {
   auto& fileMetadata = m_fileMetadata.emplace_back();
   const void* fileInlineData = nullptr;
 
   file.getFileMetadata(&fileMetadata, &fileInlineData);
-  m_fileInlineData.push_back(fileInlineData);
+
+  // Always copy inline data since it is small, and the
+  // file object may not outlive this object in spill mode
+  size_t fileInlineOffset = m_fileInlineData.size();
+  m_fileInlineData.resize(fileInlineOffset + fileMetadata.inlineDataSize);
+
+  if (fileMetadata.inlineDataSize)
+    std::memcpy(&m_fileInlineData[fileInlineOffset], fileInlineData, fileMetadata.inlineDataSize);
 
   size_t fileNameOffset = m_fileNames.size();
   m_fileNames.resize(fileNameOffset + fileMetadata.nameLength);
@@ -133,84 +263,467 @@ void ArchiveStreams::addFile(
   size_t subFileIndex = m_subFileMetadata.size();
   m_subFileMetadata.resize(subFileIndex + fileMetadata.subFileCount);
   m_subFileData.resize(subFileIndex + fileMetadata.subFileCount);
+  m_subFileLayout.resize(subFileIndex + fileMetadata.subFileCount);
+  m_subFileSpillOffsets.resize(subFileIndex + fileMetadata.subFileCount);
+
+  if (!fileMetadata.subFileCount)
+    return;
+
+  // Data offsets are assigned when writing the file
+  uint64_t dataOffset = 0;
+
+  std::vector<uint64_t> layoutKeys(fileMetadata.subFileCount);
+
+  file.getSubFileMetadata(dataOffset, fileMetadata.subFileCount,
+    &m_subFileMetadata[subFileIndex], &m_subFileData[subFileIndex],
+    layoutKeys.data());
+
+  // Make sub-files with identical contents point to the same data
+  // source, so that the payload only gets written to the file once.
+  // If the data of the first copy was already spilled to disk, we
+  // rely on the hash and metadata to identify duplicates.
+  for (size_t i = subFileIndex; i < m_subFileMetadata.size(); i++) {
+    auto& subFile = m_subFileMetadata[i];
+
+    auto& layout = m_subFileLayout[i];
+    layout.group = layoutGroup;
+    layout.key = layoutKeys[i - subFileIndex];
+    layout.source = i;
+
+    if (!subFile.compressedSize)
+      continue;
+
+    UniqueHash hash = UniqueHash::compute(subFile.compressedSize, m_subFileData[i]);
+    auto entry = m_subFileLookup.emplace(hash, i);
+
+    if (!entry.second) {
+      const auto& other = m_subFileMetadata[entry.first->second];
+
+      if (other.compression == subFile.compression
+       && other.compressedSize == subFile.compressedSize
+       && other.rawSize == subFile.rawSize
+       && (!m_subFileData[entry.first->second]
+        || !std::memcmp(m_subFileData[entry.first->second], m_subFileData[i], subFile.compressedSize))) {
+        layout.source = entry.first->second;
+        m_subFileDedupSize += subFile.compressedSize;
+      }
+    }
 
-  if (fileMetadata.subFileCount) {
-    file.getSubFileMetadata(m_subFileDataOffset, fileMetadata.subFileCount,
-      &m_subFileMetadata[subFileIndex], &m_subFileData[subFileIndex]);
+    if (m_spillStream) {
+      if (layout.source == i) {
+        m_subFileSpillOffsets[i] = m_spillStream->getSize();
+        m_spillError |= !m_spillStream->write(m_subFileData[i], subFile.compressedSize);
+      }
+
+      m_subFileData[i] = nullptr;
+    }
   }
 }
 
 
 BuildResult ArchiveStreams::write(
-        std::filesystem::path         path) const {
-  WrFileStream file(m_environment.io->open(path, IoOpenMode::eCreate));
+        std::filesystem::path         path) {
+  // Finish writing spilled data, and make sure that it
+  // is visible to reads before we start reading it back
+  if (m_spillStream) {
+    bool success = !m_spillError && m_spillStream->flush();
+    m_spillStream.reset();
+
+    if (!success || m_spillFile->sync() != IoStatus::eSuccess) {
+      Log::err("Failed to write spill file ", m_spillPath);
+      return BuildResult::eIoError;
+    }
 
-  if (!file)
+    m_spillFile = m_environment.io->open(m_spillPath, IoOpenMode::eRead);
+
+    if (!m_spillFile) {
+      Log::err("Failed to open spill file ", m_spillPath);
+      return BuildResult::eIoError;
+    }
+  }
+
+  // Order and align sub-file data first since the sub-file
+  // table needs to contain the final data offsets
+  std::vector<IoArchiveSubFileMetadata> subFileMetadata = m_subFileMetadata;
+  std::vector<size_t> subFileOrder;
+
+  uint64_t subFileDataSize = computeSubFileLayout(subFileMetadata, subFileOrder);
+
+  // Accumulate file, name and sub-file tables as well as
+  // the name table in a single uncompressed blob
+  std::vector<char> metadata;
+
+  if (!getMetadataBlob(Lwrap<WrVectorStream>(metadata), subFileMetadata)
+   || !getNameTable(Lwrap<WrVectorStream>(metadata)))
     return BuildResult::eIoError;
 
-  WrStream stream(file);
+  // Compress inline data in pages that can be loaded on demand
+  std::vector<IoArchiveInlinePage> pages;
+  std::vector<char> pageData;
+
+  if (!getInlinePages(pages, pageData))
+    return BuildResult::eIoError;
+
+  // Page data is stored right after the metadata blob, which
+  // in turn ends with the page table, so fix up the offsets
+  IoArchiveInlinePageTableHeader pageTable = { };
+  pageTable.pageSize = InlinePageSize;
+  pageTable.pageCount = uint32_t(pages.size());
 
-  // Accumulate metadata, including inline file
-  // data, in a single uncompressed blob
-  std::vector<char> rawMetadata;
+  uint64_t pageDataOffset = sizeof(IoArchiveHeader) + metadata.size()
+    + sizeof(pageTable) + sizeof(IoArchiveInlinePage) * pages.size();
 
-  if (!getMetadataBlob(Lwrap<WrVectorStream>(rawMetadata)))
+  for (auto& page : pages)
+    page.offset += pageDataOffset;
+
+  WrVectorStream metadataStream(metadata);
+  WrStream metadataWriter(metadataStream);
+
+  if (!metadataWriter.write(pageTable)
+   || !metadataWriter.write(pages)
+   || !metadataWriter.flush())
     return BuildResult::eIoError;
 
-  // Compress the metadata blob
-  std::vector<char> compressedMetadata;
+  // Sub-file data starts at an aligned offset as well, so that
+  // the alignment of individual sub-files is preserved
+  uint64_t headerSize = sizeof(IoArchiveHeader) + metadata.size() + pageData.size();
+  uint64_t subFileDataOffset = align<uint64_t>(headerSize, std::max(m_layout.subFileAlignment, 1u));
+
+  // We know the exact file size at this point, so let the
+  // file system reserve storage before writing anything
+  WrAsyncFileStreamDesc fileDesc;
+  fileDesc.allocationSize = subFileDataOffset + subFileDataSize;
 
-  if (!deflateEncode(Lwrap<WrVectorStream>(compressedMetadata), rawMetadata))
+  WrAsyncFileStream file(m_environment.io,
+    m_environment.io->open(path, IoOpenMode::eCreate), fileDesc);
+
+  if (!file)
     return BuildResult::eIoError;
 
+  WrStream stream(file);
+
   // Write file header
   IoArchiveHeader header = { };
   std::memcpy(header.magic, "ASFILE", sizeof(header.magic));
+  header.version = 2;
   header.fileCount = m_fileMetadata.size();
-  header.fileOffset = sizeof(header) + compressedMetadata.size();
-  header.compressedMetadataSize = compressedMetadata.size();
-  header.rawMetadataSize = rawMetadata.size();
+  header.fileOffset = subFileDataOffset;
+  header.compressedMetadataSize = metadata.size();
+  header.rawMetadataSize = metadata.size();
+
+  std::vector<char> padding(m_layout.subFileAlignment);
 
   if (!stream.write(header)
-   || !stream.write(compressedMetadata))
+   || !stream.write(metadata)
+   || !stream.write(pageData)
+   || !stream.write(padding.data(), subFileDataOffset - headerSize))
     return BuildResult::eIoError;
 
-  // Append sub-file data in order
-  for (size_t i = 0; i < m_subFileMetadata.size(); i++) {
-    if (!m_subFileMetadata[i].compressedSize)
-      continue;
-
-    if (!stream.write(m_subFileData[i], m_subFileMetadata[i].compressedSize))
+  // Append sub-file data in layout order. Sub-file offsets
+  // are relative to the start of the sub-file data region.
+  if (m_spillFile) {
+    if (!writeSpilledData(stream, subFileMetadata, subFileOrder))
       return BuildResult::eIoError;
+  } else {
+    uint64_t dataOffset = 0;
+
+    for (size_t i : subFileOrder) {
+      const auto& subFile = subFileMetadata[i];
+
+      if (!stream.write(padding.data(), subFile.offset - dataOffset)
+       || !stream.write(m_subFileData[i], subFile.compressedSize))
+        return BuildResult::eIoError;
+
+      dataOffset = subFile.offset + subFile.compressedSize;
+    }
   }
 
   if (!stream.flush())
     return BuildResult::eIoError;
 
+  if (m_subFileDedupSize) {
+    Log::info("Deduplicated ", m_subFileDedupSize >> 10,
+      " kiB of sub-file data in ", path);
+  }
+
   return BuildResult::eSuccess;
 }
 
 
+uint64_t ArchiveStreams::computeSubFileLayout(
+        std::vector<IoArchiveSubFileMetadata>& metadata,
+        std::vector<size_t>&          dataOrder) const {
+  // Gather all sub-files that own their data and order them by
+  // layout group, then by layout key. Ties are broken by order
+  // of insertion so that the layout is deterministic.
+  dataOrder.clear();
+
+  for (size_t i = 0; i < metadata.size(); i++) {
+    if (m_subFileLayout[i].source == i && metadata[i].compressedSize)
+      dataOrder.push_back(i);
+  }
+
+  std::sort(dataOrder.begin(), dataOrder.end(), [this] (size_t a, size_t b) {
+    const auto& aLayout = m_subFileLayout[a];
+    const auto& bLayout = m_subFileLayout[b];
+
+    if (aLayout.group != bLayout.group)
+      return aLayout.group < bLayout.group;
+
+    if (aLayout.key != bLayout.key)
+      return aLayout.key < bLayout.key;
+
+    return a < b;
+  });
+
+  // Align sub-files that are at least as large as the alignment to
+  // the next boundary, and move smaller ones to the next boundary
+  // only if they would otherwise straddle it. This way, reading any
+  // sub-file touches the minimum number of blocks without wasting
+  // too much space on archives with many small sub-files.
+  uint64_t alignment = std::max(m_layout.subFileAlignment, 1u);
+  uint64_t dataOffset = 0;
+
+  for (size_t i : dataOrder) {
+    uint64_t size = metadata[i].compressedSize;
+
+    if (size >= alignment || (dataOffset & (alignment - 1)) + size > alignment)
+      dataOffset = align(dataOffset, alignment);
+
+    metadata[i].offset = dataOffset;
+    dataOffset += size;
+  }
+
+  // Resolve offsets of deduplicated and empty sub-files
+  for (size_t i = 0; i < metadata.size(); i++) {
+    if (!metadata[i].compressedSize)
+      metadata[i].offset = 0;
+    else if (m_subFileLayout[i].source != i)
+      metadata[i].offset = metadata[m_subFileLayout[i].source].offset;
+  }
+
+  return dataOffset;
+}
+
+
 bool ArchiveStreams::getMetadataBlob(
-        WrVectorStream&               stream) const {
+        WrVectorStream&               stream,
+  const std::vector<IoArchiveSubFileMetadata>& subFileMetadata) const {
   WrStream metadataWriter(stream);
 
-  // Write basic file metadata
+  // Write basic file metadata. Inline data is stored separately.
   if (!metadataWriter.write(m_fileMetadata)
    || !metadataWriter.write(m_fileNames)
-   || !metadataWriter.write(m_subFileMetadata))
+   || !metadataWriter.write(subFileMetadata))
     return false;
 
-  // Write inline data
+  return metadataWriter.flush();
+}
+
+
+bool ArchiveStreams::getNameTable(
+        WrVectorStream&               stream) const {
+  // Maximum number of seeds to try per bucket before giving up
+  constexpr uint32_t MaxSeed = 1u << 24;
+
+  // Compute name hashes for all named files
+  std::vector<std::pair<uint64_t, uint32_t>> names;
+  names.reserve(m_fileMetadata.size());
+
+  size_t nameOffset = 0;
+
   for (size_t i = 0; i < m_fileMetadata.size(); i++) {
-    if (!m_fileMetadata[i].inlineDataSize)
-      continue;
+    uint32_t nameLength = m_fileMetadata[i].nameLength;
+
+    if (nameLength) {
+      uint64_t hash = computeArchiveNameHash(&m_fileNames[nameOffset], nameLength - 1);
+      names.push_back(std::make_pair(hash, uint32_t(i)));
+    }
+
+    nameOffset += nameLength;
+  }
+
+  IoArchiveNameTableHeader header = { };
+  header.slotCount = uint32_t(names.size());
+  header.bucketCount = std::max(1u, (header.slotCount + 3u) / 4u);
+
+  // Assign names to buckets, and process the largest buckets
+  // first since those are the hardest to find a seed for.
+  std::vector<std::vector<uint32_t>> buckets(header.bucketCount);
+
+  for (uint32_t i = 0; i < names.size(); i++)
+    buckets[computeArchiveNameBucket(names[i].first, header.bucketCount)].push_back(i);
+
+  std::vector<uint32_t> bucketOrder(header.bucketCount);
+
+  for (uint32_t i = 0; i < header.bucketCount; i++)
+    bucketOrder[i] = i;
+
+  std::stable_sort(bucketOrder.begin(), bucketOrder.end(), [&buckets] (uint32_t a, uint32_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  std::vector<uint32_t> seeds(header.bucketCount);
+  std::vector<uint32_t> slots(header.slotCount);
+  std::vector<bool> slotsUsed(header.slotCount);
+
+  std::vector<uint32_t> bucketSlots;
+
+  for (uint32_t b : bucketOrder) {
+    const auto& bucket = buckets[b];
+
+    if (bucket.empty())
+      break;
+
+    bool found = false;
+
+    for (uint32_t seed = 0; seed < MaxSeed && !found; seed++) {
+      bucketSlots.clear();
+      found = true;
+
+      for (uint32_t i = 0; i < bucket.size() && found; i++) {
+        uint32_t slot = computeArchiveNameSlot(names[bucket[i]].first, seed, header.slotCount);
+
+        found = !slotsUsed[slot]
+          && std::find(bucketSlots.begin(), bucketSlots.end(), slot) == bucketSlots.end();
+
+        bucketSlots.push_back(slot);
+      }
+
+      if (found) {
+        for (uint32_t i = 0; i < bucket.size(); i++) {
+          slotsUsed[bucketSlots[i]] = true;
+          slots[bucketSlots[i]] = names[bucket[i]].second;
+        }
+
+        seeds[b] = seed;
+      }
+    }
+
+    if (!found) {
+      // This should only happen with duplicate names. Write an
+      // empty table so that readers fall back to a hash map.
+      Log::warn("Failed to build perfect hash table for file names");
+
+      header.bucketCount = 1;
+      header.slotCount = 0;
+
+      seeds.assign(1, 0u);
+      slots.clear();
+      break;
+    }
+  }
+
+  WrStream writer(stream);
+
+  return writer.write(header)
+      && writer.write(seeds)
+      && writer.write(slots)
+      && writer.flush();
+}
+
+
+bool ArchiveStreams::writeSpilledData(
+        WrStream<WrAsyncFileStream>&  stream,
+  const std::vector<IoArchiveSubFileMetadata>& metadata,
+  const std::vector<size_t>&          dataOrder) {
+  std::vector<char> padding(m_layout.subFileAlignment);
+  std::vector<char> buffer;
+
+  uint64_t dataOffset = 0;
+  size_t batchStart = 0;
+
+  while (batchStart < dataOrder.size()) {
+    // Gather as many sub-files as fit into one batch, but
+    // always at least one so that large sub-files work
+    uint64_t batchSize = 0;
+    size_t batchEnd = batchStart;
+
+    while (batchEnd < dataOrder.size()) {
+      uint64_t size = metadata[dataOrder[batchEnd]].compressedSize;
 
-    if (!metadataWriter.write(m_fileInlineData[i], m_fileMetadata[i].inlineDataSize))
+      if (batchEnd > batchStart && batchSize + size > SpillBatchSize)
+        break;
+
+      batchSize += size;
+      batchEnd += 1;
+    }
+
+    // Read the entire batch with a single request
+    buffer.resize(std::max<uint64_t>(buffer.size(), batchSize));
+
+    IoRequest request = m_environment.io->createRequest();
+    uint64_t bufferOffset = 0;
+
+    for (size_t i = batchStart; i < batchEnd; i++) {
+      size_t index = dataOrder[i];
+      uint64_t size = metadata[index].compressedSize;
+
+      request->read(m_spillFile, m_subFileSpillOffsets[index], size, &buffer[bufferOffset]);
+      bufferOffset += size;
+    }
+
+    if (!m_environment.io->submit(request)
+     || request->wait() != IoStatus::eSuccess) {
+      Log::err("Failed to read spill file ", m_spillPath);
       return false;
+    }
+
+    // Write sub-file data to the archive
+    bufferOffset = 0;
+
+    for (size_t i = batchStart; i < batchEnd; i++) {
+      const auto& subFile = metadata[dataOrder[i]];
+
+      if (!stream.write(padding.data(), subFile.offset - dataOffset)
+       || !stream.write(&buffer[bufferOffset], subFile.compressedSize))
+        return false;
+
+      bufferOffset += subFile.compressedSize;
+      dataOffset = subFile.offset + subFile.compressedSize;
+    }
+
+    batchStart = batchEnd;
   }
 
-  return metadataWriter.flush();
+  return true;
+}
+
+
+bool ArchiveStreams::getInlinePages(
+        std::vector<IoArchiveInlinePage>& pages,
+        std::vector<char>&            pageData) const {
+  const auto& inlineData = m_fileInlineData;
+
+  size_t pageCount = (inlineData.size() + InlinePageSize - 1) / InlinePageSize;
+
+  // Compress all pages in parallel since they are independent
+  std::vector<std::vector<char>> compressedPages(pageCount);
+  std::atomic<bool> success = { true };
+
+  m_environment.jobs->execute<BatchJob>([&] (uint32_t index) {
+    size_t offset = size_t(index) * InlinePageSize;
+    size_t size = std::min<size_t>(InlinePageSize, inlineData.size() - offset);
+
+    if (!deflateEncode(Lwrap<WrVectorStream>(compressedPages[index]), RdMemoryView(&inlineData[offset], size)))
+      success = false;
+  }, uint32_t(pageCount), 1u);
+
+  if (!success)
+    return false;
+
+  // Concatenate compressed pages. Page offsets are
+  // relative to the start of the page data for now.
+  for (size_t i = 0; i < pageCount; i++) {
+    auto& page = pages.emplace_back();
+    page.offset = pageData.size();
+    page.compressedSize = uint32_t(compressedPages[i].size());
+    page.rawSize = uint32_t(std::min<size_t>(InlinePageSize, inlineData.size() - i * InlinePageSize));
+
+    pageData.insert(pageData.end(), compressedPages[i].begin(), compressedPages[i].end());
+  }
+
+  return true;
 }
 
 
@@ -233,22 +746,70 @@ ArchiveBuilder::~ArchiveBuilder() {
 }
 
 
+void ArchiveBuilder::setLayout(
+  const ArchiveLayoutDesc&            layout) {
+  std::unique_lock lock(m_mutex);
+  m_layout = layout;
+}
+
+
+void ArchiveBuilder::setStreaming(
+        bool                          enable) {
+  std::unique_lock lock(m_mutex);
+  m_streaming = enable;
+}
+
+
+void ArchiveBuilder::setCache(
+        std::shared_ptr<BuildCache>   cache) {
+  std::unique_lock lock(m_mutex);
+  m_cache = std::move(cache);
+}
+
+
+void ArchiveBuilder::setLayoutGroup(
+  const std::string&                  name) {
+  std::unique_lock lock(m_mutex);
+  m_layoutGroupName = name;
+}
+
+
+std::string ArchiveBuilder::getLayoutGroup() const {
+  std::unique_lock lock(m_mutex);
+  return m_layoutGroupName;
+}
+
+
 void ArchiveBuilder::addBuildJob(
         std::shared_ptr<BuildJob>     job) {
   std::unique_lock lock(m_mutex);
 
   auto& item = m_buildJobs.emplace();
+  item.layoutGroup = getLayoutGroupIndex();
   item.job = m_environment.jobs->dispatch<SimpleJob>([this,
-    cJob  = std::move(job),
-    cItem = &item
+    cJob   = std::move(job),
+    cItem  = &item,
+    cCache = m_cache
   ] {
     if (m_status.load() != BuildResult::eSuccess) {
       cItem->status.first = BuildResult::eAborted;
       return;
     }
 
+    // Try to pull the job output from the build cache first
+    BuildCacheKey key;
+    bool cacheable = cCache && cJob->getCacheKey(key);
+
+    if (cacheable && cCache->load(key.getHash(), cItem->status.second)) {
+      cItem->status.first = BuildResult::eSuccess;
+      return;
+    }
+
     cItem->status = cJob->build();
 
+    if (cacheable && cItem->status.first == BuildResult::eSuccess)
+      cCache->store(key.getHash(), cItem->status.second);
+
     if (cItem->status.first != BuildResult::eSuccess) {
       auto expected = BuildResult::eSuccess;
       m_status.compare_exchange_strong(expected, cItem->status.first, std::memory_order_release, std::memory_order_relaxed);
@@ -259,12 +820,21 @@ void ArchiveBuilder::addBuildJob(
 
 BuildResult ArchiveBuilder::build(
         std::filesystem::path         path) {
-  ArchiveStreams streams(m_environment);
-
   std::unique_lock lock(m_mutex);
 
+  ArchiveStreams streams(m_environment, m_layout);
+
+  if (m_streaming) {
+    std::filesystem::path spillPath = path;
+    spillPath += ".spill";
+
+    if (!streams.setSpillFile(spillPath))
+      return BuildResult::eIoError;
+  }
+
   // The file objects contain the actual data blobs, so we
-  // must keep them alive at constant memory locations
+  // must keep them alive at constant memory locations,
+  // unless the data gets spilled to disk right away
   std::list<ArchiveFile> files;
 
   while (!m_buildJobs.empty()) {
@@ -276,11 +846,30 @@ BuildResult ArchiveBuilder::build(
       return job.status.first;
     }
 
-    streams.addFile(files.emplace_back(std::move(job.status.second)));
+    if (m_streaming)
+      streams.addFile(job.status.second, job.layoutGroup);
+    else
+      streams.addFile(files.emplace_back(std::move(job.status.second)), job.layoutGroup);
+
     m_buildJobs.pop();
   }
 
   return streams.write(path);
 }
 
+
+uint32_t ArchiveBuilder::getLayoutGroupIndex() {
+  // Group indices are assigned in order of first use, so
+  // that ungrouped files retain the order they were added in
+  if (m_layoutGroupName.empty())
+    return m_layoutGroupCount++;
+
+  auto entry = m_layoutGroups.emplace(m_layoutGroupName, m_layoutGroupCount);
+
+  if (entry.second)
+    m_layoutGroupCount += 1;
+
+  return entry.first->second;
+}
+
 }
@@ -5,12 +5,18 @@
 #include <mutex>
 #include <queue>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "common.h"
 
+#include "../../src/util/util_hash.h"
+
 namespace as::archive {
 
+class BuildCache;
+class BuildCacheKey;
+
 using ArchiveData = std::vector<char>;
 
 /**
@@ -34,9 +40,75 @@ struct ArchiveSubFile {
   size_t rawSize = 0;
   /** Compressed data buffer */
   ArchiveData compressedData;
+  /** Layout key. Within a layout group, sub-files with a lower
+   *  key are stored before sub-files with a higher key. */
+  uint64_t layoutKey = 0;
+};
+
+
+/**
+ * \brief Archive layout properties
+ */
+struct ArchiveLayoutDesc {
+  /** Alignment of sub-file data within the archive, in bytes. Must
+   *  be a power of two. Sub-files that are smaller than this will
+   *  only be aligned if they would otherwise cross a boundary. */
+  uint32_t subFileAlignment = 4096;
+};
+
+
+/**
+ * \brief Compression policy for CPU-decoded sub-files
+ *
+ * Determines which compression type is used for sub-files that
+ * are always decoded on the CPU, such as shader binaries. Data
+ * that may be decoded on the GPU always uses GDeflate. Policies
+ * that require a codec that the library was built without fall
+ * back to DEFLATE.
+ */
+enum class ArchiveCompressionPolicy : uint32_t {
+  /** Use DEFLATE, which is supported by all builds */
+  eDeflate    = 0,
+  /** Optimize for decoding speed using LZ4 */
+  eSpeed      = 1,
+  /** Optimize for compression ratio using Zstandard */
+  eRatio      = 2,
+  /** Compress with both LZ4 and Zstandard, and only use the
+   *  latter if it is significantly smaller. */
+  eBalanced   = 3,
 };
 
 
+/**
+ * \brief Compresses sub-file data with the given type
+ *
+ * \param [out] output Compressed data
+ * \param [in] input Uncompressed data
+ * \param [in] compression Compression type
+ * \returns \c true on success
+ */
+bool compressArchiveData(
+        ArchiveData&                    output,
+        RdMemoryView                    input,
+        IoArchiveCompression            compression);
+
+
+/**
+ * \brief Compresses sub-file data according to a policy
+ *
+ * \param [out] output Compressed data
+ * \param [out] compression Compression type that was used
+ * \param [in] input Uncompressed data
+ * \param [in] policy Compression policy
+ * \returns \c true on success
+ */
+bool compressArchiveData(
+        ArchiveData&                    output,
+        IoArchiveCompression&           compression,
+        RdMemoryView                    input,
+        ArchiveCompressionPolicy        policy);
+
+
 /**
  * \brief Archive file
  *
@@ -75,13 +147,17 @@ public:
    * \param [in] compression Compression type
    * \param [in] rawSize Uncompressed data size
    * \param [in] compressedData Compressed file data
+   * \param [in] layoutKey Layout key. Sub-files that get
+   *    requested first, such as coarse mip levels, should
+   *    use lower keys than the remaining sub-files.
    * \returns \c true on success
    */
   bool addSubFile(
           FourCC                        identifier,
           IoArchiveCompression          compression,
           size_t                        rawSize,
-          ArchiveData&&                 compressedData);
+          ArchiveData&&                 compressedData,
+          uint64_t                      layoutKey);
 
   /**
    * \brief Queries file name
@@ -111,12 +187,14 @@ public:
    *    parameter arrays. Excess items will not be written.
    * \param [out] metadata Sub-file metadata array
    * \param [out] subFileData Sub-file data array
+   * \param [out] layoutKeys Sub-file layout key array
    */
   void getSubFileMetadata(
           uint64_t&                     dataOffset,
           size_t                        entryCount,
           IoArchiveSubFileMetadata*     metadata,
-    const void**                        subFileData) const;
+    const void**                        subFileData,
+          uint64_t*                     layoutKeys) const;
 
 private:
 
@@ -166,6 +244,17 @@ public:
    */
   virtual std::pair<BuildResult, ArchiveFile> build() = 0;
 
+  /**
+   * \brief Computes cache key for the job
+   *
+   * Jobs that support caching must add all parameters and input
+   * files that affect the output of \c build to the key.
+   * \param [out] key Cache key
+   * \returns \c true if the job output can be cached
+   */
+  virtual bool getCacheKey(
+          BuildCacheKey&                key) const;
+
 };
 
 
@@ -175,20 +264,46 @@ public:
  * Provides a simple interface to 
  */
 class ArchiveStreams {
-
+  /** Uncompressed size of inline data pages */
+  constexpr static uint32_t InlinePageSize = 64u << 10;
+  /** Maximum amount of spilled data to read back at once */
+  constexpr static uint64_t SpillBatchSize = 16ull << 20;
 public:
 
   ArchiveStreams(
-          Environment                   environment);
+          Environment                   environment,
+    const ArchiveLayoutDesc&            layout);
 
   ~ArchiveStreams();
 
+  /**
+   * \brief Enables spilling sub-file data to disk
+   *
+   * When enabled, sub-file data is written to the given file
+   * as soon as a file is added, so that the caller can free
+   * the file afterwards and memory usage no longer scales with
+   * the archive size. The data is read back and copied to the
+   * actual archive in \c write, and the spill file is deleted
+   * when the object is destroyed. Must be called before any
+   * files are added.
+   * \param [in] path Path of the temporary spill file
+   * \returns \c true if the spill file could be created
+   */
+  bool setSpillFile(
+    const std::filesystem::path&        path);
+
   /**
    * \brief Adds a file
+   *
    * \param [in] file File info
+   * \param [in] layoutGroup Layout group index. Sub-file data
+   *    is ordered by layout group first, so that the sub-files
+   *    of files that are typically loaded together end up in
+   *    one contiguous region of the archive.
    */
   void addFile(
-    const ArchiveFile&                  file);
+    const ArchiveFile&                  file,
+          uint32_t                      layoutGroup);
 
   /**
    * \brief Writes archive file
@@ -199,23 +314,56 @@ public:
    * \returns Status of the operation
    */
   BuildResult write(
-          std::filesystem::path         path) const;
+          std::filesystem::path         path);
 
 private:
 
+  struct SubFileLayout {
+    uint32_t group;
+    uint64_t key;
+    size_t   source;
+  };
+
   Environment                             m_environment;
+  ArchiveLayoutDesc                       m_layout;
 
   std::vector<IoArchiveFileMetadata>      m_fileMetadata;
-  std::vector<const void*>                m_fileInlineData;
+  std::vector<char>                       m_fileInlineData;
   std::vector<char>                       m_fileNames;
 
-  uint64_t                                m_subFileDataOffset = 0;
   std::vector<IoArchiveSubFileMetadata>   m_subFileMetadata;
   std::vector<const void*>                m_subFileData;
+  std::vector<SubFileLayout>              m_subFileLayout;
+  std::vector<uint64_t>                   m_subFileSpillOffsets;
+
+  std::filesystem::path                   m_spillPath;
+  IoFile                                  m_spillFile;
+  std::unique_ptr<WrAsyncFileStream>      m_spillStream;
+  bool                                    m_spillError = false;
+
+  uint64_t                                m_subFileDedupSize = 0;
+  std::unordered_map<UniqueHash, size_t, HashMemberProc> m_subFileLookup;
+
+  uint64_t computeSubFileLayout(
+          std::vector<IoArchiveSubFileMetadata>& metadata,
+          std::vector<size_t>&          dataOrder) const;
 
   bool getMetadataBlob(
+          WrVectorStream&               stream,
+    const std::vector<IoArchiveSubFileMetadata>& subFileMetadata) const;
+
+  bool getNameTable(
           WrVectorStream&               stream) const;
 
+  bool writeSpilledData(
+          WrStream<WrAsyncFileStream>&  stream,
+    const std::vector<IoArchiveSubFileMetadata>& metadata,
+    const std::vector<size_t>&          dataOrder);
+
+  bool getInlinePages(
+          std::vector<IoArchiveInlinePage>& pages,
+          std::vector<char>&            pageData) const;
+
 };
 
 
@@ -224,6 +372,7 @@ private:
  */
 struct ArchiveBuilderJobInfo {
   std::pair<BuildResult, ArchiveFile> status;
+  uint32_t layoutGroup;
   Job job;
 };
 
@@ -240,10 +389,60 @@ public:
 
   ~ArchiveBuilder();
 
+  /**
+   * \brief Sets archive layout properties
+   *
+   * Must be called before \c build.
+   * \param [in] layout Layout properties
+   */
+  void setLayout(
+    const ArchiveLayoutDesc&            layout);
+
+  /**
+   * \brief Enables streaming mode
+   *
+   * In streaming mode, sub-file data of each completed build
+   * job is spilled to a temporary file next to the output file
+   * right away, so that peak memory usage does not depend on
+   * the total size of the archive.
+   * \param [in] enable Whether to enable streaming mode
+   */
+  void setStreaming(
+          bool                          enable);
+
+  /**
+   * \brief Sets build cache
+   *
+   * Cacheable build jobs that are added afterwards will
+   * first look up their output in the given cache, and
+   * store it there if no cache entry exists.
+   * \param [in] cache Build cache, or \c nullptr
+   */
+  void setCache(
+          std::shared_ptr<BuildCache>   cache);
+
+  /**
+   * \brief Sets layout group for subsequent build jobs
+   *
+   * Files within the same named group are stored next to
+   * each other in the archive. Files added without a group
+   * name are each placed in their own group.
+   * \param [in] name Group name, or empty string
+   */
+  void setLayoutGroup(
+    const std::string&                  name);
+
+  /**
+   * \brief Queries current layout group name
+   * \returns Current layout group name
+   */
+  std::string getLayoutGroup() const;
+
   /**
    * \brief Adds a build job
    *
-   * The job will be dispatched immediately.
+   * The job will be dispatched immediately and will use
+   * the layout group that is currently set.
    * \param [in] job Build job object
    */
   void addBuildJob(
@@ -264,11 +463,21 @@ public:
 private:
 
   Environment                         m_environment;
+  ArchiveLayoutDesc                   m_layout;
+  bool                                m_streaming = false;
+
+  std::shared_ptr<BuildCache>         m_cache;
 
-  std::mutex                          m_mutex;
+  mutable std::mutex                  m_mutex;
   std::atomic<BuildResult>            m_status = { BuildResult::eSuccess };
   std::queue<ArchiveBuilderJobInfo>   m_buildJobs;
 
+  std::string                         m_layoutGroupName;
+  uint32_t                            m_layoutGroupCount = 0;
+  std::unordered_map<std::string, uint32_t> m_layoutGroups;
+
+  uint32_t getLayoutGroupIndex();
+
 };
 
 }
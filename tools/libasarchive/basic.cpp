@@ -42,7 +42,15 @@ std::pair<BuildResult, ArchiveFile> BasicBuildJob::build() {
         } break;
 
         case IoArchiveCompression::eGDeflate: {
-          if (!gdeflateEncode(Lwrap<WrVectorStream>(subFile.compressedData), rawData)) {
+          if (!gdeflateEncode(m_env.jobs, Lwrap<WrVectorStream>(subFile.compressedData), rawData)) {
+            Log::err("Failed to compress binary");
+            result.first = BuildResult::eInvalidInput;
+          }
+        } break;
+
+        case IoArchiveCompression::eLz4:
+        case IoArchiveCompression::eZstd: {
+          if (!compressArchiveData(subFile.compressedData, rawData, subFile.compression)) {
             Log::err("Failed to compress binary");
             result.first = BuildResult::eInvalidInput;
           }
@@ -56,7 +64,8 @@ std::pair<BuildResult, ArchiveFile> BasicBuildJob::build() {
 
   for (auto& subFile : m_desc.subFiles) {
     result.second.addSubFile(subFile.identifier,
-      subFile.compression, subFile.rawSize, std::move(subFile.compressedData));
+      subFile.compression, subFile.rawSize, std::move(subFile.compressedData),
+      subFile.layoutKey);
   }
 
   return result;
@@ -0,0 +1,161 @@
+#include <random>
+
+#include "cache.h"
+#include "merge.h"
+
+namespace as::archive {
+
+BuildCacheKey::BuildCacheKey() {
+  add(BuildCacheVersion);
+}
+
+
+BuildCacheKey::~BuildCacheKey() {
+
+}
+
+
+void BuildCacheKey::add(
+  const std::string&                  string) {
+  // Include the length so that adjacent strings
+  // cannot produce the same key data
+  add(uint64_t(string.size()));
+  add(string.data(), string.size());
+}
+
+
+void BuildCacheKey::add(
+  const void*                         data,
+        size_t                        size) {
+  size_t offset = m_data.size();
+  m_data.resize(offset + size);
+
+  if (size)
+    std::memcpy(&m_data[offset], data, size);
+}
+
+
+bool BuildCacheKey::addFile(
+  const Io&                           io,
+  const std::filesystem::path&        path) {
+  IoFile file = io->open(path, IoOpenMode::eRead);
+
+  if (!file)
+    return false;
+
+  std::vector<char> data(file->getSize());
+
+  if (file->read(0, data.size(), data.data()) != IoStatus::eSuccess)
+    return false;
+
+  add(uint64_t(data.size()));
+  add(UniqueHash::compute(data.size(), data.data()));
+  return true;
+}
+
+
+UniqueHash BuildCacheKey::getHash() const {
+  return UniqueHash::compute(m_data.size(), m_data.data());
+}
+
+
+
+
+BuildCache::BuildCache(
+        Environment                   environment,
+        std::filesystem::path         directory)
+: m_environment (std::move(environment))
+, m_directory   (std::move(directory))
+, m_tempIndex   (std::random_device()()) {
+  std::error_code ec;
+  std::filesystem::create_directories(m_directory, ec);
+
+  if (ec)
+    Log::warn("Failed to create build cache directory ", m_directory);
+}
+
+
+BuildCache::~BuildCache() {
+
+}
+
+
+bool BuildCache::load(
+  const UniqueHash&                   key,
+        ArchiveFile&                  file) {
+  std::filesystem::path path = getPath(key);
+
+  std::error_code ec;
+
+  if (!std::filesystem::exists(path, ec)) {
+    m_missCount += 1;
+    return false;
+  }
+
+  auto archive = IoArchive::fromFile(m_environment.io->open(path, IoOpenMode::eRead));
+
+  if (!(*archive) || archive->getFileCount() != 1) {
+    Log::warn("Invalid build cache entry ", path);
+
+    m_missCount += 1;
+    return false;
+  }
+
+  // Reading the cached file is the same as merging it
+  auto result = MergeBuildJob(m_environment, std::move(archive), 0).build();
+
+  if (result.first != BuildResult::eSuccess) {
+    m_missCount += 1;
+    return false;
+  }
+
+  file = std::move(result.second);
+
+  m_hitCount += 1;
+  return true;
+}
+
+
+bool BuildCache::store(
+  const UniqueHash&                   key,
+  const ArchiveFile&                  file) {
+  std::filesystem::path path = getPath(key);
+  std::filesystem::path tempPath = path;
+  tempPath += strcat(".", m_tempIndex++, ".tmp");
+
+  // Don't waste space on aligning sub-files here, the
+  // layout is recomputed when writing the actual archive
+  ArchiveLayoutDesc layout = { };
+  layout.subFileAlignment = 1;
+
+  ArchiveStreams streams(m_environment, layout);
+  streams.addFile(file, 0);
+
+  std::error_code ec;
+
+  if (streams.write(tempPath) != BuildResult::eSuccess) {
+    Log::warn("Failed to write build cache entry ", tempPath);
+
+    std::filesystem::remove(tempPath, ec);
+    return false;
+  }
+
+  std::filesystem::rename(tempPath, path, ec);
+
+  if (ec) {
+    Log::warn("Failed to write build cache entry ", path);
+
+    std::filesystem::remove(tempPath, ec);
+    return false;
+  }
+
+  return true;
+}
+
+
+std::filesystem::path BuildCache::getPath(
+  const UniqueHash&                   key) const {
+  return m_directory / strcat(key.toString(), ".asa");
+}
+
+}
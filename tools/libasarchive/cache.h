@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "archive.h"
+
+namespace as::archive {
+
+/**
+ * \brief Build cache version
+ *
+ * Part of every cache key. Must be incremented whenever the
+ * output of any cacheable build job changes for identical
+ * inputs, so that stale cache entries are no longer used.
+ */
+constexpr uint32_t BuildCacheVersion = 1;
+
+
+/**
+ * \brief Build cache key
+ *
+ * Accumulates all parameters and input file contents that
+ * affect the output of a build job, and computes a hash
+ * that uniquely identifies the resulting archive file.
+ */
+class BuildCacheKey {
+
+public:
+
+  BuildCacheKey();
+
+  ~BuildCacheKey();
+
+  /**
+   * \brief Adds plain value to the key
+   * \param [in] value Value to add
+   */
+  template<typename T, std::enable_if_t<std::is_trivially_copyable_v<T>, bool> = true>
+  void add(const T& value) {
+    add(&value, sizeof(value));
+  }
+
+  /**
+   * \brief Adds string to the key
+   * \param [in] string String to add
+   */
+  void add(
+    const std::string&                  string);
+
+  /**
+   * \brief Adds raw data to the key
+   *
+   * \param [in] data Pointer to data
+   * \param [in] size Number of bytes to add
+   */
+  void add(
+    const void*                         data,
+          size_t                        size);
+
+  /**
+   * \brief Adds input file to the key
+   *
+   * Reads the entire file and adds a hash of its contents.
+   * The file path itself does not contribute to the key.
+   * \param [in] io I/O interface
+   * \param [in] path File path
+   * \returns \c true if the file could be read
+   */
+  bool addFile(
+    const Io&                           io,
+    const std::filesystem::path&        path);
+
+  /**
+   * \brief Computes key hash
+   * \returns Hash of all data added so far
+   */
+  UniqueHash getHash() const;
+
+private:
+
+  std::vector<char> m_data;
+
+};
+
+
+/**
+ * \brief Build cache
+ *
+ * Persistent on-disk cache that stores the output of build
+ * jobs as single-file archives, keyed by the hash of the
+ * job's cache key. Cache entries are never invalidated
+ * explicitly, the directory can safely be deleted instead.
+ */
+class BuildCache {
+
+public:
+
+  /**
+   * \brief Initializes build cache
+   *
+   * Creates the cache directory if necessary.
+   * \param [in] environment Library environment
+   * \param [in] directory Cache directory
+   */
+  BuildCache(
+          Environment                   environment,
+          std::filesystem::path         directory);
+
+  ~BuildCache();
+
+  /**
+   * \brief Looks up cached archive file
+   *
+   * \param [in] key Cache key hash
+   * \param [out] file Archive file
+   * \returns \c true if a valid cache entry was found
+   */
+  bool load(
+    const UniqueHash&                   key,
+          ArchiveFile&                  file);
+
+  /**
+   * \brief Stores archive file in the cache
+   *
+   * Writes to a uniquely named temporary file first and renames
+   * it, so that concurrent or interrupted builds cannot leave
+   * behind partially written cache entries.
+   * \param [in] key Cache key hash
+   * \param [in] file Archive file
+   * \returns \c true on success
+   */
+  bool store(
+    const UniqueHash&                   key,
+    const ArchiveFile&                  file);
+
+  /**
+   * \brief Queries number of cache hits
+   * \returns Number of successful lookups
+   */
+  uint32_t getHitCount() const {
+    return m_hitCount.load();
+  }
+
+  /**
+   * \brief Queries number of cache misses
+   * \returns Number of failed lookups
+   */
+  uint32_t getMissCount() const {
+    return m_missCount.load();
+  }
+
+private:
+
+  Environment           m_environment;
+  std::filesystem::path m_directory;
+
+  std::atomic<uint32_t> m_hitCount  = { 0u };
+  std::atomic<uint32_t> m_missCount = { 0u };
+  std::atomic<uint32_t> m_tempIndex;
+
+  std::filesystem::path getPath(
+    const UniqueHash&                   key) const;
+
+};
+
+}
@@ -1,9 +1,11 @@
+#include <fstream>
 #include <unordered_map>
 
 #include "../../src/gfx/gfx.h"
 
 #include "../../src/util/util_deflate.h"
 
+#include "cache.h"
 #include "geometry.h"
 
 namespace as::archive {
@@ -47,7 +49,7 @@ std::pair<BuildResult, ArchiveFile> GeometryBuildJob::build() {
 
   ArchiveData buffer;
 
-  if (!(gdeflateEncode(Lwrap<WrVectorStream>(buffer), srcBuffer))) {
+  if (!(gdeflateEncode(m_env.jobs, Lwrap<WrVectorStream>(buffer), srcBuffer))) {
     result.first = BuildResult::eIoError;
     return result;
   }
@@ -60,8 +62,69 @@ std::pair<BuildResult, ArchiveFile> GeometryBuildJob::build() {
   result.second = ArchiveFile(FourCC('G', 'E', 'O', 'M'), m_desc.name);
   result.second.setInlineData(std::move(metadata));
   result.second.addSubFile(FourCC('M', 'E', 'T', 'A'),
-    IoArchiveCompression::eGDeflate, srcBuffer.getSize(), std::move(buffer));
+    IoArchiveCompression::eGDeflate, srcBuffer.getSize(), std::move(buffer), 0);
   return result;
 }
 
+
+bool GeometryBuildJob::getCacheKey(
+        BuildCacheKey&                key) const {
+  key.add(FourCC('G', 'E', 'O', 'M'));
+  key.add(m_desc.name);
+
+  if (m_desc.layoutMap) {
+    for (const auto& layout : m_desc.layoutMap->getLayouts()) {
+      auto metadata = layout->getMetadata();
+      key.add(std::string(metadata.name.c_str()));
+      key.add(metadata.attributeCount);
+
+      auto attributes = layout->getAttributes();
+
+      for (auto a = attributes.first; a != attributes.second; a++) {
+        key.add(std::string(a->name.c_str()));
+        key.add(a->dataFormat);
+        key.add(a->stream);
+        key.add(a->morph);
+      }
+    }
+  }
+
+  if (!key.addFile(m_env.io, m_input))
+    return false;
+
+  // External buffers are not part of the GLTF file itself,
+  // so parse the JSON and add any referenced buffer files
+  if (m_input.extension() != ".gltf")
+    return true;
+
+  std::ifstream file(m_input);
+  json j = json::parse(file, nullptr, false);
+
+  if (j.is_discarded())
+    return false;
+
+  if (!j.count("buffers"))
+    return true;
+
+  for (const auto& buffer : j.at("buffers")) {
+    if (!buffer.count("uri"))
+      continue;
+
+    std::string uri = buffer.at("uri").get<std::string>();
+
+    if (uri.starts_with("data:"))
+      continue;
+
+    std::filesystem::path path = uri;
+
+    if (path.is_relative())
+      path = m_input.parent_path() / path;
+
+    if (!key.addFile(m_env.io, path))
+      return false;
+  }
+
+  return true;
+}
+
 }
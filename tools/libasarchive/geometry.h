@@ -33,6 +33,9 @@ public:
 
   std::pair<BuildResult, ArchiveFile> build() override;
 
+  bool getCacheKey(
+          BuildCacheKey&                key) const override;
+
 private:
 
   Environment           m_env;
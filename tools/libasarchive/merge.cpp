@@ -53,11 +53,14 @@ std::pair<BuildResult, ArchiveFile> MergeBuildJob::build() {
       return result;
     }
 
+    // Use the original data offset as the layout key in order to
+    // preserve the layout of the source archive within the group
     result.second.addSubFile(
       subFile->getIdentifier(),
       subFile->getCompressionType(),
       subFile->getSize(),
-      std::move(compressedData));
+      std::move(compressedData),
+      subFile->getOffsetInArchive());
   }
 
   return result;
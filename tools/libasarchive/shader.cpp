@@ -1,5 +1,4 @@
-#include "../../src/util/util_deflate.h"
-
+#include "cache.h"
 #include "shader.h"
 
 namespace as::archive {
@@ -71,10 +70,12 @@ std::pair<BuildResult, ArchiveFile> ShaderBuildJob::build() {
     return result;
   }
 
-  // Compress binary further with deflate
+  // Compress binary further. Shaders are always decoded
+  // on the CPU, so the policy can pick any compression type.
   ArchiveData shaderData;
+  IoArchiveCompression compression = IoArchiveCompression::eNone;
 
-  if (!deflateEncode(Lwrap<WrVectorStream>(shaderData), shaderBinaryData)) {
+  if (!compressArchiveData(shaderData, compression, shaderBinaryData, m_desc.compression)) {
     Log::err("Failed to compress SPIR-V binary");
 
     result.first = BuildResult::eInvalidInput;
@@ -83,11 +84,19 @@ std::pair<BuildResult, ArchiveFile> ShaderBuildJob::build() {
 
   result.second = ArchiveFile(FourCC('S', 'H', 'D', 'R'), m_input.stem());
   result.second.setInlineData(std::move(shaderMetadata));
-  result.second.addSubFile(FourCC('S', 'P', 'I', 'R'),
-    IoArchiveCompression::eDeflate,
-    shaderBinaryData.size(), std::move(shaderData));
+  result.second.addSubFile(FourCC('S', 'P', 'I', 'R'), compression,
+    shaderBinaryData.size(), std::move(shaderData), 0);
 
   return result;
 }
 
+
+bool ShaderBuildJob::getCacheKey(
+        BuildCacheKey&                key) const {
+  key.add(FourCC('S', 'H', 'D', 'R'));
+  key.add(m_desc.compression);
+  key.add(m_input.stem().string());
+  return key.addFile(m_env.io, m_input);
+}
+
 }
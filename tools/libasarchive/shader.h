@@ -8,7 +8,8 @@
 namespace as::archive {
 
 struct ShaderDesc {
-
+  /** Compression policy for the SPIR-V binary */
+  ArchiveCompressionPolicy compression = ArchiveCompressionPolicy::eDeflate;
 };
 
 class ShaderBuildJob : public BuildJob {
@@ -24,6 +25,9 @@ public:
 
   std::pair<BuildResult, ArchiveFile> build() override;
 
+  bool getCacheKey(
+          BuildCacheKey&                key) const override;
+
 private:
 
   Environment           m_env;
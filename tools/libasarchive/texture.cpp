@@ -5,6 +5,7 @@
 
 #include "../../src/util/util_deflate.h"
 
+#include "cache.h"
 #include "texture.h"
 
 namespace as::archive {
@@ -385,8 +386,12 @@ std::pair<BuildResult, ArchiveFile> TextureBuildJob::build() {
         ? FourCC(strcat(std::setw(3), std::setfill('0'), std::hex, l, m))
         : FourCC(strcat(std::setw(3), std::setfill('0'), std::hex, l, 'T'));
 
+      // Store the mip tail first and the full-resolution mip last,
+      // so that low-detail data for all layers is loaded in one go
+      uint32_t layoutKey = metadata.mipTailStart - m;
+
       result.second.addSubFile(ident, IoArchiveCompression::eGDeflate,
-        m_rawSizes[index], std::move(m_compressedData[index]));
+        m_rawSizes[index], std::move(m_compressedData[index]), layoutKey);
     }
   }
 
@@ -394,6 +399,27 @@ std::pair<BuildResult, ArchiveFile> TextureBuildJob::build() {
 }
 
 
+bool TextureBuildJob::getCacheKey(
+        BuildCacheKey&                key) const {
+  key.add(FourCC('T', 'E', 'X', ' '));
+  key.add(m_desc.name);
+  key.add(m_desc.format);
+  key.add(m_desc.enableMips);
+  key.add(m_desc.enableCube);
+  key.add(m_desc.enableLayers);
+  key.add(m_desc.allowCompression);
+  key.add(m_desc.allowBc7);
+  key.add(uint64_t(m_inputs.size()));
+
+  for (const auto& input : m_inputs) {
+    if (!key.addFile(m_env.io, input))
+      return false;
+  }
+
+  return true;
+}
+
+
 void TextureBuildJob::generateMip(
   const GfxFormatInfo&                formatInfo,
         TextureImage*                 dstImage,
@@ -560,7 +586,7 @@ bool TextureBuildJob::compressChunk(
 
   m_rawSizes[dataIndex] = subresourceData.size();
 
-  return gdeflateEncode(Lwrap<WrVectorStream>(m_compressedData.at(dataIndex)), subresourceData);
+  return gdeflateEncode(m_env.jobs, Lwrap<WrVectorStream>(m_compressedData.at(dataIndex)), subresourceData);
 }
 
 
@@ -782,6 +782,23 @@ std::shared_ptr<GltfPackedVertexLayout> GltfPackedVertexLayoutMap::find(
 }
 
 
+std::vector<std::shared_ptr<GltfPackedVertexLayout>> GltfPackedVertexLayoutMap::getLayouts() const {
+  std::vector<std::pair<std::string, std::shared_ptr<GltfPackedVertexLayout>>> entries(m_map.begin(), m_map.end());
+
+  std::sort(entries.begin(), entries.end(), [] (const auto& a, const auto& b) {
+    return a.first < b.first;
+  });
+
+  std::vector<std::shared_ptr<GltfPackedVertexLayout>> result;
+  result.reserve(entries.size());
+
+  for (auto& entry : entries)
+    result.push_back(std::move(entry.second));
+
+  return result;
+}
+
+
 
 GltfMeshletBuilder::GltfMeshletBuilder(
         std::shared_ptr<GltfMeshPrimitive> primitive,
@@ -382,6 +382,12 @@ public:
   std::shared_ptr<GltfPackedVertexLayout> find(
     const char*                         name) const;
 
+  /**
+   * \brief Retrieves all vertex layouts
+   * \returns Vertex layout objects, ordered by name
+   */
+  std::vector<std::shared_ptr<GltfPackedVertexLayout>> getLayouts() const;
+
 private:
 
   std::unordered_map<std::string, std::shared_ptr<GltfPackedVertexLayout>> m_map;